@@ -2405,6 +2405,58 @@ static uint64_t do_ld8_mmu(CPUState *cpu, vaddr addr, MemOpIdx oi,
     return ret;
 }
 
+/*
+ * Specializations of do_ld4_mmu and do_ld8_mmu for data loads in host
+ * byte order with MO_ATOM_IFALIGN, which tcg selects at code generation
+ * time for the bulk of guest accesses.  With the byte order and the
+ * atomicity known, a load from RAM within one page is just the aligned
+ * host load, and a load across pages needs no test of the byte order.
+ * Only the alignment requirement is taken from @oi.
+ */
+static uint32_t do_ld4_he_mmu(CPUState *cpu, vaddr addr,
+                              MemOpIdx oi, uintptr_t ra)
+{
+    MMULookupLocals l;
+    bool crosspage;
+    uint32_t ret;
+
+    cpu_req_mo(cpu, TCG_MO_LD_LD | TCG_MO_ST_LD);
+    crosspage = mmu_lookup(cpu, addr, oi, ra, MMU_DATA_LOAD, &l);
+    if (likely(!crosspage)) {
+        if (likely(!(l.page[0].flags & (TLB_MMIO | TLB_BSWAP)))) {
+            return load_atom_4(cpu, ra, l.page[0].haddr, MO_UL);
+        }
+        return do_ld_4(cpu, &l.page[0], l.mmu_idx, MMU_DATA_LOAD,
+                       l.memop, ra);
+    }
+
+    ret = do_ld_beN(cpu, &l.page[0], 0, l.mmu_idx, MMU_DATA_LOAD, MO_UL, ra);
+    ret = do_ld_beN(cpu, &l.page[1], ret, l.mmu_idx, MMU_DATA_LOAD, MO_UL, ra);
+    return be32_to_cpu(ret);
+}
+
+static uint64_t do_ld8_he_mmu(CPUState *cpu, vaddr addr,
+                              MemOpIdx oi, uintptr_t ra)
+{
+    MMULookupLocals l;
+    bool crosspage;
+    uint64_t ret;
+
+    cpu_req_mo(cpu, TCG_MO_LD_LD | TCG_MO_ST_LD);
+    crosspage = mmu_lookup(cpu, addr, oi, ra, MMU_DATA_LOAD, &l);
+    if (likely(!crosspage)) {
+        if (likely(!(l.page[0].flags & (TLB_MMIO | TLB_BSWAP)))) {
+            return load_atom_8(cpu, ra, l.page[0].haddr, MO_UQ);
+        }
+        return do_ld_8(cpu, &l.page[0], l.mmu_idx, MMU_DATA_LOAD,
+                       l.memop, ra);
+    }
+
+    ret = do_ld_beN(cpu, &l.page[0], 0, l.mmu_idx, MMU_DATA_LOAD, MO_UQ, ra);
+    ret = do_ld_beN(cpu, &l.page[1], ret, l.mmu_idx, MMU_DATA_LOAD, MO_UQ, ra);
+    return be64_to_cpu(ret);
+}
+
 static Int128 do_ld16_mmu(CPUState *cpu, vaddr addr,
                           MemOpIdx oi, uintptr_t ra)
 {
@@ -2814,6 +2866,54 @@ static void do_st8_mmu(CPUState *cpu, vaddr addr, uint64_t val,
     (void) do_st_leN(cpu, &l.page[1], val, l.mmu_idx, l.memop, ra);
 }
 
+/*
+ * Specializations of do_st4_mmu and do_st8_mmu, the counterparts of
+ * do_ld4_he_mmu and do_ld8_he_mmu above.
+ */
+static void do_st4_he_mmu(CPUState *cpu, vaddr addr, uint32_t val,
+                          MemOpIdx oi, uintptr_t ra)
+{
+    MMULookupLocals l;
+    bool crosspage;
+
+    cpu_req_mo(cpu, TCG_MO_LD_ST | TCG_MO_ST_ST);
+    crosspage = mmu_lookup(cpu, addr, oi, ra, MMU_DATA_STORE, &l);
+    if (likely(!crosspage)) {
+        if (likely(!(l.page[0].flags
+                     & (TLB_MMIO | TLB_DISCARD_WRITE | TLB_BSWAP)))) {
+            store_atom_4(cpu, ra, l.page[0].haddr, MO_UL, val);
+        } else {
+            do_st_4(cpu, &l.page[0], val, l.mmu_idx, l.memop, ra);
+        }
+        return;
+    }
+
+    val = do_st_leN(cpu, &l.page[0], cpu_to_le32(val), l.mmu_idx, MO_UL, ra);
+    (void) do_st_leN(cpu, &l.page[1], val, l.mmu_idx, MO_UL, ra);
+}
+
+static void do_st8_he_mmu(CPUState *cpu, vaddr addr, uint64_t val,
+                          MemOpIdx oi, uintptr_t ra)
+{
+    MMULookupLocals l;
+    bool crosspage;
+
+    cpu_req_mo(cpu, TCG_MO_LD_ST | TCG_MO_ST_ST);
+    crosspage = mmu_lookup(cpu, addr, oi, ra, MMU_DATA_STORE, &l);
+    if (likely(!crosspage)) {
+        if (likely(!(l.page[0].flags
+                     & (TLB_MMIO | TLB_DISCARD_WRITE | TLB_BSWAP)))) {
+            store_atom_8(cpu, ra, l.page[0].haddr, MO_UQ, val);
+        } else {
+            do_st_8(cpu, &l.page[0], val, l.mmu_idx, l.memop, ra);
+        }
+        return;
+    }
+
+    val = do_st_leN(cpu, &l.page[0], cpu_to_le64(val), l.mmu_idx, MO_UQ, ra);
+    (void) do_st_leN(cpu, &l.page[1], val, l.mmu_idx, MO_UQ, ra);
+}
+
 static void do_st16_mmu(CPUState *cpu, vaddr addr, Int128 val,
                         MemOpIdx oi, uintptr_t ra)
 {
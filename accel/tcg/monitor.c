@@ -163,6 +163,8 @@ static void dump_exec_info(GString *buf)
      */
     g_string_append_printf(buf, "gen code size       %zu/%zu\n",
                            tcg_code_size(), tcg_code_capacity());
+    g_string_append_printf(buf, "gen code pages      %s\n",
+                           tcg_code_page_type());
     g_string_append_printf(buf, "TB count            %zu\n", nb_tbs);
     g_string_append_printf(buf, "TB avg target size  %zu max=%zu bytes\n",
                            nb_tbs ? tst.target_size / nb_tbs : 0,
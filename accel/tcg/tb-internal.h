@@ -38,6 +38,20 @@ static inline void tb_lock_page1(tb_page_addr_t p0, tb_page_addr_t p1)
 
 static inline void tb_unlock_page1(tb_page_addr_t p0, tb_page_addr_t p1) { }
 static inline void tb_unlock_pages(TranslationBlock *tb) { }
+
+/*
+ * Return true if writes to the code on the page containing @address
+ * are frequent enough that tb_lock_page0 no longer write-protects it;
+ * TBs using the page must then verify their code bytes on entry.
+ */
+bool page_smc_hot(tb_page_addr_t address);
+
+/*
+ * If the page containing @address is SMC-hot, return the counter that its
+ * self-checking TBs decrement on entry; helper_smc_cool is called when
+ * it reaches zero.  Otherwise return NULL.
+ */
+int32_t *page_smc_quiet_counter(tb_page_addr_t address);
 #else
 void tb_lock_page1(tb_page_addr_t, tb_page_addr_t);
 void tb_unlock_page1(tb_page_addr_t, tb_page_addr_t);
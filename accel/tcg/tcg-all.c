@@ -49,6 +49,7 @@ struct TCGState {
     OnOffAuto mttcg_enabled;
     bool one_insn_per_tb;
     int splitwx_enabled;
+    bool huge_pages;
     unsigned long tb_size;
 };
 typedef struct TCGState TCGState;
@@ -128,7 +129,8 @@ static int tcg_init_machine(MachineState *ms)
 
     page_init();
     tb_htable_init();
-    tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_threads);
+    tcg_init(s->tb_size * MiB, s->splitwx_enabled, s->huge_pages,
+             max_threads);
 
 #if defined(CONFIG_SOFTMMU)
     /*
@@ -205,6 +207,18 @@ static void tcg_set_splitwx(Object *obj, bool value, Error **errp)
     s->splitwx_enabled = value;
 }
 
+static bool tcg_get_huge_pages(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->huge_pages;
+}
+
+static void tcg_set_huge_pages(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->huge_pages = value;
+}
+
 static bool tcg_get_one_insn_per_tb(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -259,6 +273,11 @@ static void tcg_accel_class_init(ObjectClass *oc, const void *data)
     object_class_property_set_description(oc, "split-wx",
         "Map jit pages into separate RW and RX regions");
 
+    object_class_property_add_bool(oc, "huge-pages",
+        tcg_get_huge_pages, tcg_set_huge_pages);
+    object_class_property_set_description(oc, "huge-pages",
+        "Back the jit buffer with explicit huge pages");
+
     object_class_property_add_bool(oc, "one-insn-per-tb",
                                    tcg_get_one_insn_per_tb,
                                    tcg_set_one_insn_per_tb);
@@ -28,6 +28,11 @@ DEF_HELPER_FLAGS_1(lookup_tb_ptr, TCG_CALL_NO_WG_SE, cptr, env)
 
 DEF_HELPER_FLAGS_1(exit_atomic, TCG_CALL_NO_WG, noreturn, env)
 
+#ifdef CONFIG_USER_ONLY
+DEF_HELPER_FLAGS_1(smc_stale, TCG_CALL_NO_WG, noreturn, env)
+DEF_HELPER_FLAGS_1(smc_cool, TCG_CALL_NO_WG, noreturn, env)
+#endif
+
 #ifndef IN_HELPER_PROTO
 /*
  * Pass calls to memset directly to libc, without a thunk in qemu.
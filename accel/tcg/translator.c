@@ -9,6 +9,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/bswap.h"
+#include "qemu/host-utils.h"
 #include "qemu/log.h"
 #include "qemu/error-report.h"
 #include "accel/tcg/cpu-ldst-common.h"
@@ -103,6 +104,103 @@ static void gen_tb_end(const TranslationBlock *tb, uint32_t cflags,
     }
 }
 
+#ifdef CONFIG_USER_ONLY
+static void gen_smc_check_bytes(const uint8_t *host, size_t len,
+                                TCGLabel *stale)
+{
+    while (len) {
+        size_t n = MIN(pow2floor(len), sizeof(uintptr_t));
+
+        /* The host loads must be aligned. */
+        while ((uintptr_t)host & (n - 1)) {
+            n >>= 1;
+        }
+
+        if (n == 8) {
+            TCGv_i64 t = tcg_temp_new_i64();
+            tcg_gen_ld_i64(t, tcg_constant_ptr(host), 0);
+            tcg_gen_brcondi_i64(TCG_COND_NE, t, ldq_he_p(host), stale);
+        } else {
+            TCGv_i32 t = tcg_temp_new_i32();
+            TCGv_ptr p = tcg_constant_ptr(host);
+            int32_t v;
+
+            switch (n) {
+            case 4:
+                tcg_gen_ld_i32(t, p, 0);
+                v = ldl_he_p(host);
+                break;
+            case 2:
+                tcg_gen_ld16u_i32(t, p, 0);
+                v = lduw_he_p(host);
+                break;
+            default:
+                tcg_gen_ld8u_i32(t, p, 0);
+                v = ldub_p(host);
+                break;
+            }
+            tcg_gen_brcondi_i32(TCG_COND_NE, t, v, stale);
+        }
+        host += n;
+        len -= n;
+    }
+}
+
+/*
+ * If the code of this TB lies on a page which is not write-protected
+ * because it is modified too often (see page_smc_hot), compare the guest
+ * code bytes with the ones we translated before executing the first insn,
+ * and discard the TB if they differ.  Also count down the executions
+ * left before the page is considered cold again.
+ */
+static void gen_smc_check(DisasContextBase *db, TCGOp *first_insn_start)
+{
+    tb_page_addr_t page0 = tb_page_addr0(db->tb);
+    tb_page_addr_t page1 = tb_page_addr1(db->tb);
+    size_t size = db->pc_next - db->pc_first;
+    size_t len0;
+    int32_t *quiet;
+    TCGLabel *stale, *cool;
+    TCGv_ptr quiet_ptr;
+    TCGv_i32 t;
+
+    if (db->fake_insn || page0 == -1) {
+        return;
+    }
+    quiet = page_smc_quiet_counter(page0);
+    if (!quiet && page1 != -1) {
+        quiet = page_smc_quiet_counter(page1);
+    }
+    if (!quiet) {
+        return;
+    }
+
+    len0 = MIN(size, -(db->pc_first | TARGET_PAGE_MASK));
+    stale = gen_new_label();
+    cool = gen_new_label();
+
+    tcg_ctx->emit_before_op = first_insn_start;
+    gen_smc_check_bytes(db->host_addr[0], len0, stale);
+    if (size > len0) {
+        gen_smc_check_bytes(db->host_addr[1], size - len0, stale);
+    }
+
+    /* Racy between threads, but the count need not be exact. */
+    quiet_ptr = tcg_constant_ptr(quiet);
+    t = tcg_temp_new_i32();
+    tcg_gen_ld_i32(t, quiet_ptr, 0);
+    tcg_gen_subi_i32(t, t, 1);
+    tcg_gen_st_i32(t, quiet_ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_LE, t, 0, cool);
+    tcg_ctx->emit_before_op = NULL;
+
+    gen_set_label(cool);
+    gen_helper_smc_cool(tcg_env);
+    gen_set_label(stale);
+    gen_helper_smc_stale(tcg_env);
+}
+#endif
+
 bool translator_is_same_page(const DisasContextBase *db, vaddr addr)
 {
     return ((addr ^ db->pc_first) & TARGET_PAGE_MASK) == 0;
@@ -143,6 +241,18 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     db->record_len = 0;
     db->code_mmuidx = cpu_mmu_index(cpu, true);
 
+#ifdef CONFIG_USER_ONLY
+    /*
+     * A page with self-checking TBs is writable, so a store that modifies
+     * a later insn of the same TB goes unnoticed.  Where the target must
+     * honour that, translate one insn per TB; the next TB checks itself.
+     */
+    if (cpu->cc->tcg_ops->precise_smc && tb_page_addr0(tb) != -1
+        && page_smc_hot(tb_page_addr0(tb))) {
+        db->max_insns = 1;
+    }
+#endif
+
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
@@ -220,6 +330,10 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     set_can_do_io(db, true);
     tcg_ctx->emit_before_op = NULL;
 
+#ifdef CONFIG_USER_ONLY
+    gen_smc_check(db, first_insn_start);
+#endif
+
     /* May be used by disas_log or plugin callbacks. */
     tb->size = db->pc_next - db->pc_first;
     tb->icount = db->num_insns;
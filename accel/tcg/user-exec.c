@@ -500,6 +500,185 @@ static bool pageflags_set_clear(vaddr start, vaddr last,
     return inval_tb;
 }
 
+/*
+ * Pages on which code is repeatedly modified, e.g. by a JIT that places
+ * data next to its code, or that patches call sites in place.  Each write
+ * to a protected page costs a SIGSEGV and two mprotect calls, so once a
+ * page has been unprotected SMC_HOT_THRESHOLD times we stop protecting
+ * it.  Instead, each TB that uses the page compares its guest code bytes
+ * on entry (see translator_loop), and is discarded by helper_smc_stale
+ * if they changed.
+ *
+ * Code that is rewritten in a burst and then runs for a long time should
+ * not stay on self-checking TBs forever.  The checking TBs count down
+ * SMCPage::quiet on entry, and any change found by the check resets it.
+ * When it runs out, helper_smc_cool discards the TBs of the page and
+ * halves its fault count, so that the page is protected again and gets
+ * normal TBs, and only becomes hot again after a few more faults.
+ *
+ * The map is keyed by the start of the unit of protection, which is the
+ * larger of the host and target page, and is protected by mmap_lock.
+ */
+#define SMC_HOT_THRESHOLD  8
+#define SMC_QUIET_EXECS    65536
+
+typedef struct SMCPage {
+    unsigned faults;
+    /* Decremented by generated code without mmap_lock */
+    int32_t quiet;
+    /* Generated code may point to @quiet, so the entry must not be freed */
+    bool referenced;
+} SMCPage;
+
+static GHashTable *smc_pages;
+
+static vaddr smc_unit_start(vaddr address)
+{
+    int host_page_size = qemu_real_host_page_size();
+
+    if (host_page_size <= TARGET_PAGE_SIZE) {
+        return address & TARGET_PAGE_MASK;
+    }
+    return address & -host_page_size;
+}
+
+static vaddr smc_unit_last(vaddr address)
+{
+    return smc_unit_start(address)
+        + MAX(qemu_real_host_page_size(), TARGET_PAGE_SIZE) - 1;
+}
+
+static SMCPage *smc_page_find(vaddr start)
+{
+    if (!smc_pages) {
+        return NULL;
+    }
+    return g_hash_table_lookup(smc_pages, (gpointer)(uintptr_t)start);
+}
+
+static unsigned smc_fault_get(vaddr start)
+{
+    SMCPage *p = smc_page_find(start);
+
+    return p ? p->faults : 0;
+}
+
+static void smc_fault_add(vaddr start)
+{
+    SMCPage *p = smc_page_find(start);
+
+    if (!p) {
+        if (!smc_pages) {
+            smc_pages = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+        }
+        p = g_new0(SMCPage, 1);
+        g_hash_table_insert(smc_pages, (gpointer)(uintptr_t)start, p);
+    }
+    if (p->faults < SMC_HOT_THRESHOLD && ++p->faults == SMC_HOT_THRESHOLD) {
+        qatomic_set(&p->quiet, SMC_QUIET_EXECS);
+    }
+}
+
+static gboolean smc_fault_reset_one(gpointer key, gpointer value,
+                                    gpointer opaque)
+{
+    vaddr *range = opaque;
+    vaddr start = (uintptr_t)key;
+    SMCPage *p = value;
+
+    if (start < smc_unit_start(range[0]) || start > range[1]) {
+        return false;
+    }
+    p->faults = 0;
+    return !p->referenced;
+}
+
+static void smc_fault_reset(vaddr start, vaddr last)
+{
+    if (smc_pages && g_hash_table_size(smc_pages)) {
+        vaddr range[2] = { start, last };
+        g_hash_table_foreach_remove(smc_pages, smc_fault_reset_one, range);
+    }
+}
+
+bool page_smc_hot(tb_page_addr_t address)
+{
+    assert_memory_lock();
+    return smc_fault_get(smc_unit_start(address)) >= SMC_HOT_THRESHOLD;
+}
+
+int32_t *page_smc_quiet_counter(tb_page_addr_t address)
+{
+    SMCPage *p;
+
+    assert_memory_lock();
+    p = smc_page_find(smc_unit_start(address));
+    if (!p || p->faults < SMC_HOT_THRESHOLD) {
+        return NULL;
+    }
+    p->referenced = true;
+    return &p->quiet;
+}
+
+/*
+ * Restore the state for the first insn of the TB that called a
+ * self-check helper and return the TB.  The check is made before the
+ * first guest insn has done anything, whatever the position of the call
+ * within the generated code.
+ */
+static TranslationBlock *smc_check_restore(CPUState *cpu, uintptr_t retaddr)
+{
+    TranslationBlock *tb = tcg_tb_lookup(retaddr);
+
+    cpu_restore_state_from_tb(cpu, tb, (uintptr_t)tb->tc.ptr + GETPC_ADJ);
+    return tb;
+}
+
+void HELPER(smc_stale)(CPUArchState *env)
+{
+    CPUState *cpu = env_cpu(env);
+    TranslationBlock *tb = smc_check_restore(cpu, GETPC());
+    tb_page_addr_t page[2] = { tb_page_addr0(tb), tb_page_addr1(tb) };
+
+    mmap_lock();
+    /* The code is still being modified, so keep the page hot. */
+    for (int i = 0; i < ARRAY_SIZE(page); i++) {
+        SMCPage *p = page[i] == -1 ? NULL
+                     : smc_page_find(smc_unit_start(page[i]));
+        if (p) {
+            qatomic_set(&p->quiet, SMC_QUIET_EXECS);
+        }
+    }
+    tb_phys_invalidate(tb, -1);
+    mmap_unlock();
+
+    cpu_loop_exit_noexc(cpu);
+}
+
+void HELPER(smc_cool)(CPUArchState *env)
+{
+    CPUState *cpu = env_cpu(env);
+    TranslationBlock *tb = smc_check_restore(cpu, GETPC());
+    tb_page_addr_t page[2] = { tb_page_addr0(tb), tb_page_addr1(tb) };
+
+    mmap_lock();
+    for (int i = 0; i < ARRAY_SIZE(page); i++) {
+        SMCPage *p = page[i] == -1 ? NULL
+                     : smc_page_find(smc_unit_start(page[i]));
+
+        /* Another thread may have cooled the page already. */
+        if (p && p->faults >= SMC_HOT_THRESHOLD) {
+            p->faults = SMC_HOT_THRESHOLD / 2;
+            tb_invalidate_phys_range(cpu, smc_unit_start(page[i]),
+                                     smc_unit_last(page[i]));
+        }
+    }
+    tb_phys_invalidate(tb, -1);
+    mmap_unlock();
+
+    cpu_loop_exit_noexc(cpu);
+}
+
 void page_set_flags(vaddr start, vaddr last, int flags)
 {
     bool reset = false;
@@ -529,6 +708,7 @@ void page_set_flags(vaddr start, vaddr last, int flags)
 
     if (!flags || reset) {
         page_reset_target_data(start, last);
+        smc_fault_reset(start, last);
         inval_tb |= pageflags_unset(start, last);
     }
     if (flags) {
@@ -682,6 +862,11 @@ void tb_lock_page0(tb_page_addr_t address)
         last = start + host_page_size - 1;
     }
 
+    /* TBs on this page check themselves; leave it writable. */
+    if (smc_fault_get(start) >= SMC_HOT_THRESHOLD) {
+        return;
+    }
+
     p = pageflags_find(start, last);
     if (!p) {
         return;
@@ -786,6 +971,7 @@ int page_unprotect(CPUState *cpu, tb_page_addr_t address, uintptr_t pc)
             prot = (prot & ~PAGE_EXEC) | PAGE_READ;
         }
         mprotect((void *)g2h_untagged(start), len, prot & PAGE_RWX);
+        smc_fault_add(start);
     }
     mmap_unlock();
 
@@ -1144,6 +1330,38 @@ static uint64_t do_ld8_mmu(CPUState *cpu, vaddr addr, MemOpIdx oi,
     return ret;
 }
 
+/*
+ * Specializations of do_ld4_mmu and do_ld8_mmu for data loads in host
+ * byte order with MO_ATOM_IFALIGN, which tcg selects at code generation
+ * time for the bulk of guest accesses.  Only the alignment requirement
+ * is taken from @oi.
+ */
+static uint32_t do_ld4_he_mmu(CPUState *cpu, vaddr addr,
+                              MemOpIdx oi, uintptr_t ra)
+{
+    void *haddr;
+    uint32_t ret;
+
+    cpu_req_mo(cpu, TCG_MO_LD_LD | TCG_MO_ST_LD);
+    haddr = cpu_mmu_lookup(cpu, addr, get_memop(oi), ra, MMU_DATA_LOAD);
+    ret = load_atom_4(cpu, ra, haddr, MO_UL);
+    clear_helper_retaddr();
+    return ret;
+}
+
+static uint64_t do_ld8_he_mmu(CPUState *cpu, vaddr addr,
+                              MemOpIdx oi, uintptr_t ra)
+{
+    void *haddr;
+    uint64_t ret;
+
+    cpu_req_mo(cpu, TCG_MO_LD_LD | TCG_MO_ST_LD);
+    haddr = cpu_mmu_lookup(cpu, addr, get_memop(oi), ra, MMU_DATA_LOAD);
+    ret = load_atom_8(cpu, ra, haddr, MO_UQ);
+    clear_helper_retaddr();
+    return ret;
+}
+
 static Int128 do_ld16_mmu(CPUState *cpu, vaddr addr,
                           MemOpIdx oi, uintptr_t ra)
 {
@@ -1222,6 +1440,32 @@ static void do_st8_mmu(CPUState *cpu, vaddr addr, uint64_t val,
     clear_helper_retaddr();
 }
 
+/*
+ * Specializations of do_st4_mmu and do_st8_mmu, the counterparts of
+ * do_ld4_he_mmu and do_ld8_he_mmu above.
+ */
+static void do_st4_he_mmu(CPUState *cpu, vaddr addr, uint32_t val,
+                          MemOpIdx oi, uintptr_t ra)
+{
+    void *haddr;
+
+    cpu_req_mo(cpu, TCG_MO_LD_ST | TCG_MO_ST_ST);
+    haddr = cpu_mmu_lookup(cpu, addr, get_memop(oi), ra, MMU_DATA_STORE);
+    store_atom_4(cpu, ra, haddr, MO_UL, val);
+    clear_helper_retaddr();
+}
+
+static void do_st8_he_mmu(CPUState *cpu, vaddr addr, uint64_t val,
+                          MemOpIdx oi, uintptr_t ra)
+{
+    void *haddr;
+
+    cpu_req_mo(cpu, TCG_MO_LD_ST | TCG_MO_ST_ST);
+    haddr = cpu_mmu_lookup(cpu, addr, get_memop(oi), ra, MMU_DATA_STORE);
+    store_atom_8(cpu, ra, haddr, MO_UQ, val);
+    clear_helper_retaddr();
+}
+
 static void do_st16_mmu(CPUState *cpu, vaddr addr, Int128 val,
                         MemOpIdx oi, uintptr_t ra)
 {
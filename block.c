@@ -427,8 +427,8 @@ BlockDriverState *bdrv_new(void)
 
     qemu_co_queue_init(&bs->flush_queue);
 
-    qemu_co_mutex_init(&bs->bsc_modify_lock);
-    bs->block_status_cache = g_new0(BdrvBlockStatusCache, 1);
+    qemu_mutex_init(&bs->block_status_cache.lock);
+    QTAILQ_INIT(&bs->block_status_cache.lru);
 
     for (i = 0; i < bdrv_drain_all_count; i++) {
         bdrv_drained_begin(bs);
@@ -1489,6 +1489,8 @@ static void GRAPH_WRLOCK bdrv_child_cb_detach(BdrvChild *child)
 
     assert_bdrv_graph_writable();
     QLIST_REMOVE(child, next);
+    /* Cached results may refer to the child */
+    bdrv_bsc_invalidate(bs);
     if (child == bs->backing) {
         assert(child != bs->file);
         bs->backing = NULL;
@@ -5113,6 +5115,7 @@ static void GRAPH_UNLOCKED bdrv_reopen_commit(BDRVReopenState *reopen_state)
     if (drv->bdrv_reopen_commit) {
         drv->bdrv_reopen_commit(reopen_state);
     }
+    bdrv_bsc_invalidate(bs);
 
     GRAPH_RDLOCK_GUARD_MAINLOOP();
 
@@ -5205,8 +5208,7 @@ static void bdrv_close(BlockDriverState *bs)
     bs->explicit_options = NULL;
     qobject_unref(bs->full_open_options);
     bs->full_open_options = NULL;
-    g_free(bs->block_status_cache);
-    bs->block_status_cache = NULL;
+    bdrv_bsc_invalidate(bs);
 
     bdrv_release_named_dirty_bitmaps(bs);
     assert(QLIST_EMPTY(&bs->dirty_bitmaps));
@@ -5590,6 +5592,7 @@ static void bdrv_delete(BlockDriverState *bs)
     bdrv_close(bs);
 
     qemu_mutex_destroy(&bs->reqs_lock);
+    qemu_mutex_destroy(&bs->block_status_cache.lock);
 
     g_free(bs);
 }
@@ -5689,6 +5692,10 @@ int coroutine_fn bdrv_co_check(BlockDriverState *bs,
     }
 
     memset(res, 0, sizeof(*res));
+    if (fix) {
+        /* Repairs change the metadata behind the block-status cache */
+        bdrv_bsc_invalidate(bs);
+    }
     return bs->drv->bdrv_co_check(bs, res, fix);
 }
 
@@ -6954,6 +6961,7 @@ int coroutine_fn bdrv_co_invalidate_cache(BlockDriverState *bs, Error **errp)
     assert(!(bs->open_flags & BDRV_O_INACTIVE));
     assert_bdrv_graph_readable();
 
+    bdrv_bsc_invalidate(bs);
     if (bs->drv->bdrv_co_invalidate_cache) {
         bs->drv->bdrv_co_invalidate_cache(bs, &local_err);
         if (local_err) {
@@ -7860,6 +7868,7 @@ int bdrv_amend_options(BlockDriverState *bs, QemuOpts *opts,
                    bs->drv->format_name);
         return -ENOTSUP;
     }
+    bdrv_bsc_invalidate(bs);
     return bs->drv->bdrv_amend_options(bs, opts, status_cb,
                                        cb_opaque, force, errp);
 }
@@ -8321,6 +8330,7 @@ int bdrv_make_empty(BdrvChild *c, Error **errp)
     }
 
     ret = drv->bdrv_make_empty(c->bs);
+    bdrv_bsc_invalidate(c->bs);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Failed to empty %s",
                          c->bs->filename);
@@ -8491,41 +8501,153 @@ BlockDriverState *bdrv_backing_chain_next(BlockDriverState *bs)
     return bdrv_skip_filters(bdrv_cow_bs(bdrv_skip_filters(bs)));
 }
 
+static void bdrv_bsc_remove_locked(BdrvBlockStatusCache *bsc,
+                                   BdrvBlockStatusCacheEntry *e)
+{
+    interval_tree_remove(&e->node, &bsc->tree);
+    QTAILQ_REMOVE(&bsc->lru, e, lru);
+    qatomic_set(&bsc->nb_entries, bsc->nb_entries - 1);
+    g_free(e);
+}
+
+static void bdrv_bsc_remove_range_locked(BdrvBlockStatusCache *bsc,
+                                         int64_t offset, int64_t bytes)
+{
+    IntervalTreeNode *node, *next;
+
+    node = interval_tree_iter_first(&bsc->tree, offset, offset + bytes - 1);
+    while (node) {
+        next = interval_tree_iter_next(node, offset, offset + bytes - 1);
+        bdrv_bsc_remove_locked(bsc, container_of(node,
+                                                 BdrvBlockStatusCacheEntry,
+                                                 node));
+        node = next;
+    }
+}
+
+static BdrvBlockStatusCacheEntry *
+bdrv_bsc_find_locked(BdrvBlockStatusCache *bsc, int64_t offset)
+{
+    IntervalTreeNode *node = interval_tree_iter_first(&bsc->tree,
+                                                      offset, offset);
+
+    return node ? container_of(node, BdrvBlockStatusCacheEntry, node) : NULL;
+}
+
+/*
+ * Whether @b directly follows @a and has the same status, so that both can
+ * be merged into one region.
+ */
+static bool bdrv_bsc_can_merge(BdrvBlockStatusCacheEntry *a,
+                               BdrvBlockStatusCacheEntry *b)
+{
+    if (a->node.last + 1 != b->node.start ||
+        a->ret != b->ret || a->file != b->file) {
+        return false;
+    }
+    return !(a->ret & BDRV_BLOCK_OFFSET_VALID) ||
+           a->map + (b->node.start - a->node.start) == b->map;
+}
+
 /**
- * Check whether [offset, offset + bytes) overlaps with the cached
- * block-status data region.
- *
- * If so, and @pnum is not NULL, set *pnum to `bsc.data_end - offset`,
- * which is what bdrv_bsc_is_data()'s interface needs.
- * Otherwise, *pnum is not touched.
+ * See block_int.h for this function's documentation.
  */
-static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
-                                           int64_t offset, int64_t bytes,
-                                           int64_t *pnum)
+bool bdrv_bsc_lookup(BlockDriverState *bs, int64_t offset, int *ret,
+                     int64_t *pnum, int64_t *map, BlockDriverState **file)
 {
-    BdrvBlockStatusCache *bsc = qatomic_rcu_read(&bs->block_status_cache);
-    bool overlaps;
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    BdrvBlockStatusCacheEntry *e;
+    IO_CODE();
 
-    overlaps =
-        qatomic_read(&bsc->valid) &&
-        ranges_overlap(offset, bytes, bsc->data_start,
-                       bsc->data_end - bsc->data_start);
+    if (!qatomic_read(&bsc->nb_entries)) {
+        return false;
+    }
+
+    QEMU_LOCK_GUARD(&bsc->lock);
 
-    if (overlaps && pnum) {
-        *pnum = bsc->data_end - offset;
+    e = bdrv_bsc_find_locked(bsc, offset);
+    if (!e) {
+        return false;
     }
 
-    return overlaps;
+    QTAILQ_REMOVE(&bsc->lru, e, lru);
+    QTAILQ_INSERT_TAIL(&bsc->lru, e, lru);
+
+    *ret = e->ret;
+    *pnum = e->node.last + 1 - offset;
+    *map = e->map + (offset - e->node.start);
+    *file = e->file;
+    return true;
 }
 
 /**
  * See block_int.h for this function's documentation.
  */
-bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
+unsigned int bdrv_bsc_generation(BlockDriverState *bs)
 {
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
-    return bdrv_bsc_range_overlaps_locked(bs, offset, 1, pnum);
+    return qatomic_read(&bs->block_status_cache.generation);
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_bsc_fill(BlockDriverState *bs, unsigned int generation,
+                   int64_t granularity, int64_t offset, int64_t bytes,
+                   int ret, int64_t map, BlockDriverState *file)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    BdrvBlockStatusCacheEntry *e, *prev, *next;
+    IO_CODE();
+
+    assert(bytes > 0 && !(ret & BDRV_BLOCK_EOF));
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+
+    if (qatomic_read(&bsc->generation) != generation) {
+        return;
+    }
+    bsc->granularity = granularity;
+
+    e = g_new(BdrvBlockStatusCacheEntry, 1);
+    *e = (BdrvBlockStatusCacheEntry) {
+        .node.start = offset,
+        .node.last  = offset + bytes - 1,
+        .ret        = ret,
+        .map        = ret & BDRV_BLOCK_OFFSET_VALID ? map : 0,
+        .file       = file,
+    };
+
+    /* Overlapping regions can only be stale, or identical to the new one */
+    bdrv_bsc_remove_range_locked(bsc, offset, bytes);
+
+    prev = offset > 0 ? bdrv_bsc_find_locked(bsc, offset - 1) : NULL;
+    if (prev && bdrv_bsc_can_merge(prev, e)) {
+        e->node.start = prev->node.start;
+        e->map = prev->map;
+        bdrv_bsc_remove_locked(bsc, prev);
+    }
+    next = bdrv_bsc_find_locked(bsc, e->node.last + 1);
+    if (next && bdrv_bsc_can_merge(e, next)) {
+        e->node.last = next->node.last;
+        bdrv_bsc_remove_locked(bsc, next);
+    }
+
+    if (bsc->nb_entries >= BDRV_BSC_MAX_ENTRIES) {
+        bdrv_bsc_remove_locked(bsc, QTAILQ_FIRST(&bsc->lru));
+    }
+    interval_tree_insert(&e->node, &bsc->tree);
+    QTAILQ_INSERT_TAIL(&bsc->lru, e, lru);
+    qatomic_set(&bsc->nb_entries, bsc->nb_entries + 1);
+
+    /*
+     * Pairs with bdrv_bsc_invalidate_range(): Either it sees the new entry
+     * and removes it, or we see its new generation here.
+     */
+    smp_mb();
+    if (qatomic_read(&bsc->generation) != generation) {
+        bdrv_bsc_remove_locked(bsc, e);
+    }
 }
 
 /**
@@ -8534,34 +8656,40 @@ bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes)
 {
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
 
-    if (bdrv_bsc_range_overlaps_locked(bs, offset, bytes, NULL)) {
-        qatomic_set(&bs->block_status_cache->valid, false);
+    /* Full barrier, pairs with the one in bdrv_bsc_fill() */
+    qatomic_inc(&bsc->generation);
+    if (!qatomic_read(&bsc->nb_entries) || !bytes) {
+        return;
     }
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+    if (bsc->granularity) {
+        int64_t end = QEMU_ALIGN_UP(offset + bytes, bsc->granularity);
+
+        offset = QEMU_ALIGN_DOWN(offset, bsc->granularity);
+        bytes = end - offset;
+    }
+    bdrv_bsc_remove_range_locked(bsc, offset, bytes);
 }
 
 /**
  * See block_int.h for this function's documentation.
  */
-void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
+void bdrv_bsc_invalidate(BlockDriverState *bs)
 {
-    BdrvBlockStatusCache *new_bsc = g_new(BdrvBlockStatusCache, 1);
-    BdrvBlockStatusCache *old_bsc;
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
     IO_CODE();
 
-    *new_bsc = (BdrvBlockStatusCache) {
-        .valid = true,
-        .data_start = offset,
-        .data_end = offset + bytes,
-    };
-
-    QEMU_LOCK_GUARD(&bs->bsc_modify_lock);
+    qatomic_inc(&bsc->generation);
+    if (!qatomic_read(&bsc->nb_entries)) {
+        return;
+    }
 
-    old_bsc = qatomic_rcu_read(&bs->block_status_cache);
-    qatomic_rcu_set(&bs->block_status_cache, new_bsc);
-    if (old_bsc) {
-        g_free_rcu(old_bsc, rcu);
+    QEMU_LOCK_GUARD(&bsc->lock);
+    while (!QTAILQ_EMPTY(&bsc->lru)) {
+        bdrv_bsc_remove_locked(bsc, QTAILQ_FIRST(&bsc->lru));
     }
 }
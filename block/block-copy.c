@@ -36,6 +36,13 @@
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
 #define BLOCK_COPY_CLUSTER_SIZE_DEFAULT (1 << 16)
 
+/* Adaptive sizing, see block_copy_adapt() */
+#define BLOCK_COPY_ADAPT_INTERVAL (100 * SCALE_MS)
+#define BLOCK_COPY_ADAPT_LATENCY (50 * SCALE_MS)
+/* Bounds for the number of queued requests, in 1/16ths */
+#define BLOCK_COPY_ADAPT_ALPHA 16
+#define BLOCK_COPY_ADAPT_BETA 48
+
 typedef enum {
     COPY_READ_WRITE_CLUSTER,
     COPY_READ_WRITE,
@@ -53,6 +60,7 @@ typedef struct BlockCopyCallState {
     int64_t bytes;
     int max_workers;
     int64_t max_chunk;
+    bool adaptive;
     bool ignore_ratelimit;
     BlockCopyAsyncCallbackFunc cb;
     void *cb_opaque;
@@ -155,6 +163,23 @@ typedef struct BlockCopyState {
      * block_copy_reset_unallocated() every time it does.
      */
     bool skip_unallocated; /* atomic */
+
+    /*
+     * Adaptive sizing of the tasks of block_copy_async() calls that ask for
+     * it.  @workers and @chunk are also read atomically without the lock.
+     */
+    bool rate_limited; /* atomic */
+    struct {
+        int workers;
+        int64_t chunk;
+        bool slow_start;
+        int64_t start_ns;       /* Start of the current interval */
+        uint64_t bytes;         /* Copied in the current interval */
+        uint64_t lat_ns;        /* Sum of the latencies of these tasks */
+        uint64_t tasks;
+        uint64_t base_lat;      /* Lowest latency per KiB seen */
+    } adapt;
+
     /* State fields that use a thread-safe API */
     BdrvDirtyBitmap *copy_bitmap;
     ProgressMeter *progress;
@@ -181,6 +206,108 @@ static int64_t block_copy_chunk_size(BlockCopyState *s)
     }
 }
 
+/*
+ * Tasks that copy through a bounce buffer take it from s->mem, which
+ * copy-before-write operations share with the background copying.  Do not
+ * let adaptive sizing grow them beyond BLOCK_COPY_MAX_BUFFER, so that a few
+ * large background tasks cannot take all of that memory and stall guest
+ * writes.  Only copy_range requests, which need no buffer, may be larger.
+ *
+ * Called with lock held
+ */
+static int64_t block_copy_adapt_max_chunk(BlockCopyState *s,
+                                          BlockCopyCallState *call_state)
+{
+    return MIN_NON_ZERO(block_copy_chunk_size(s), call_state->max_chunk);
+}
+
+/* Called with lock held */
+static void block_copy_adapt_account(BlockCopyState *s, int64_t bytes,
+                                     int64_t lat_ns)
+{
+    s->adapt.bytes += bytes;
+    s->adapt.lat_ns += lat_ns;
+    s->adapt.tasks++;
+}
+
+/*
+ * Choose the number of parallel tasks and their size from what the
+ * storage did in the last interval, the way TCP Vegas chooses its
+ * congestion window.  The lowest latency per byte seen is taken as what
+ * the storage does when it is not loaded.  From the current latency
+ * follows how many of our requests are queued in the storage instead of
+ * being worked on.  Add a worker while fewer than BLOCK_COPY_ADAPT_ALPHA
+ * are queued (doubling them at first, like TCP slow start), and remove
+ * one when more than BLOCK_COPY_ADAPT_BETA are.
+ *
+ * Larger tasks have less overhead per byte, but guest writes that hit an
+ * area being copied wait for the task, so grow them only while a task
+ * takes less than half of BLOCK_COPY_ADAPT_LATENCY, and shrink them when
+ * one takes more than twice that.
+ *
+ * Called with lock held
+ */
+static void block_copy_adapt(BlockCopyState *s, BlockCopyCallState *call_state)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t max_chunk = block_copy_adapt_max_chunk(s, call_state);
+    int workers = s->adapt.workers;
+    int64_t chunk = s->adapt.chunk;
+    uint64_t lat, task_lat, queued;
+
+    if (!workers) {
+        /* First call */
+        workers = 1;
+        chunk = MIN(block_copy_chunk_size(s), max_chunk);
+        s->adapt.slow_start = true;
+        s->adapt.start_ns = now;
+    } else if (now - s->adapt.start_ns >= BLOCK_COPY_ADAPT_INTERVAL &&
+               s->adapt.tasks) {
+        lat = s->adapt.lat_ns / MAX(s->adapt.bytes / KiB, 1);
+        if (!s->adapt.base_lat || lat < s->adapt.base_lat) {
+            s->adapt.base_lat = lat;
+        } else {
+            /* Slowly forget it, in case the storage got slower for good */
+            s->adapt.base_lat += (lat - s->adapt.base_lat) / 16;
+        }
+
+        queued = 16 * workers * (lat - s->adapt.base_lat) / MAX(lat, 1);
+        if (queued < BLOCK_COPY_ADAPT_ALPHA) {
+            workers = s->adapt.slow_start ? workers * 2 : workers + 1;
+        } else {
+            s->adapt.slow_start = false;
+            if (queued > BLOCK_COPY_ADAPT_BETA) {
+                workers--;
+            }
+        }
+
+        task_lat = s->adapt.lat_ns / s->adapt.tasks;
+        if (task_lat < BLOCK_COPY_ADAPT_LATENCY / 2) {
+            chunk *= 2;
+        } else if (task_lat > BLOCK_COPY_ADAPT_LATENCY * 2) {
+            chunk /= 2;
+        }
+
+        trace_block_copy_adapt(s, lat, s->adapt.base_lat, task_lat);
+
+        s->adapt.start_ns = now;
+        s->adapt.bytes = 0;
+        s->adapt.lat_ns = 0;
+        s->adapt.tasks = 0;
+    }
+
+    workers = MAX(MIN(workers, call_state->max_workers), 1);
+    if (workers == call_state->max_workers) {
+        s->adapt.slow_start = false;
+    }
+    chunk = MAX(MIN(chunk, max_chunk), s->cluster_size);
+    if (workers != s->adapt.workers || chunk != s->adapt.chunk) {
+        trace_block_copy_adapt_set(s, workers, chunk);
+    }
+    qatomic_set(&s->adapt.workers, workers);
+    qatomic_set(&s->adapt.chunk, chunk);
+}
+
 /*
  * Search for the first dirty area in offset/bytes range and create task at
  * the beginning of it.
@@ -193,7 +320,14 @@ block_copy_task_create(BlockCopyState *s, BlockCopyCallState *call_state,
     int64_t max_chunk;
 
     QEMU_LOCK_GUARD(&s->lock);
-    max_chunk = MIN_NON_ZERO(block_copy_chunk_size(s), call_state->max_chunk);
+    /* With a speed limit, the storage is not what limits the throughput */
+    if (call_state->adaptive && !qatomic_read(&s->rate_limited)) {
+        block_copy_adapt(s, call_state);
+        max_chunk = s->adapt.chunk;
+    } else {
+        max_chunk = MIN_NON_ZERO(block_copy_chunk_size(s),
+                                 call_state->max_chunk);
+    }
     if (!bdrv_dirty_bitmap_next_dirty_area(s->copy_bitmap,
                                            offset, offset + bytes,
                                            max_chunk, &offset, &bytes))
@@ -584,6 +718,7 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     int ret = -1;
 
     WITH_GRAPH_RDLOCK_GUARD() {
@@ -596,6 +731,13 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
             s->method = method;
         }
 
+        /* Zeroes are written without copying, so they say nothing */
+        if (ret >= 0 && t->call_state->adaptive &&
+            t->method != COPY_WRITE_ZEROES) {
+            block_copy_adapt_account(s, t->req.bytes,
+                qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns);
+        }
+
         if (ret < 0) {
             if (!t->call_state->ret) {
                 t->call_state->ret = ret;
@@ -824,6 +966,14 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         if (!aio && bytes) {
             aio = aio_task_pool_new(call_state->max_workers);
         }
+        if (aio && call_state->adaptive) {
+            int workers = qatomic_read(&s->adapt.workers);
+
+            if (qatomic_read(&s->rate_limited) || !workers) {
+                workers = call_state->max_workers;
+            }
+            aio_task_pool_set_max_busy_tasks(aio, workers);
+        }
 
         ret = block_copy_task_run(aio, task);
         if (ret < 0) {
@@ -972,6 +1122,7 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t start, int64_t bytes,
 BlockCopyCallState *block_copy_async(BlockCopyState *s,
                                      int64_t offset, int64_t bytes,
                                      int max_workers, int64_t max_chunk,
+                                     bool adaptive,
                                      BlockCopyAsyncCallbackFunc cb,
                                      void *cb_opaque)
 {
@@ -983,6 +1134,7 @@ BlockCopyCallState *block_copy_async(BlockCopyState *s,
         .bytes = bytes,
         .max_workers = max_workers,
         .max_chunk = max_chunk,
+        .adaptive = adaptive,
         .cb = cb,
         .cb_opaque = cb_opaque,
 
@@ -1057,6 +1209,13 @@ int64_t block_copy_cluster_size(BlockCopyState *s)
     return s->cluster_size;
 }
 
+bool block_copy_get_adapt(BlockCopyState *s, int *workers, int64_t *chunk)
+{
+    *workers = qatomic_read(&s->adapt.workers);
+    *chunk = qatomic_read(&s->adapt.chunk);
+    return *workers != 0 && !qatomic_read(&s->rate_limited);
+}
+
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
 {
     qatomic_set(&s->skip_unallocated, skip);
@@ -1065,6 +1224,7 @@ void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed)
 {
     ratelimit_set_speed(&s->rate_limit, speed, BLOCK_COPY_SLICE_TIME);
+    qatomic_set(&s->rate_limited, speed != 0);
 
     /*
      * Note: it's good to kick all call states from here, but it should be done
@@ -29,6 +29,7 @@
 #include "qapi/qapi-commands-block.h"
 #include "qemu/main-loop.h"
 #include "system/block-backend.h"
+#include "system/iothread.h"
 
 #include <fuse.h>
 #include <fuse_lowlevel.h>
@@ -41,15 +42,42 @@
 #include <linux/fs.h>
 #endif
 
+/*
+ * Multiple queues need FUSE_DEV_IOC_CLONE, and a way to make libfuse send
+ * replies to the cloned fd that a request was read from
+ */
+#if defined(__linux__) && defined(HAVE_FUSE_SESSION_CUSTOM_IO)
+#define FUSE_EXPORT_MULTIQUEUE
+#ifndef FUSE_DEV_IOC_CLONE
+#define FUSE_DEV_IOC_CLONE _IOR(229, 0, uint32_t)
+#endif
+#endif
+
 /* Prevent overly long bounce buffer allocations */
 #define FUSE_MAX_BOUNCE_BYTES (MIN(BDRV_REQUEST_MAX_BYTES, 64 * 1024 * 1024))
 
+typedef struct FuseExport FuseExport;
 
-typedef struct FuseExport {
+/*
+ * A /dev/fuse file descriptor and the AioContext that handles the requests
+ * read from it.  Queue 0 uses the session fd and runs in the export's
+ * AioContext.  The other queues use clones of the session fd and run in the
+ * iothreads given with the iothreads option.  The kernel hands each request
+ * to whichever queue reads first.
+ */
+typedef struct FuseQueue {
+    FuseExport *exp;
+    AioContext *ctx;
+    int fd;
+    struct fuse_buf fuse_buf;
+} FuseQueue;
+
+struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
-    struct fuse_buf fuse_buf;
+    FuseQueue *queues;
+    int num_queues;
     unsigned int in_flight; /* atomic */
     bool mounted, fd_handler_set_up;
 
@@ -62,7 +90,7 @@ typedef struct FuseExport {
     mode_t st_mode;
     uid_t st_uid;
     gid_t st_gid;
-} FuseExport;
+};
 
 static GHashTable *exports;
 static const struct fuse_lowlevel_ops fuse_ops;
@@ -79,14 +107,26 @@ static void read_from_fuse_export(void *opaque);
 static bool is_regular_file(const char *path, Error **errp);
 
 
+static void fuse_export_set_fd_handlers(FuseExport *exp, bool enable)
+{
+    for (int i = 0; i < exp->num_queues; i++) {
+        FuseQueue *q = &exp->queues[i];
+
+        if (q->fd < 0) {
+            continue;
+        }
+        aio_set_fd_handler(q->ctx, q->fd,
+                           enable ? read_from_fuse_export : NULL,
+                           NULL, NULL, NULL, enable ? q : NULL);
+    }
+    exp->fd_handler_set_up = enable;
+}
+
 static void fuse_export_drained_begin(void *opaque)
 {
     FuseExport *exp = opaque;
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       NULL, NULL, NULL, NULL, NULL);
-    exp->fd_handler_set_up = false;
+    fuse_export_set_fd_handlers(exp, false);
 }
 
 static void fuse_export_drained_end(void *opaque)
@@ -95,11 +135,9 @@ static void fuse_export_drained_end(void *opaque)
 
     /* Refresh AioContext in case it changed */
     exp->common.ctx = blk_get_aio_context(exp->common.blk);
+    exp->queues[0].ctx = exp->common.ctx;
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    fuse_export_set_fd_handlers(exp, true);
 }
 
 static bool fuse_export_drained_poll(void *opaque)
@@ -121,10 +159,48 @@ static int fuse_export_create(BlockExport *blk_exp,
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
     BlockExportOptionsFuse *args = &blk_exp_args->u.fuse;
+    strList *iothread_list;
+    int num_queues = 1;
     int ret;
 
     assert(blk_exp_args->type == BLOCK_EXPORT_TYPE_FUSE);
 
+    for (iothread_list = args->iothreads; iothread_list;
+         iothread_list = iothread_list->next) {
+        num_queues++;
+    }
+
+#ifndef FUSE_EXPORT_MULTIQUEUE
+    if (num_queues > 1) {
+        error_setg(errp, "Multiple FUSE export iothreads are not supported "
+                   "by this build");
+        return -ENOTSUP;
+    }
+#endif
+
+    exp->queues = g_new0(FuseQueue, num_queues);
+    exp->num_queues = num_queues;
+    for (int i = 0; i < exp->num_queues; i++) {
+        exp->queues[i] = (FuseQueue) {
+            .exp = exp,
+            .ctx = exp->common.ctx,
+            .fd  = -1,
+        };
+    }
+    iothread_list = args->iothreads;
+    for (int i = 1; i < exp->num_queues; i++) {
+        IOThread *iothread = iothread_by_id(iothread_list->value);
+
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found",
+                       iothread_list->value);
+            ret = -ENOENT;
+            goto fail;
+        }
+        exp->queues[i].ctx = iothread_get_aio_context(iothread);
+        iothread_list = iothread_list->next;
+    }
+
     /* For growable and writable exports, take the RESIZE permission */
     if (args->growable || blk_exp_args->writable) {
         uint64_t blk_perm, blk_shared_perm;
@@ -134,7 +210,7 @@ static int fuse_export_create(BlockExport *blk_exp,
         ret = blk_set_perm(exp->common.blk, blk_perm | BLK_PERM_RESIZE,
                            blk_shared_perm, errp);
         if (ret < 0) {
-            return ret;
+            goto fail;
         }
     }
 
@@ -269,10 +345,17 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
 
     g_hash_table_insert(exports, g_strdup(mountpoint), NULL);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    exp->queues[0].fd = fuse_session_fd(exp->fuse_session);
+#ifdef FUSE_EXPORT_MULTIQUEUE
+    if (exp->num_queues > 1) {
+        ret = setup_fuse_queues(exp, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+    }
+#endif
+
+    fuse_export_set_fd_handlers(exp, true);
 
     return 0;
 
@@ -281,29 +364,116 @@ fail:
     return ret;
 }
 
+/*
+ * The queue whose request is being processed in this thread.  This does not
+ * involve coroutines, so use __thread.
+ */
+static __thread FuseQueue *fuse_current_queue;
+
+#ifdef FUSE_EXPORT_MULTIQUEUE
+/*
+ * libfuse reads requests from and writes replies to the session fd.  The
+ * kernel only accepts a reply on the fd that the request was read from, so
+ * redirect both to the fd of the current queue.
+ */
+static ssize_t fuse_export_io_read(int fd, void *buf, size_t buf_len,
+                                   void *userdata)
+{
+    return read(fuse_current_queue ? fuse_current_queue->fd : fd,
+                buf, buf_len);
+}
+
+static ssize_t fuse_export_io_writev(int fd, struct iovec *iov, int count,
+                                     void *userdata)
+{
+    return writev(fuse_current_queue ? fuse_current_queue->fd : fd,
+                  iov, count);
+}
+
+static const struct fuse_custom_io fuse_export_io = {
+    .read   = fuse_export_io_read,
+    .writev = fuse_export_io_writev,
+};
+
+/**
+ * Clone the session fd for all queues but the first one.
+ */
+static int setup_fuse_queues(FuseExport *exp, Error **errp)
+{
+    uint32_t session_fd = fuse_session_fd(exp->fuse_session);
+    int ret;
+
+    for (int i = 1; i < exp->num_queues; i++) {
+        int fd = qemu_open("/dev/fuse", O_RDWR, errp);
+
+        if (fd < 0) {
+            ret = -errno;
+            goto fail;
+        }
+        if (ioctl(fd, FUSE_DEV_IOC_CLONE, &session_fd) < 0) {
+            ret = -errno;
+            error_setg_errno(errp, errno, "Failed to clone FUSE session fd");
+            qemu_close(fd);
+            goto fail;
+        }
+        exp->queues[i].fd = fd;
+    }
+
+    ret = fuse_session_custom_io(exp->fuse_session, &fuse_export_io,
+                                 session_fd);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to set up FUSE session I/O");
+        goto fail;
+    }
+
+    /* All queues get woken up for each request, but only one can have it */
+    for (int i = 0; i < exp->num_queues; i++) {
+        g_unix_set_fd_nonblocking(exp->queues[i].fd, true, NULL);
+    }
+    return 0;
+
+fail:
+    for (int i = 1; i < exp->num_queues; i++) {
+        if (exp->queues[i].fd >= 0) {
+            qemu_close(exp->queues[i].fd);
+            exp->queues[i].fd = -1;
+        }
+    }
+    return ret;
+}
+#endif
+
 /**
- * Callback to be invoked when the FUSE session FD can be read from.
+ * Callback to be invoked when a FUSE queue FD can be read from.
  * (This is basically the FUSE event loop.)
  */
 static void read_from_fuse_export(void *opaque)
 {
-    FuseExport *exp = opaque;
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
+    FuseQueue *prev_queue = fuse_current_queue;
     int ret;
 
     blk_exp_ref(&exp->common);
 
     qatomic_inc(&exp->in_flight);
 
+    /* Handlers may run nested event loops that process other requests */
+    fuse_current_queue = q;
+
     do {
-        ret = fuse_session_receive_buf(exp->fuse_session, &exp->fuse_buf);
+        ret = fuse_session_receive_buf(exp->fuse_session, &q->fuse_buf);
     } while (ret == -EINTR);
     if (ret < 0) {
+        /* -EAGAIN if another queue got the request */
         goto out;
     }
 
-    fuse_session_process_buf(exp->fuse_session, &exp->fuse_buf);
+    fuse_session_process_buf(exp->fuse_session, &q->fuse_buf);
 
 out:
+    fuse_current_queue = prev_queue;
+
     if (qatomic_fetch_dec(&exp->in_flight) == 1) {
         aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
     }
@@ -319,10 +489,7 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
         fuse_session_exit(exp->fuse_session);
 
         if (exp->fd_handler_set_up) {
-            aio_set_fd_handler(exp->common.ctx,
-                               fuse_session_fd(exp->fuse_session),
-                               NULL, NULL, NULL, NULL, NULL);
-            exp->fd_handler_set_up = false;
+            fuse_export_set_fd_handlers(exp, false);
         }
     }
 
@@ -347,7 +514,14 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
-    free(exp->fuse_buf.mem);
+    for (int i = 0; i < exp->num_queues; i++) {
+        /* Queue 0 uses the session fd, which libfuse closes */
+        if (i > 0 && exp->queues[i].fd >= 0) {
+            qemu_close(exp->queues[i].fd);
+        }
+        free(exp->queues[i].fuse_buf.mem);
+    }
+    g_free(exp->queues);
     g_free(exp->mountpoint);
 }
 
@@ -379,6 +553,15 @@ static bool is_regular_file(const char *path, Error **errp)
  */
 static void fuse_init(void *userdata, struct fuse_conn_info *conn)
 {
+#ifdef FUSE_EXPORT_MULTIQUEUE
+    FuseExport *exp = userdata;
+
+    /* Splicing from the device would bypass fuse_export_io */
+    if (exp->num_queues > 1) {
+        conn->want &= ~FUSE_CAP_SPLICE_READ;
+    }
+#endif
+
     /*
      * MIN_NON_ZERO() would not be wrong here, but what we set here
      * must equal what has been passed to fuse_session_new().
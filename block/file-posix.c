@@ -36,6 +36,7 @@
 #include "block/thread-pool.h"
 #include "qemu/iov.h"
 #include "block/raw-aio.h"
+#include "system/memory.h" /* for ram_block_discard_disable() */
 #include "qobject/qdict.h"
 #include "qobject/qstring.h"
 
@@ -173,6 +174,10 @@ typedef struct BDRVRawState {
     uint64_t locked_shared_perm;
 
     uint64_t aio_max_batch;
+#ifdef CONFIG_LINUX_IO_URING
+    /* io_uring polling options, only used if use_luring_setup is true */
+    LuringSetup luring_setup;
+#endif
 
     int perm_change_fd;
     int perm_change_flags;
@@ -183,6 +188,8 @@ typedef struct BDRVRawState {
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+    bool aio_fixed_buffers:1;
+    bool use_luring_setup:1;
     bool use_mpath:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
@@ -585,6 +592,28 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "aio-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM with io_uring, pinning it (default: off)",
+        },
+        {
+            .name = "aio-sqpoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "submit io_uring requests from a kernel thread (default: off)",
+        },
+        {
+            .name = "aio-sqpoll-cpu",
+            .type = QEMU_OPT_NUMBER,
+            .help = "CPU to pin the io_uring kernel thread to (default: none)",
+        },
+        {
+            .name = "aio-iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "poll for io_uring completions (default: off)",
+        },
+#endif
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -666,6 +695,42 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
 
+#ifdef CONFIG_LINUX_IO_URING
+    s->aio_fixed_buffers = qemu_opt_get_bool(opts, "aio-fixed-buffers", false);
+    if (s->aio_fixed_buffers && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-fixed-buffers=on requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    s->luring_setup = (LuringSetup) {
+        .sqpoll     = qemu_opt_get_bool(opts, "aio-sqpoll", false),
+        .sqpoll_cpu = -1,
+        .iopoll     = qemu_opt_get_bool(opts, "aio-iopoll", false),
+    };
+    if (qemu_opt_get(opts, "aio-sqpoll-cpu")) {
+        uint64_t cpu = qemu_opt_get_number(opts, "aio-sqpoll-cpu", 0);
+
+        if (!s->luring_setup.sqpoll) {
+            error_setg(errp, "aio-sqpoll-cpu requires aio-sqpoll=on");
+            ret = -EINVAL;
+            goto fail;
+        }
+        if (cpu > INT_MAX) {
+            error_setg(errp, "aio-sqpoll-cpu is out of range");
+            ret = -EINVAL;
+            goto fail;
+        }
+        s->luring_setup.sqpoll_cpu = cpu;
+    }
+    s->use_luring_setup = s->luring_setup.sqpoll || s->luring_setup.iopoll;
+    if (s->use_luring_setup && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-sqpoll and aio-iopoll require aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif
+
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
                               ON_OFF_AUTO_AUTO, &local_err);
@@ -755,14 +820,22 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif /* !defined(CONFIG_LINUX_AIO) */
 
-#ifndef CONFIG_LINUX_IO_URING
+#ifdef CONFIG_LINUX_IO_URING
+    /* The kernel only polls for completions of O_DIRECT requests */
+    if (s->luring_setup.iopoll && !(s->open_flags & O_DIRECT)) {
+        error_setg(errp, "aio-iopoll=on was specified, but it requires "
+                         "cache.direct=on, which was not specified.");
+        ret = -EINVAL;
+        goto fail;
+    }
+#else
     if (s->use_linux_io_uring) {
         error_setg(errp, "aio=io_uring was specified, but is not supported "
                          "in this build.");
         ret = -EINVAL;
         goto fail;
     }
-#endif /* !defined(CONFIG_LINUX_IO_URING) */
+#endif /* CONFIG_LINUX_IO_URING */
 
     s->has_discard = true;
     s->has_write_zeroes = true;
@@ -829,6 +902,19 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+
+    if (s->aio_fixed_buffers) {
+        /*
+         * io_uring keeps the pages of fixed buffers pinned, so discarding
+         * guest RAM would leave it with stale pages.
+         */
+        ret = ram_block_discard_disable(true);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "aio-fixed-buffers=on cannot be used "
+                             "while RAM discard is required");
+            goto fail;
+        }
+    }
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -2533,7 +2619,17 @@ static inline bool raw_check_linux_io_uring(BDRVRawState *s)
     }
 
     ctx = qemu_get_current_aio_context();
-    if (unlikely(!aio_setup_linux_io_uring(ctx, &local_err))) {
+    if (s->use_luring_setup &&
+        unlikely(!aio_setup_linux_io_uring(ctx, &s->luring_setup,
+                                           &local_err))) {
+        error_reportf_err(local_err, "Unable to use polled linux io_uring, "
+                                     "falling back to normal io_uring: ");
+        s->use_luring_setup = false;
+        local_err = NULL;
+    }
+
+    /* The default ring is always needed for requests that cannot be polled */
+    if (unlikely(!aio_setup_linux_io_uring(ctx, NULL, &local_err))) {
         error_reportf_err(local_err, "Unable to use linux io_uring, "
                                      "falling back to thread pool: ");
         s->use_linux_io_uring = false;
@@ -2541,6 +2637,23 @@ static inline bool raw_check_linux_io_uring(BDRVRawState *s)
     }
     return true;
 }
+
+/*
+ * Return the io_uring setup to use for requests of @type.  IOPOLL rings only
+ * support reads and writes with O_DIRECT; everything else goes to the default
+ * ring.
+ */
+static const LuringSetup *raw_luring_setup(BDRVRawState *s, int type)
+{
+    if (!s->use_luring_setup) {
+        return NULL;
+    }
+    if (s->luring_setup.iopoll &&
+        ((type & QEMU_AIO_FLUSH) || !(s->open_flags & O_DIRECT))) {
+        return NULL;
+    }
+    return &s->luring_setup;
+}
 #endif
 
 #ifdef CONFIG_LINUX_AIO
@@ -2597,7 +2710,8 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
 #ifdef CONFIG_LINUX_IO_URING
     } else if (raw_check_linux_io_uring(s)) {
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type, flags);
+        ret = luring_co_submit(bs, raw_luring_setup(s, type), s->fd, offset,
+                               qiov, type, flags);
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2693,7 +2807,8 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
 
 #ifdef CONFIG_LINUX_IO_URING
     if (raw_check_linux_io_uring(s)) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH, 0);
+        return luring_co_submit(bs, raw_luring_setup(s, QEMU_AIO_FLUSH), s->fd,
+                                0, NULL, QEMU_AIO_FLUSH, 0);
     }
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2704,6 +2819,15 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     return raw_thread_pool_submit(handle_aiocb_flush, &acb);
 }
 
+/* Close a file descriptor that may have been used for I/O */
+static void raw_close_io_fd(int fd)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    luring_unregister_fd(fd);
+#endif
+    qemu_close(fd);
+}
+
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
@@ -2712,11 +2836,37 @@ static void raw_close(BlockDriverState *bs)
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
 #endif
-        qemu_close(s->fd);
+        raw_close_io_fd(s->fd);
         s->fd = -1;
     }
+    if (s->aio_fixed_buffers) {
+        ram_block_discard_disable(false);
+    }
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    /* If this fails, requests just use normal buffers */
+    if (s->aio_fixed_buffers) {
+        luring_register_buf(host, size);
+    }
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->aio_fixed_buffers) {
+        luring_unregister_buf(host, size);
+    }
+}
+#endif
+
 /**
  * Truncates the given regular file @fd to @offset and, when growing, fills the
  * new space according to @prealloc.
@@ -3903,7 +4053,7 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
-        qemu_close(s->fd);
+        raw_close_io_fd(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
     }
@@ -4010,6 +4160,10 @@ BlockDriver bdrv_file = {
     .bdrv_check_perm = raw_check_perm,
     .bdrv_set_perm   = raw_set_perm,
     .bdrv_abort_perm_update = raw_abort_perm_update,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
     .create_opts = &raw_create_opts,
     .mutable_opts = mutable_opts,
 };
@@ -4470,6 +4624,10 @@ static BlockDriver bdrv_host_device = {
     .bdrv_abort_perm_update = raw_abort_perm_update,
     .bdrv_probe_blocksizes = hdev_probe_blocksizes,
     .bdrv_probe_geometry = hdev_probe_geometry,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     /* generic scsi device */
 #ifdef __linux__
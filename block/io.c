@@ -580,6 +580,30 @@ void bdrv_drain_all(void)
     bdrv_drain_all_end();
 }
 
+/*
+ * Index @req by its overlap range, so that serialising requests only need to
+ * look at the requests that they overlap.  Requests of zero length overlap
+ * nothing and are not indexed.
+ *
+ * Called with req->bs->reqs_lock held.
+ */
+static void tracked_request_index(BdrvTrackedRequest *req)
+{
+    if (req->overlap_bytes) {
+        req->node.start = req->overlap_offset;
+        req->node.last = req->overlap_offset + req->overlap_bytes - 1;
+        interval_tree_insert(&req->node, &req->bs->tracked_request_tree);
+    }
+}
+
+/* Called with req->bs->reqs_lock held */
+static void tracked_request_unindex(BdrvTrackedRequest *req)
+{
+    if (req->overlap_bytes) {
+        interval_tree_remove(&req->node, &req->bs->tracked_request_tree);
+    }
+}
+
 /**
  * Remove an active request from the tracked requests list
  *
@@ -593,6 +617,7 @@ static void coroutine_fn tracked_request_end(BdrvTrackedRequest *req)
 
     qemu_mutex_lock(&req->bs->reqs_lock);
     QLIST_REMOVE(req, list);
+    tracked_request_unindex(req);
     qemu_mutex_unlock(&req->bs->reqs_lock);
 
     /*
@@ -629,6 +654,7 @@ static void coroutine_fn tracked_request_begin(BdrvTrackedRequest *req,
 
     qemu_mutex_lock(&bs->reqs_lock);
     QLIST_INSERT_HEAD(&bs->tracked_requests, req, list);
+    tracked_request_index(req);
     qemu_mutex_unlock(&bs->reqs_lock);
 }
 
@@ -652,9 +678,17 @@ static bool tracked_request_overlaps(BdrvTrackedRequest *req,
 static coroutine_fn BdrvTrackedRequest *
 bdrv_find_conflicting_request(BdrvTrackedRequest *self)
 {
-    BdrvTrackedRequest *req;
+    uint64_t start = self->overlap_offset;
+    /* A request of zero length can still conflict with one around it */
+    uint64_t last = start + MAX(self->overlap_bytes, 1) - 1;
+    IntervalTreeNode *node;
+
+    for (node = interval_tree_iter_first(&self->bs->tracked_request_tree,
+                                         start, last);
+         node;
+         node = interval_tree_iter_next(node, start, last)) {
+        BdrvTrackedRequest *req = container_of(node, BdrvTrackedRequest, node);
 
-    QLIST_FOREACH(req, &self->bs->tracked_requests, list) {
         if (req == self || (!req->serialising && !self->serialising)) {
             continue;
         }
@@ -710,8 +744,10 @@ static void tracked_request_set_serialising(BdrvTrackedRequest *req,
         req->serialising = true;
     }
 
+    tracked_request_unindex(req);
     req->overlap_offset = MIN(req->overlap_offset, overlap_offset);
     req->overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    tracked_request_index(req);
 }
 
 /**
@@ -1296,6 +1332,13 @@ bdrv_co_do_copy_on_readv(BdrvChild *child, int64_t offset, int64_t bytes,
                 goto err;
             }
 
+            /*
+             * The block status of this range, which has just been looked
+             * up for the copy, changed from unallocated to allocated.
+             * bdrv_driver_pwritev() does not update the cache.
+             */
+            bdrv_bsc_invalidate_range(bs, align_offset, pnum);
+
             if (!(flags & BDRV_REQ_PREFETCH)) {
                 qemu_iovec_from_buf(qiov, qiov_offset + progress,
                                     bounce_buffer + skip_bytes,
@@ -2029,6 +2072,17 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, int64_t bytes,
 
     qatomic_inc(&bs->write_gen);
 
+    /*
+     * Writing data does not change the status of data regions, which is
+     * all that protocol nodes cache; format nodes cache everything.
+     */
+    if (req->type == BDRV_TRACKED_TRUNCATE) {
+        bdrv_bsc_invalidate(bs);
+    } else if (!bs->drv || bs->drv->is_format ||
+               req->type != BDRV_TRACKED_WRITE) {
+        bdrv_bsc_invalidate_range(bs, offset, bytes);
+    }
+
     /*
      * Discard cannot extend the image, but in error handling cases, such as
      * when reverting a qcow2 cluster allocation, the discarded range can pass
@@ -2362,6 +2416,23 @@ int bdrv_flush_all(void)
     return result;
 }
 
+/*
+ * Writes to a format node may change the block status of all clusters they
+ * touch (e.g. by allocating them), so block-status cache invalidations must
+ * cover whole clusters.  Return the cluster size, or 0 if it is unknown, in
+ * which case the results of @bs must not be cached.
+ */
+static int64_t coroutine_fn GRAPH_RDLOCK
+bdrv_bsc_granularity(BlockDriverState *bs)
+{
+    BlockDriverInfo bdi;
+
+    if (bdrv_co_get_info(bs, &bdi) < 0 || bdi.cluster_size <= 0) {
+        return 0;
+    }
+    return bdi.cluster_size;
+}
+
 /*
  * Returns the allocation status of the specified sectors.
  * Drivers not implementing the functionality are assumed to not support
@@ -2449,67 +2520,63 @@ bdrv_co_do_block_status(BlockDriverState *bs, unsigned int mode,
     aligned_bytes = ROUND_UP(offset + bytes, align) - aligned_offset;
 
     if (bs->drv->bdrv_co_block_status) {
+        unsigned int bsc_gen;
+
         /*
-         * Use the block-status cache only for protocol nodes: Format
-         * drivers are generally quick to inquire the status, but protocol
-         * drivers often need to get information from outside of qemu, so
-         * we do not have control over the actual implementation.  There
-         * have been cases where inquiring the status took an unreasonably
-         * long time, and we can do nothing in qemu to fix it.
-         * This is especially problematic for images with large data areas,
-         * because finding the few holes in them and giving them special
-         * treatment does not gain much performance.  Therefore, we try to
-         * cache the last-identified data region.
+         * Repeated queries are common: Jobs and qemu-img walk the whole
+         * image, often once per layer of a backing chain, and protocol
+         * drivers often need to get information from outside of qemu
+         * (there have been cases where inquiring the status took an
+         * unreasonably long time, and we can do nothing in qemu to fix
+         * it), so cache the results.
          *
-         * Second, limiting ourselves to protocol nodes allows us to assume
-         * the block status for data regions to be DATA | OFFSET_VALID, and
-         * that the host offset is the same as the guest offset.
-         *
-         * Note that it is possible that external writers zero parts of
+         * Format nodes own their metadata, so their status only changes
+         * through writes to them, which invalidate the cache; cache all
+         * of their results.  For protocol nodes, only cache data
+         * regions: It is possible that external writers zero parts of
          * the cached regions without the cache being invalidated, and so
          * we may report zeroes as data.  This is not catastrophic,
-         * however, because reporting zeroes as data is fine.
+         * however, because reporting zeroes as data is fine.  This also
+         * allows us to assume the block status for data regions to be
+         * DATA | OFFSET_VALID, and that the host offset is the same as
+         * the guest offset.
          */
-        if (QLIST_EMPTY(&bs->children) &&
-            bdrv_bsc_is_data(bs, aligned_offset, pnum))
-        {
-            ret = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
-            local_file = bs;
-            local_map = aligned_offset;
-        } else {
+        if (!bdrv_bsc_lookup(bs, aligned_offset, &ret, pnum, &local_map,
+                             &local_file)) {
+            bsc_gen = bdrv_bsc_generation(bs);
             ret = bs->drv->bdrv_co_block_status(bs, mode, aligned_offset,
                                                 aligned_bytes, pnum, &local_map,
                                                 &local_file);
 
             /*
-             * Note that checking QLIST_EMPTY(&bs->children) is also done when
-             * the cache is queried above.  Technically, we do not need to check
-             * it here; the worst that can happen is that we fill the cache for
-             * non-protocol nodes, and then it is never used.  However, filling
-             * the cache requires an RCU update, so double check here to avoid
-             * such an update if possible.
-             *
              * Check mode, because we only want to update the cache when we
              * have accurate information about what is zero and what is data.
              */
-            if (mode == BDRV_WANT_PRECISE &&
-                ret == (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID) &&
-                QLIST_EMPTY(&bs->children))
+            if (mode != BDRV_WANT_PRECISE || ret < 0 ||
+                (ret & BDRV_BLOCK_EOF)) {
+                /* Not cacheable */
+            } else if (bs->drv->is_format) {
+                int64_t granularity = bdrv_bsc_granularity(bs);
+
+                if (granularity) {
+                    bdrv_bsc_fill(bs, bsc_gen, granularity, aligned_offset,
+                                  *pnum, ret, local_map, local_file);
+                }
+            } else if (ret == (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID) &&
+                       QLIST_EMPTY(&bs->children))
             {
                 /*
                  * When a protocol driver reports BLOCK_OFFSET_VALID, the
                  * returned local_map value must be the same as the offset we
                  * have passed (aligned_offset), and local_bs must be the node
                  * itself.
-                 * Assert this, because we follow this rule when reading from
-                 * the cache (see the `local_file = bs` and
-                 * `local_map = aligned_offset` assignments above), and the
-                 * result the cache delivers must be the same as the driver
-                 * would deliver.
+                 * Assert this, because the result the cache delivers must be
+                 * the same as the driver would deliver.
                  */
                 assert(local_file == bs);
                 assert(local_map == aligned_offset);
-                bdrv_bsc_fill(bs, aligned_offset, *pnum);
+                bdrv_bsc_fill(bs, bsc_gen, 0, aligned_offset, *pnum, ret,
+                              local_map, local_file);
             }
         }
     } else {
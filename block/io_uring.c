@@ -11,11 +11,15 @@
 #include "qemu/osdep.h"
 #include <liburing.h>
 #include "block/aio.h"
+#include "qemu/bitmap.h"
 #include "qemu/queue.h"
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
 #include "qemu/defer-call.h"
+#include "qemu/lockable.h"
+#include "qemu/rcu.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "system/block-backend.h"
 #include "trace.h"
@@ -26,6 +30,19 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Sizes of the fixed buffer and fixed file tables of each ring */
+#define LURING_MAX_FIXED_BUFS 1024
+#define LURING_MAX_FIXED_FILES 64
+
+/* The kernel does not accept larger fixed buffers */
+#define LURING_FIXED_BUF_MAX_SIZE (1 * GiB)
+
+/*
+ * How long the kernel thread of an SQPOLL ring keeps polling for new
+ * requests before it goes to sleep and must be woken up by a syscall
+ */
+#define LURING_SQPOLL_IDLE_MS 10
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -53,13 +70,416 @@ struct LuringState {
     AioContext *aio_context;
 
     struct io_uring ring;
+    LuringSetup setup;
+
+    /*
+     * Completions are only posted when polled for with io_uring_enter(), so
+     * the ring fd never becomes readable (IOPOLL without SQPOLL)
+     */
+    bool reap_by_polling;
 
     /* No locking required, only accessed from AioContext home thread */
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /* Entry in luring_states, protected by luring_reg_lock */
+    QLIST_ENTRY(LuringState) next;
+
+    /*
+     * Whether the buffers in luring_buf_table are registered with this ring.
+     * Written under luring_reg_lock, read by the AioContext home thread.
+     */
+    bool fixed_bufs;
+    /* Registering fixed buffers failed, protected by luring_reg_lock */
+    bool fixed_bufs_failed;
+
+    /*
+     * File descriptor in each slot of the fixed file table, or -1.  Slots are
+     * only filled in by the AioContext home thread, and cleared by
+     * luring_unregister_fd() (see there).
+     */
+    bool fixed_files;
+    int fixed_fds[LURING_MAX_FIXED_FILES];
 };
 
+#ifdef HAVE_IO_URING_REGISTER_SPARSE
+/*
+ * Registered buffers and files
+ *
+ * Memory that is used for many requests, like guest RAM, can be registered
+ * with all rings as fixed buffers so that the kernel does not need to pin
+ * and unpin its pages for every request.  Requests whose data is in one
+ * contiguous part of a fixed buffer are then submitted as READ_FIXED or
+ * WRITE_FIXED.
+ *
+ * File descriptors are registered lazily with each ring as fixed files, so
+ * that the kernel does not need to look up the file for every request.
+ */
+
+typedef struct LuringFixedBuf {
+    void *host;
+    size_t size;
+    /* Each LURING_FIXED_BUF_MAX_SIZE chunk takes one slot, starting here */
+    unsigned int first_slot;
+} LuringFixedBuf;
+
+/* A range of memory registered with luring_register_buf() */
+typedef struct LuringBufRegion {
+    LuringFixedBuf buf;
+    unsigned int refcnt;
+    QLIST_ENTRY(LuringBufRegion) next;
+} LuringBufRegion;
+
+/* Snapshot of the registered regions for lookups, sorted by address */
+typedef struct LuringBufTable {
+    struct rcu_head rcu;
+    unsigned int nb_bufs;
+    LuringFixedBuf bufs[];
+} LuringBufTable;
+
+/* Protects the following variables */
+static QemuMutex luring_reg_lock;
+static QLIST_HEAD(, LuringState) luring_states =
+    QLIST_HEAD_INITIALIZER(luring_states);
+static QLIST_HEAD(, LuringBufRegion) luring_buf_regions =
+    QLIST_HEAD_INITIALIZER(luring_buf_regions);
+static DECLARE_BITMAP(luring_buf_slots, LURING_MAX_FIXED_BUFS);
+
+/* RCU protected, updated under luring_reg_lock */
+static LuringBufTable *luring_buf_table;
+
+static void __attribute__((__constructor__)) luring_reg_init(void)
+{
+    qemu_mutex_init(&luring_reg_lock);
+}
+
+/* Fill in the slots of @buf in the fixed buffer table of @s, or clear them */
+static int luring_update_fixed_buf(LuringState *s, const LuringFixedBuf *buf,
+                                   bool clear)
+{
+    unsigned int nb_slots = DIV_ROUND_UP(buf->size, LURING_FIXED_BUF_MAX_SIZE);
+    g_autofree struct iovec *iov = g_new0(struct iovec, nb_slots);
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < nb_slots && !clear; i++) {
+        size_t offset = (size_t)i * LURING_FIXED_BUF_MAX_SIZE;
+
+        iov[i].iov_base = buf->host + offset;
+        iov[i].iov_len = MIN(buf->size - offset, LURING_FIXED_BUF_MAX_SIZE);
+    }
+
+    ret = io_uring_register_buffers_update_tag(&s->ring, buf->first_slot,
+                                               iov, NULL, nb_slots);
+    return ret < 0 ? ret : 0;
+}
+
+static void luring_add_fixed_buf_locked(LuringState *s,
+                                        const LuringFixedBuf *buf)
+{
+    int ret = 0;
+
+    if (s->fixed_bufs_failed) {
+        return;
+    }
+
+    if (!s->fixed_bufs) {
+        ret = io_uring_register_buffers_sparse(&s->ring,
+                                               LURING_MAX_FIXED_BUFS);
+    }
+    if (ret == 0) {
+        ret = luring_update_fixed_buf(s, buf, false);
+    }
+    if (ret < 0) {
+        /* Most likely RLIMIT_MEMLOCK is too low; use normal buffers */
+        trace_luring_fixed_bufs_failed(s, ret);
+        s->fixed_bufs_failed = true;
+        qatomic_set(&s->fixed_bufs, false);
+        return;
+    }
+    qatomic_set(&s->fixed_bufs, true);
+}
+
+static int luring_fixed_buf_cmp(const void *a, const void *b)
+{
+    uintptr_t ha = (uintptr_t)((const LuringFixedBuf *)a)->host;
+    uintptr_t hb = (uintptr_t)((const LuringFixedBuf *)b)->host;
+
+    return ha < hb ? -1 : ha > hb;
+}
+
+static void luring_publish_buf_table_locked(void)
+{
+    LuringBufTable *old = luring_buf_table;
+    LuringBufTable *t;
+    LuringBufRegion *r;
+    unsigned int n = 0;
+
+    QLIST_FOREACH(r, &luring_buf_regions, next) {
+        n++;
+    }
+
+    t = g_malloc(sizeof(*t) + n * sizeof(t->bufs[0]));
+    t->nb_bufs = 0;
+    QLIST_FOREACH(r, &luring_buf_regions, next) {
+        t->bufs[t->nb_bufs++] = r->buf;
+    }
+    qsort(t->bufs, t->nb_bufs, sizeof(t->bufs[0]), luring_fixed_buf_cmp);
+
+    qatomic_rcu_set(&luring_buf_table, t);
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+}
+
+void luring_register_buf(void *host, size_t size)
+{
+    unsigned int nb_slots = DIV_ROUND_UP(size, LURING_FIXED_BUF_MAX_SIZE);
+    LuringBufRegion *r;
+    LuringState *s;
+    unsigned long slot;
+
+    QEMU_LOCK_GUARD(&luring_reg_lock);
+
+    QLIST_FOREACH(r, &luring_buf_regions, next) {
+        if (r->buf.host == host && r->buf.size == size) {
+            r->refcnt++;
+            return;
+        }
+    }
+
+    slot = bitmap_find_next_zero_area(luring_buf_slots, LURING_MAX_FIXED_BUFS,
+                                      0, nb_slots, 0);
+    if (slot + nb_slots > LURING_MAX_FIXED_BUFS) {
+        trace_luring_fixed_bufs_failed(NULL, -ENOSPC);
+        return;
+    }
+    bitmap_set(luring_buf_slots, slot, nb_slots);
+
+    r = g_new(LuringBufRegion, 1);
+    *r = (LuringBufRegion) {
+        .buf = {
+            .host       = host,
+            .size       = size,
+            .first_slot = slot,
+        },
+        .refcnt = 1,
+    };
+    QLIST_INSERT_HEAD(&luring_buf_regions, r, next);
+
+    /* Only publish the buffer once all rings can use it */
+    QLIST_FOREACH(s, &luring_states, next) {
+        luring_add_fixed_buf_locked(s, &r->buf);
+    }
+    luring_publish_buf_table_locked();
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    LuringBufRegion *r;
+    LuringState *s;
+
+    QEMU_LOCK_GUARD(&luring_reg_lock);
+
+    QLIST_FOREACH(r, &luring_buf_regions, next) {
+        if (r->buf.host == host && r->buf.size == size) {
+            break;
+        }
+    }
+    if (!r || --r->refcnt) {
+        return;
+    }
+
+    QLIST_REMOVE(r, next);
+    luring_publish_buf_table_locked();
+
+    /*
+     * There are no requests for this memory any more, so it is safe to
+     * clear the slots even if a ring thread still sees the old table.
+     */
+    QLIST_FOREACH(s, &luring_states, next) {
+        if (s->fixed_bufs) {
+            luring_update_fixed_buf(s, &r->buf, true);
+        }
+    }
+    bitmap_clear(luring_buf_slots, r->buf.first_slot,
+                 DIV_ROUND_UP(size, LURING_FIXED_BUF_MAX_SIZE));
+    g_free(r);
+}
+
+/*
+ * Return the index of the fixed buffer slot that contains all of @qiov, or
+ * -1 if there is none.
+ */
+static int luring_fixed_buf(LuringState *s, QEMUIOVector *qiov,
+                            BdrvRequestFlags flags)
+{
+    uintptr_t base = (uintptr_t)qiov->iov[0].iov_base;
+    size_t len = qiov->iov[0].iov_len;
+    const LuringFixedBuf *buf;
+    LuringBufTable *t;
+    unsigned int lo, hi;
+    size_t offset;
+
+    if (!(flags & BDRV_REQ_REGISTERED_BUF) || qiov->niov != 1 || !len ||
+        !qatomic_read(&s->fixed_bufs)) {
+        return -1;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    t = qatomic_rcu_read(&luring_buf_table);
+    if (!t) {
+        return -1;
+    }
+
+    /* Find the last buffer that starts at or before base */
+    lo = 0;
+    hi = t->nb_bufs;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if ((uintptr_t)t->bufs[mid].host <= base) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return -1;
+    }
+
+    buf = &t->bufs[lo - 1];
+    offset = base - (uintptr_t)buf->host;
+    if (offset >= buf->size || len > buf->size - offset) {
+        return -1;
+    }
+
+    /* The request must not cross into the next slot */
+    if (offset / LURING_FIXED_BUF_MAX_SIZE !=
+        (offset + len - 1) / LURING_FIXED_BUF_MAX_SIZE) {
+        return -1;
+    }
+    return buf->first_slot + offset / LURING_FIXED_BUF_MAX_SIZE;
+}
+
+/*
+ * Return the fixed file slot for @fd, registering @fd in a free slot if
+ * necessary, or -1 if the fd cannot be used as a fixed file.
+ */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int free_slot = -1;
+    int i, ret;
+
+    if (!s->fixed_files) {
+        return -1;
+    }
+
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        int slot_fd = qatomic_read(&s->fixed_fds[i]);
+
+        if (slot_fd == fd) {
+            return i;
+        } else if (slot_fd < 0 && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        return -1;
+    }
+
+    qatomic_set(&s->fixed_fds[free_slot], fd);
+    ret = io_uring_register_files_update(&s->ring, free_slot, &fd, 1);
+    if (ret < 0) {
+        trace_luring_fixed_files_failed(s, ret);
+        qatomic_set(&s->fixed_fds[free_slot], -1);
+        s->fixed_files = false;
+        return -1;
+    }
+    return free_slot;
+}
+
+void luring_unregister_fd(int fd)
+{
+    LuringState *s;
+    int no_fd = -1;
+    int i;
+
+    QEMU_LOCK_GUARD(&luring_reg_lock);
+
+    /*
+     * The caller makes sure that there are no requests for @fd, so the ring
+     * threads do not look at the slots for @fd concurrently.  Clear the slot
+     * in the kernel first, so that it is not reused before that is done.
+     */
+    QLIST_FOREACH(s, &luring_states, next) {
+        for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+            if (qatomic_read(&s->fixed_fds[i]) == fd) {
+                io_uring_register_files_update(&s->ring, i, &no_fd, 1);
+                qatomic_set(&s->fixed_fds[i], -1);
+            }
+        }
+    }
+}
+
+static void luring_init_fixed(LuringState *s)
+{
+    LuringBufRegion *r;
+    int i;
+
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        s->fixed_fds[i] = -1;
+    }
+    s->fixed_files = io_uring_register_files_sparse(&s->ring,
+                                                    LURING_MAX_FIXED_FILES) == 0;
+
+    QEMU_LOCK_GUARD(&luring_reg_lock);
+    QLIST_FOREACH(r, &luring_buf_regions, next) {
+        luring_add_fixed_buf_locked(s, &r->buf);
+    }
+    QLIST_INSERT_HEAD(&luring_states, s, next);
+}
+
+static void luring_cleanup_fixed(LuringState *s)
+{
+    QEMU_LOCK_GUARD(&luring_reg_lock);
+    QLIST_REMOVE(s, next);
+}
+#else /* !HAVE_IO_URING_REGISTER_SPARSE */
+void luring_register_buf(void *host, size_t size)
+{
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+}
+
+void luring_unregister_fd(int fd)
+{
+}
+
+static int luring_fixed_buf(LuringState *s, QEMUIOVector *qiov,
+                            BdrvRequestFlags flags)
+{
+    return -1;
+}
+
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    return -1;
+}
+
+static void luring_init_fixed(LuringState *s)
+{
+}
+
+static void luring_cleanup_fixed(LuringState *s)
+{
+}
+#endif /* !HAVE_IO_URING_REGISTER_SPARSE */
+
 /**
  * luring_resubmit:
  *
@@ -88,6 +508,16 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     /* Update read position */
     luringcb->total_read += nread;
+
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        /* The buffer is contiguous, just skip what was read */
+        luringcb->sqeq.off += nread;
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len -= nread;
+        luring_resubmit(s, luringcb);
+        return;
+    }
+
     remaining = luringcb->qiov->size - luringcb->total_read;
 
     /* Shorten qiov */
@@ -221,7 +651,13 @@ end:
         }
     }
 
-    qemu_bh_cancel(s->completion_bh);
+    /*
+     * Nothing will tell us about completions on a ring that must be polled,
+     * so keep polling from the BH while requests are in flight.
+     */
+    if (!s->reap_by_polling || !s->io_q.in_flight) {
+        qemu_bh_cancel(s->completion_bh);
+    }
 
     defer_call_end();
 }
@@ -295,6 +731,16 @@ static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
 
+    if (s->reap_by_polling && s->io_q.in_flight &&
+        !io_uring_cq_ready(&s->ring)) {
+        struct io_uring_cqe *cqe;
+
+        /*
+         * On IOPOLL rings, this enters the kernel to poll the device queue
+         * once, without waiting.  AioContext polling calls us in a loop.
+         */
+        return io_uring_peek_cqe(&s->ring, &cqe) == 0;
+    }
     return io_uring_cq_ready(&s->ring);
 }
 
@@ -338,29 +784,47 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                             uint64_t offset, int type, BdrvRequestFlags flags)
 {
     int ret;
+    int buf_index, file_index;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    QEMUIOVector *qiov = luringcb->qiov;
 
     switch (type) {
     case QEMU_AIO_WRITE:
-#ifdef HAVE_IO_URING_PREP_WRITEV2
     {
-        int luring_flags = (flags & BDRV_REQ_FUA) ? RWF_DSYNC : 0;
-        io_uring_prep_writev2(sqes, fd, luringcb->qiov->iov,
-                              luringcb->qiov->niov, offset, luring_flags);
-    }
+        int luring_flags = 0;
+
+#ifdef HAVE_IO_URING_PREP_WRITEV2
+        luring_flags = (flags & BDRV_REQ_FUA) ? RWF_DSYNC : 0;
 #else
-        assert(flags == 0);
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        assert(!(flags & BDRV_REQ_FUA));
+#endif
+        buf_index = luring_fixed_buf(s, qiov, flags);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, qiov->iov[0].iov_base,
+                                      qiov->iov[0].iov_len, offset, buf_index);
+            sqes->rw_flags = luring_flags;
+        } else {
+#ifdef HAVE_IO_URING_PREP_WRITEV2
+            io_uring_prep_writev2(sqes, fd, qiov->iov, qiov->niov, offset,
+                                  luring_flags);
+#else
+            io_uring_prep_writev(sqes, fd, qiov->iov, qiov->niov, offset);
 #endif
+        }
         break;
+    }
     case QEMU_AIO_ZONE_APPEND:
         io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
                              luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        buf_index = luring_fixed_buf(s, qiov, flags);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, qiov->iov[0].iov_base,
+                                     qiov->iov[0].iov_len, offset, buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, qiov->iov, qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
@@ -370,6 +834,12 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+
+    file_index = luring_fixed_file(s, fd);
+    if (file_index >= 0) {
+        sqes->fd = file_index;
+        io_uring_sqe_set_flags(sqes, IOSQE_FIXED_FILE);
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -388,13 +858,14 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     return 0;
 }
 
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type,
-                                  BdrvRequestFlags flags)
+int coroutine_fn luring_co_submit(BlockDriverState *bs,
+                                  const LuringSetup *setup, int fd,
+                                  uint64_t offset, QEMUIOVector *qiov,
+                                  int type, BdrvRequestFlags flags)
 {
     int ret;
     AioContext *ctx = qemu_get_current_aio_context();
-    LuringState *s = aio_get_linux_io_uring(ctx);
+    LuringState *s = aio_get_linux_io_uring(ctx, setup);
     LuringAIOCB luringcb = {
         .co         = qemu_coroutine_self(),
         .ret        = -EINPROGRESS,
@@ -432,15 +903,35 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(const LuringSetup *setup, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = {};
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    s->setup = (LuringSetup) { .sqpoll_cpu = -1 };
+    if (setup) {
+        s->setup = *setup;
+    }
+
+    if (s->setup.sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = LURING_SQPOLL_IDLE_MS;
+        if (s->setup.sqpoll_cpu >= 0) {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = s->setup.sqpoll_cpu;
+        }
+    }
+    if (s->setup.iopoll) {
+        params.flags |= IORING_SETUP_IOPOLL;
+        /* With SQPOLL, the kernel thread reaps completions, too */
+        s->reap_by_polling = !s->setup.sqpoll;
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
     if (rc < 0) {
         error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
@@ -448,12 +939,21 @@ LuringState *luring_init(Error **errp)
     }
 
     ioq_init(&s->io_q);
+    luring_init_fixed(s);
     return s;
 
 }
 
+bool luring_has_setup(LuringState *s, const LuringSetup *setup)
+{
+    return s->setup.sqpoll == setup->sqpoll &&
+           s->setup.iopoll == setup->iopoll &&
+           (!setup->sqpoll || s->setup.sqpoll_cpu == setup->sqpoll_cpu);
+}
+
 void luring_cleanup(LuringState *s)
 {
+    luring_cleanup_fixed(s);
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
     g_free(s);
@@ -29,7 +29,7 @@
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
-/* The mirroring buffer is a list of granularity-sized chunks.
+/* The mirroring buffer is a list of buf_chunk-sized chunks.
  * Free chunks are organized in a list.
  */
 typedef struct MirrorBuffer {
@@ -71,6 +71,8 @@ typedef struct MirrorBlockJob {
     bool should_complete;
     int64_t granularity;
     size_t buf_size;
+    /* Size of the chunks in the mirroring buffer, a multiple of granularity */
+    int64_t buf_chunk;
     int64_t bdev_length;
     unsigned long *cow_bitmap;
     unsigned long *zero_bitmap;
@@ -290,7 +292,7 @@ static int coroutine_fn mirror_cow_align(MirrorBlockJob *s, int64_t *offset,
     int ret = 0;
     int64_t align_offset = *offset;
     int64_t align_bytes = *bytes;
-    int max_bytes = s->granularity * s->max_iov;
+    int64_t max_bytes = s->buf_chunk * s->max_iov;
 
     need_cow = !test_bit(*offset / s->granularity, s->cow_bitmap);
     need_cow |= !test_bit((*offset + *bytes - 1) / s->granularity,
@@ -356,7 +358,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
     int ret = -1;
     uint64_t max_bytes;
 
-    max_bytes = s->granularity * s->max_iov;
+    max_bytes = s->buf_chunk * s->max_iov;
 
     /* We can only handle as much as buf_size at a time. */
     op->bytes = MIN(s->buf_size, MIN(max_bytes, op->bytes));
@@ -376,14 +378,14 @@ static void coroutine_fn mirror_co_read(void *opaque)
     assert(QEMU_IS_ALIGNED(op->offset, s->granularity));
     /* The range is sector-aligned, since bdrv_getlength() rounds up. */
     assert(QEMU_IS_ALIGNED(op->bytes, BDRV_SECTOR_SIZE));
-    nb_chunks = DIV_ROUND_UP(op->bytes, s->granularity);
+    nb_chunks = DIV_ROUND_UP(op->bytes, s->buf_chunk);
 
     while (s->buf_free_count < nb_chunks) {
         trace_mirror_yield_in_flight(s, op->offset, s->in_flight);
         mirror_wait_for_free_in_flight_slot(s);
     }
 
-    /* Now make a QEMUIOVector taking enough granularity-sized chunks
+    /* Now make a QEMUIOVector taking enough buf_chunk-sized chunks
      * from s->buf_free.
      */
     qemu_iovec_init(&op->qiov, nb_chunks);
@@ -393,7 +395,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
 
         QSIMPLEQ_REMOVE_HEAD(&s->buf_free, next);
         s->buf_free_count--;
-        qemu_iovec_add(&op->qiov, buf, MIN(s->granularity, remaining));
+        qemu_iovec_add(&op->qiov, buf, MIN(s->buf_chunk, remaining));
     }
 
     /* Copy the dirty cluster.  */
@@ -517,19 +519,63 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
     return bytes_handled;
 }
 
+/*
+ * A block status query for the rest of the area that mirror_iteration() is
+ * working on, which runs while the previous part of the area is copied.
+ */
+typedef struct MirrorBlockStatus {
+    BlockDriverState *bs;
+    int64_t offset;
+    int64_t bytes;          /* 0 if no query was started */
+    int64_t pnum;
+    int ret;
+    bool in_progress;
+    Coroutine *waiter;
+} MirrorBlockStatus;
+
+static void coroutine_fn mirror_block_status_entry(void *opaque)
+{
+    MirrorBlockStatus *bst = opaque;
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        bst->ret = bdrv_co_block_status_above(bst->bs, NULL, bst->offset,
+                                              bst->bytes, &bst->pnum,
+                                              NULL, NULL);
+    }
+
+    bst->in_progress = false;
+    if (bst->waiter) {
+        aio_co_wake(bst->waiter);
+    }
+}
+
+static void coroutine_fn mirror_block_status_wait(MirrorBlockStatus *bst)
+{
+    while (bst->in_progress) {
+        bst->waiter = qemu_coroutine_self();
+        qemu_coroutine_yield();
+        bst->waiter = NULL;
+    }
+}
+
 static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
 {
     BlockDriverState *source;
     MirrorOp *pseudo_op;
-    int64_t offset;
+    int64_t offset, dirty_start, dirty_bytes;
     /* At least the first dirty chunk is mirrored in one iteration. */
-    int nb_chunks = 1;
+    int64_t nb_chunks = 1;
+    int64_t start_chunk, end;
+    int64_t status_end = 0;
+    int status = 0;
+    MirrorBlockStatus prefetch = {};
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
     int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
 
     bdrv_graph_co_rdlock();
     source = s->mirror_top_bs->backing->bs;
     bdrv_graph_co_rdunlock();
+    prefetch.bs = source;
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -542,7 +588,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     bdrv_dirty_bitmap_unlock(s->dirty_bitmap);
 
     /*
-     * Wait for concurrent requests to @offset.  The next loop will limit the
+     * Wait for concurrent requests to @offset.  The code below will limit the
      * copied area based on in_flight_bitmap so we only copy an area that does
      * not overlap with concurrent in-flight requests.  Still, we would like to
      * copy something, so wait until there are at least no more requests to the
@@ -552,29 +598,27 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
 
     job_pause_point(&s->common.job);
 
-    /* Find the number of consecutive dirty chunks following the first dirty
-     * one, and wait for in flight requests in them. */
+    /*
+     * Take the whole dirty area that starts at @offset at once, up to the
+     * buffer size and the first chunk that has a request in flight.  At
+     * least the first chunk is taken even if it was cleaned meanwhile.
+     */
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
-    while (nb_chunks * s->granularity < s->buf_size) {
-        int64_t next_dirty;
-        int64_t next_offset = offset + nb_chunks * s->granularity;
-        int64_t next_chunk = next_offset / s->granularity;
-        if (next_offset >= s->bdev_length ||
-            !bdrv_dirty_bitmap_get_locked(s->dirty_bitmap, next_offset)) {
-            break;
-        }
-        if (test_bit(next_chunk, s->in_flight_bitmap)) {
-            break;
-        }
-
-        next_dirty = bdrv_dirty_iter_next(s->dbi);
-        if (next_dirty > next_offset || next_dirty < 0) {
-            /* The bitmap iterator's cache is stale, refresh it */
-            bdrv_set_dirty_iter(s->dbi, next_offset);
-            next_dirty = bdrv_dirty_iter_next(s->dbi);
-        }
-        assert(next_dirty == next_offset);
-        nb_chunks++;
+    if (bdrv_dirty_bitmap_next_dirty_area(s->dirty_bitmap, offset,
+                                          offset + s->buf_size, s->buf_size,
+                                          &dirty_start, &dirty_bytes) &&
+        dirty_start == offset) {
+        nb_chunks = DIV_ROUND_UP(dirty_bytes, s->granularity);
+    }
+    start_chunk = offset / s->granularity;
+    nb_chunks = find_next_bit(s->in_flight_bitmap, start_chunk + nb_chunks,
+                              start_chunk + 1) - start_chunk;
+
+    /* Continue after the area next time */
+    if (offset + nb_chunks * s->granularity < s->bdev_length) {
+        bdrv_set_dirty_iter(s->dbi, offset + nb_chunks * s->granularity);
+    } else {
+        bdrv_set_dirty_iter(s->dbi, 0);
     }
 
     /* Clear dirty bits before querying the block status, because
@@ -601,6 +645,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     QTAILQ_INSERT_TAIL(&s->ops_in_flight, pseudo_op, next);
 
     bitmap_set(s->in_flight_bitmap, offset / s->granularity, nb_chunks);
+    end = MIN(offset + nb_chunks * s->granularity, s->bdev_length);
     while (nb_chunks > 0 && offset < s->bdev_length) {
         int ret = -1;
         int64_t io_bytes;
@@ -609,15 +654,38 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
         MirrorMethod mirror_method = MIRROR_METHOD_COPY;
 
         assert(!(offset % s->granularity));
-        WITH_GRAPH_RDLOCK_GUARD() {
-            ret = bdrv_co_block_status_above(source, NULL, offset,
-                                             nb_chunks * s->granularity,
-                                             &io_bytes, NULL, NULL);
+
+        /*
+         * One block status query usually covers much more than one request
+         * can copy, so only query again when the previous result is used up.
+         * Data written in the meantime is marked dirty again anyway.  The
+         * query for the rest of the area may already have been started
+         * below, while the previous request was copied.
+         */
+        if (offset >= status_end) {
+            mirror_block_status_wait(&prefetch);
+            if (prefetch.bytes && prefetch.offset == offset) {
+                status = prefetch.ret;
+                io_bytes = prefetch.pnum;
+            } else {
+                WITH_GRAPH_RDLOCK_GUARD() {
+                    status = bdrv_co_block_status_above(source, NULL, offset,
+                                                        nb_chunks *
+                                                        s->granularity,
+                                                        &io_bytes, NULL, NULL);
+                }
+            }
+            prefetch.bytes = 0;
+            status_end = status < 0 ? offset : offset + io_bytes;
         }
+        ret = status;
         if (ret < 0) {
             io_bytes = MIN(nb_chunks * s->granularity, max_io_bytes);
-        } else if (ret & BDRV_BLOCK_DATA) {
-            io_bytes = MIN(io_bytes, max_io_bytes);
+        } else {
+            io_bytes = status_end - offset;
+            if (ret & BDRV_BLOCK_DATA) {
+                io_bytes = MIN(io_bytes, max_io_bytes);
+            }
         }
 
         io_bytes -= io_bytes % s->granularity;
@@ -638,6 +706,21 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
             }
         }
 
+        /*
+         * If this request uses up the block status, query the rest of the
+         * area while waiting for a free slot and copying.
+         */
+        if (status >= 0 && offset + io_bytes >= status_end &&
+            status_end < end && !prefetch.bytes) {
+            prefetch.offset = status_end;
+            prefetch.bytes = end - status_end;
+            prefetch.in_progress = true;
+            trace_mirror_block_status_prefetch(s, prefetch.offset,
+                                               prefetch.bytes);
+            qemu_coroutine_enter(
+                qemu_coroutine_create(mirror_block_status_entry, &prefetch));
+        }
+
         while (s->in_flight >= MAX_IN_FLIGHT) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
@@ -664,6 +747,9 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     }
 
 fail:
+    /* @prefetch is on the stack */
+    mirror_block_status_wait(&prefetch);
+
     QTAILQ_REMOVE(&s->ops_in_flight, pseudo_op, next);
     qemu_co_queue_restart_all(&pseudo_op->waiting_requests);
     g_free(pseudo_op);
@@ -671,7 +757,7 @@ fail:
 
 static void mirror_free_init(MirrorBlockJob *s)
 {
-    int granularity = s->granularity;
+    int64_t buf_chunk = s->buf_chunk;
     size_t buf_size = s->buf_size;
     uint8_t *buf = s->buf;
 
@@ -681,8 +767,8 @@ static void mirror_free_init(MirrorBlockJob *s)
         MirrorBuffer *cur = (MirrorBuffer *)buf;
         QSIMPLEQ_INSERT_TAIL(&s->buf_free, cur, next);
         s->buf_free_count++;
-        buf_size -= granularity;
-        buf += granularity;
+        buf_size -= buf_chunk;
+        buf += buf_chunk;
     }
 }
 
@@ -1095,6 +1181,19 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
     bdrv_graph_co_rdunlock();
 
+    /*
+     * Each buffer chunk is one I/O vector element, so with a small
+     * granularity, requests would be limited to a small part of the buffer.
+     * Use larger chunks in that case, so that large dirty extents can still
+     * be copied with one request.
+     */
+    s->buf_chunk = s->granularity;
+    while (s->buf_chunk * s->max_iov < s->buf_size &&
+           s->buf_chunk * 2 <= s->buf_size) {
+        s->buf_chunk *= 2;
+    }
+    s->buf_size = QEMU_ALIGN_DOWN(s->buf_size, s->buf_chunk);
+
     s->buf = qemu_try_blockalign(bs, s->buf_size);
     if (s->buf == NULL) {
         ret = -ENOMEM;
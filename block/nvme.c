@@ -46,15 +46,18 @@
 
 typedef struct BDRVNVMeState BDRVNVMeState;
 
-/* Same index is used for queues and IRQs */
 #define INDEX_ADMIN     0
 #define INDEX_IO(n)     (1 + n)
 
-/* This driver shares a single MSIX IRQ for the admin and I/O queues */
-enum {
-    MSIX_SHARED_IRQ_IDX = 0,
-    MSIX_IRQ_COUNT = 1
-};
+/*
+ * The admin queue and the first I/O queue share an MSIX IRQ and are processed
+ * in the AioContext of the BlockDriverState.  Each further I/O queue has an
+ * IRQ of its own and serves one other AioContext, which also processes its
+ * completions, so that multiqueue devices get a queue per iothread.
+ */
+#define MSIX_SHARED_IRQ_IDX     0
+#define NVME_MAX_IO_QUEUES      64
+#define MSIX_IRQ_COUNT          NVME_MAX_IO_QUEUES
 
 typedef struct {
     int32_t  head, tail;
@@ -79,6 +82,14 @@ typedef struct {
     /* Read from I/O code path, initialized under BQL */
     BDRVNVMeState   *s;
     int             index;
+    int             irq_idx;
+
+    /*
+     * For queues with an IRQ of their own, the AioContext that uses them.
+     * Set by that AioContext on first use, cleared under BQL when the node
+     * changes AioContext and on close.
+     */
+    AioContext  *ctx;
 
     /* Fields protected by BQL */
     uint8_t     *prp_list_pages;
@@ -116,6 +127,7 @@ struct BDRVNVMeState {
     size_t doorbell_scale;
     bool write_cache_supported;
     EventNotifier irq_notifier[MSIX_IRQ_COUNT];
+    unsigned irq_count;
 
     uint64_t nsze; /* Namespace size reported by identify command */
     int nsid;      /* The namespace id to read/write data. */
@@ -144,6 +156,7 @@ struct BDRVNVMeState {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_IO_QUEUES "io-queues"
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -161,6 +174,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_IO_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -248,7 +266,10 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
     q->s = s;
     q->index = idx;
     qemu_co_queue_init(&q->free_req_queue);
-    q->completion_bh = aio_bh_new(aio_context, nvme_process_completion_bh, q);
+    if (aio_context) {
+        q->completion_bh = aio_bh_new(aio_context,
+                                      nvme_process_completion_bh, q);
+    }
     r = qemu_vfio_dma_map(s->vfio, q->prp_list_pages, bytes,
                           false, &prp_list_iova, errp);
     if (r) {
@@ -345,7 +366,7 @@ static void nvme_put_free_req_locked(NVMeQueuePair *q, NVMeRequest *req)
 static void nvme_wake_free_req_locked(NVMeQueuePair *q)
 {
     if (!qemu_co_queue_empty(&q->free_req_queue)) {
-        replay_bh_schedule_oneshot_event(q->s->aio_context,
+        replay_bh_schedule_oneshot_event(q->ctx ?: q->s->aio_context,
                 nvme_free_req_queue_cb, q);
     }
 }
@@ -626,18 +647,23 @@ out:
     return ret;
 }
 
-static void nvme_poll_queue(NVMeQueuePair *q)
+/*
+ * Check for completions without q->lock.  The lock isn't needed because
+ * nvme_process_completion() only runs in the event loop thread of the queue
+ * and cannot race with itself.
+ */
+static bool nvme_queue_has_completion(NVMeQueuePair *q)
 {
     const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
     NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
 
+    return (le16_to_cpu(cqe->status) & 0x1) != q->cq_phase;
+}
+
+static void nvme_poll_queue(NVMeQueuePair *q)
+{
     trace_nvme_poll_queue(q->s, q->index);
-    /*
-     * Do an early check for completions. q->lock isn't needed because
-     * nvme_process_completion() only runs in the event loop thread and
-     * cannot race with itself.
-     */
-    if ((le16_to_cpu(cqe->status) & 0x1) == q->cq_phase) {
+    if (!nvme_queue_has_completion(q)) {
         return;
     }
 
@@ -648,11 +674,17 @@ static void nvme_poll_queue(NVMeQueuePair *q)
     qemu_mutex_unlock(&q->lock);
 }
 
+/* Number of queues that are processed in the AioContext of the BDS */
+static unsigned nvme_shared_queue_count(BDRVNVMeState *s)
+{
+    return MIN(s->queue_count, INDEX_IO(1));
+}
+
 static void nvme_poll_queues(BDRVNVMeState *s)
 {
     int i;
 
-    for (i = 0; i < s->queue_count; i++) {
+    for (i = 0; i < nvme_shared_queue_count(s); i++) {
         nvme_poll_queue(s->queues[i]);
     }
 }
@@ -667,6 +699,93 @@ static void nvme_handle_event(EventNotifier *n)
     nvme_poll_queues(s);
 }
 
+static void nvme_handle_queue_event(void *opaque)
+{
+    NVMeQueuePair *q = opaque;
+
+    trace_nvme_handle_queue_event(q->s, q->index);
+    event_notifier_test_and_clear(&q->s->irq_notifier[q->irq_idx]);
+    nvme_poll_queue(q);
+}
+
+static bool nvme_queue_poll_cb(void *opaque)
+{
+    return nvme_queue_has_completion(opaque);
+}
+
+static void nvme_queue_poll_ready(void *opaque)
+{
+    nvme_poll_queue(opaque);
+}
+
+/* Called in @q->ctx, before the first request is submitted to @q */
+static void nvme_bind_io_queue(NVMeQueuePair *q)
+{
+    BDRVNVMeState *s = q->s;
+    EventNotifier *e = &s->irq_notifier[q->irq_idx];
+
+    trace_nvme_bind_io_queue(s, q->index, q->ctx);
+    /* Keep the AioContext alive even if its iothread goes away */
+    aio_context_ref(q->ctx);
+    q->completion_bh = aio_bh_new(q->ctx, nvme_process_completion_bh, q);
+    aio_set_fd_handler(q->ctx, event_notifier_get_fd(e),
+                       nvme_handle_queue_event, NULL, nvme_queue_poll_cb,
+                       nvme_queue_poll_ready, q);
+}
+
+/*
+ * Release the I/O queues with an IRQ of their own from the AioContexts that
+ * used them.  Called under BQL while there are no requests.
+ */
+static void nvme_unbind_io_queues(BDRVNVMeState *s)
+{
+    for (unsigned i = INDEX_IO(1); i < s->queue_count; i++) {
+        NVMeQueuePair *q = s->queues[i];
+        AioContext *ctx = q->ctx;
+
+        if (!ctx) {
+            continue;
+        }
+        assert(!q->inflight);
+        aio_set_fd_handler(ctx,
+                           event_notifier_get_fd(&s->irq_notifier[q->irq_idx]),
+                           NULL, NULL, NULL, NULL, NULL);
+        qemu_bh_delete(q->completion_bh);
+        q->completion_bh = NULL;
+        qatomic_set(&q->ctx, NULL);
+        aio_context_unref(ctx);
+    }
+}
+
+/*
+ * Return the I/O queue for requests from the current AioContext.  Requests
+ * from the AioContext of the BDS use the first I/O queue; any other
+ * AioContext gets a queue of its own if one is left, or shares the first one
+ * otherwise.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    if (ctx == s->aio_context) {
+        return s->queues[INDEX_IO(0)];
+    }
+
+    for (unsigned i = INDEX_IO(1); i < s->queue_count; i++) {
+        NVMeQueuePair *q = s->queues[i];
+        AioContext *owner = qatomic_read(&q->ctx);
+
+        if (owner == ctx) {
+            return q;
+        }
+        if (!owner && !qatomic_cmpxchg(&q->ctx, NULL, ctx)) {
+            nvme_bind_io_queue(q);
+            return q;
+        }
+    }
+    return s->queues[INDEX_IO(0)];
+}
+
 static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
@@ -674,18 +793,23 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     NVMeQueuePair *q;
     NvmeCmd cmd;
     unsigned queue_size = NVME_QUEUE_SIZE;
+    /* The first I/O queue shares the IRQ of the admin queue */
+    unsigned irq_idx = n <= INDEX_IO(0) ? MSIX_SHARED_IRQ_IDX : n - 1;
+    bool shared = irq_idx == MSIX_SHARED_IRQ_IDX;
 
     assert(n <= UINT16_MAX);
-    q = nvme_create_queue_pair(s, bdrv_get_aio_context(bs),
+    assert(irq_idx < s->irq_count);
+    q = nvme_create_queue_pair(s, shared ? bdrv_get_aio_context(bs) : NULL,
                                n, queue_size, errp);
     if (!q) {
         return false;
     }
+    q->irq_idx = irq_idx;
     cmd = (NvmeCmd) {
         .opcode = NVME_ADM_CMD_CREATE_CQ,
         .dptr.prp1 = cpu_to_le64(q->cq.iova),
         .cdw10 = cpu_to_le32(((queue_size - 1) << 16) | n),
-        .cdw11 = cpu_to_le32(NVME_CQ_IEN | NVME_CQ_PC),
+        .cdw11 = cpu_to_le32(NVME_CQ_IEN | NVME_CQ_PC | (irq_idx << 16)),
     };
     if (nvme_admin_cmd_sync(bs, &cmd)) {
         error_setg(errp, "Failed to create CQ io queue [%u]", n);
@@ -717,16 +841,8 @@ static bool nvme_poll_cb(void *opaque)
                                     irq_notifier[MSIX_SHARED_IRQ_IDX]);
     int i;
 
-    for (i = 0; i < s->queue_count; i++) {
-        NVMeQueuePair *q = s->queues[i];
-        const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
-        NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
-
-        /*
-         * q->lock isn't needed because nvme_process_completion() only runs in
-         * the event loop thread and cannot race with itself.
-         */
-        if ((le16_to_cpu(cqe->status) & 0x1) != q->cq_phase) {
+    for (i = 0; i < nvme_shared_queue_count(s); i++) {
+        if (nvme_queue_has_completion(s->queues[i])) {
             return true;
         }
     }
@@ -741,8 +857,20 @@ static void nvme_poll_ready(EventNotifier *e)
     nvme_poll_queues(s);
 }
 
+static int nvme_set_queue_count(BlockDriverState *bs, unsigned io_queues)
+{
+    /* Both counts are 0's based */
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((io_queues - 1) << 16) | (io_queues - 1)),
+    };
+
+    return nvme_admin_cmd_sync(bs, &cmd);
+}
+
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     unsigned io_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q;
@@ -754,16 +882,20 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     uint64_t timeout_ms;
     uint64_t deadline, now;
     NvmeBar *regs = NULL;
+    unsigned irqs;
 
+    assert(io_queues >= 1 && io_queues <= NVME_MAX_IO_QUEUES);
     qemu_co_mutex_init(&s->dma_map_lock);
     qemu_co_queue_init(&s->dma_flush_queue);
     s->device = g_strdup(device);
     s->nsid = namespace;
     s->aio_context = bdrv_get_aio_context(bs);
-    ret = event_notifier_init(&s->irq_notifier[MSIX_SHARED_IRQ_IDX], 0);
-    if (ret) {
-        error_setg(errp, "Failed to init event notifier");
-        return ret;
+    for (s->irq_count = 0; s->irq_count < io_queues; s->irq_count++) {
+        ret = event_notifier_init(&s->irq_notifier[s->irq_count], 0);
+        if (ret) {
+            error_setg(errp, "Failed to init event notifier");
+            return ret;
+        }
     }
 
     s->vfio = qemu_vfio_open_pci(device, errp);
@@ -870,11 +1002,12 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         }
     }
 
-    ret = qemu_vfio_pci_init_irq(s->vfio, s->irq_notifier,
+    ret = qemu_vfio_pci_init_irq(s->vfio, s->irq_notifier, s->irq_count,
                                  VFIO_PCI_MSIX_IRQ_INDEX, errp);
-    if (ret) {
+    if (ret < 0) {
         goto out;
     }
+    irqs = ret;
     aio_set_event_notifier(bdrv_get_aio_context(bs),
                            &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
                            nvme_handle_event, nvme_poll_cb,
@@ -885,10 +1018,34 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         goto out;
     }
 
+    io_queues = MIN(io_queues, irqs);
+    if (io_queues > 1 && nvme_set_queue_count(bs, io_queues)) {
+        warn_report("NVMe controller refused %u I/O queues, using one",
+                    io_queues);
+        io_queues = 1;
+    }
+
     /* Set up command queues. */
     if (!nvme_add_io_queue(bs, errp)) {
         ret = -EIO;
+        goto out;
     }
+
+    /*
+     * Queues for other AioContexts are created up front because admin
+     * commands can only be run from the AioContext of the BDS.  They are
+     * bound to an AioContext when it submits its first request.
+     */
+    while (s->queue_count < INDEX_IO(io_queues)) {
+        Error *local_err = NULL;
+
+        if (!nvme_add_io_queue(bs, &local_err)) {
+            warn_reportf_err(local_err, "Using %u I/O queues: ",
+                             s->queue_count - INDEX_IO(0));
+            break;
+        }
+    }
+    ret = 0;
 out:
     if (regs) {
         qemu_vfio_pci_unmap_bar(s->vfio, 0, (void *)regs, 0, sizeof(NvmeBar));
@@ -957,6 +1114,7 @@ static void nvme_close(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
 
+    nvme_unbind_io_queues(s);
     for (unsigned i = 0; i < s->queue_count; ++i) {
         nvme_free_queue_pair(s->queues[i]);
     }
@@ -964,7 +1122,9 @@ static void nvme_close(BlockDriverState *bs)
     aio_set_event_notifier(bdrv_get_aio_context(bs),
                            &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
                            NULL, NULL, NULL);
-    event_notifier_cleanup(&s->irq_notifier[MSIX_SHARED_IRQ_IDX]);
+    for (unsigned i = 0; i < s->irq_count; i++) {
+        event_notifier_cleanup(&s->irq_notifier[i]);
+    }
     qemu_vfio_pci_unmap_bar(s->vfio, 0, s->bar0_wo_map,
                             0, sizeof(NvmeBar) + NVME_DOORBELL_SIZE);
     qemu_vfio_close(s->vfio);
@@ -978,6 +1138,7 @@ static int nvme_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t io_queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -993,7 +1154,14 @@ static int nvme_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    io_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_IO_QUEUES, 1);
+    if (io_queues < 1 || io_queues > NVME_MAX_IO_QUEUES) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_IO_QUEUES "' must be between 1 "
+                   "and %d", NVME_MAX_IO_QUEUES);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, io_queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1193,7 +1361,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1206,7 +1374,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
         .cdw12 = cpu_to_le32(cdw12),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1314,14 +1482,14 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
         .nsid = cpu_to_le32(s->nsid),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1345,7 +1513,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     uint32_t cdw12;
 
@@ -1372,7 +1540,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1408,7 +1576,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int64_t bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     QEMU_AUTO_VFREE NvmeDsmRange *buf = NULL;
     QEMUIOVector local_qiov;
@@ -1422,7 +1590,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1552,7 +1720,8 @@ static void nvme_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
 
-    for (unsigned i = 0; i < s->queue_count; i++) {
+    nvme_unbind_io_queues(s);
+    for (unsigned i = 0; i < nvme_shared_queue_count(s); i++) {
         NVMeQueuePair *q = s->queues[i];
 
         qemu_bh_delete(q->completion_bh);
@@ -1574,7 +1743,7 @@ static void nvme_attach_aio_context(BlockDriverState *bs,
                            nvme_handle_event, nvme_poll_cb,
                            nvme_poll_ready);
 
-    for (unsigned i = 0; i < s->queue_count; i++) {
+    for (unsigned i = 0; i < nvme_shared_queue_count(s); i++) {
         NVMeQueuePair *q = s->queues[i];
 
         q->completion_bh =
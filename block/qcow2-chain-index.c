@@ -0,0 +1,317 @@
+/*
+ * Index of the backing chain layers that unallocated qcow2 areas read from
+ *
+ * Without the index, a read from an area that is unallocated in a qcow2
+ * image is passed to the backing file, which looks up its own L2 table and
+ * passes the read on if the area is unallocated there, too, and so on down
+ * the chain.  With deep snapshot chains, that is a lot of work for every
+ * request.  The index remembers, for ranges of guest offsets, which layer
+ * owns the data and where it is stored, so that such reads go directly to
+ * the owner (or to its data file) after one lookup.
+ *
+ * Entries are filled in lazily from the block status of the layers.  The
+ * index is checked against the chain before each use: if any layer was
+ * written to or otherwise changed (which changes its block-status cache
+ * generation), or the chain itself changed, all entries are dropped.  This
+ * is cheap because backing files are rarely written to.  Writes to the top
+ * image itself do not matter because the index is only used for areas that
+ * are unallocated there.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "qemu/interval-tree.h"
+#include "qemu/lockable.h"
+#include "qcow2.h"
+#include "trace.h"
+
+/* Maximum number of ranges in the index */
+#define QCOW2_CHAIN_INDEX_MAX_ENTRIES 4096
+
+typedef struct Qcow2ChainIndexEntry {
+    IntervalTreeNode node;
+    /*
+     * Where to read node.start from: @child at @offset, or zeroes if @child
+     * is NULL
+     */
+    BdrvChild *child;
+    int64_t offset;
+    QTAILQ_ENTRY(Qcow2ChainIndexEntry) lru;
+} Qcow2ChainIndexEntry;
+
+/* One layer of the backing chain, as seen when the index was last reset */
+typedef struct Qcow2ChainIndexLayer {
+    BdrvChild *child;           /* Backing child of the layer above */
+    unsigned int bsc_gen;       /* Block-status cache generation of the layer */
+} Qcow2ChainIndexLayer;
+
+struct Qcow2ChainIndex {
+    QemuMutex lock;
+    IntervalTreeRoot tree;
+    QTAILQ_HEAD(, Qcow2ChainIndexEntry) lru;
+    int nb_entries;
+
+    Qcow2ChainIndexLayer *layers;
+    int nb_layers;
+    uint64_t resets;
+};
+
+Qcow2ChainIndex *qcow2_chain_index_create(void)
+{
+    Qcow2ChainIndex *ci = g_new0(Qcow2ChainIndex, 1);
+
+    qemu_mutex_init(&ci->lock);
+    QTAILQ_INIT(&ci->lru);
+    return ci;
+}
+
+static void qcow2_chain_index_remove_locked(Qcow2ChainIndex *ci,
+                                            Qcow2ChainIndexEntry *e)
+{
+    interval_tree_remove(&e->node, &ci->tree);
+    QTAILQ_REMOVE(&ci->lru, e, lru);
+    ci->nb_entries--;
+    g_free(e);
+}
+
+static void qcow2_chain_index_clear_locked(Qcow2ChainIndex *ci)
+{
+    while (!QTAILQ_EMPTY(&ci->lru)) {
+        qcow2_chain_index_remove_locked(ci, QTAILQ_FIRST(&ci->lru));
+    }
+}
+
+void qcow2_chain_index_destroy(Qcow2ChainIndex *ci)
+{
+    if (!ci) {
+        return;
+    }
+    qcow2_chain_index_clear_locked(ci);
+    g_free(ci->layers);
+    qemu_mutex_destroy(&ci->lock);
+    g_free(ci);
+}
+
+/*
+ * Make sure that the index still describes the backing chain of @bs, and
+ * reset it if not.  Return false if the chain cannot be indexed because it
+ * contains filters, which may do anything with the requests.
+ */
+static bool GRAPH_RDLOCK
+qcow2_chain_index_validate_locked(Qcow2ChainIndex *ci, BlockDriverState *bs)
+{
+    BdrvChild *child;
+    int i = 0;
+    bool valid = true;
+
+    for (child = bs->backing; child; child = child->bs->backing) {
+        if (!child->bs->drv || child->bs->drv->is_filter) {
+            return false;
+        }
+        if (i >= ci->nb_layers || ci->layers[i].child != child ||
+            ci->layers[i].bsc_gen != bdrv_bsc_generation(child->bs)) {
+            valid = false;
+        }
+        i++;
+    }
+    if (valid && i == ci->nb_layers) {
+        return true;
+    }
+
+    trace_qcow2_chain_index_reset(bs, i);
+    qcow2_chain_index_clear_locked(ci);
+    ci->resets++;
+    ci->nb_layers = i;
+    ci->layers = g_renew(Qcow2ChainIndexLayer, ci->layers, i);
+    for (child = bs->backing, i = 0; child; child = child->bs->backing, i++) {
+        ci->layers[i] = (Qcow2ChainIndexLayer) {
+            .child = child,
+            .bsc_gen = bdrv_bsc_generation(child->bs),
+        };
+    }
+    return true;
+}
+
+static bool qcow2_chain_index_lookup_locked(Qcow2ChainIndex *ci,
+                                            int64_t offset, int64_t *bytes,
+                                            BdrvChild **child,
+                                            int64_t *child_offset)
+{
+    IntervalTreeNode *node = interval_tree_iter_first(&ci->tree,
+                                                      offset, offset);
+    Qcow2ChainIndexEntry *e;
+
+    if (!node) {
+        return false;
+    }
+    e = container_of(node, Qcow2ChainIndexEntry, node);
+    QTAILQ_REMOVE(&ci->lru, e, lru);
+    QTAILQ_INSERT_TAIL(&ci->lru, e, lru);
+
+    *bytes = MIN(*bytes, e->node.last + 1 - offset);
+    *child = e->child;
+    *child_offset = e->offset + (offset - e->node.start);
+    return true;
+}
+
+static void qcow2_chain_index_insert_locked(Qcow2ChainIndex *ci,
+                                            int64_t offset, int64_t bytes,
+                                            BdrvChild *child,
+                                            int64_t child_offset)
+{
+    Qcow2ChainIndexEntry *e;
+    IntervalTreeNode *node, *next;
+
+    /* Another request may have resolved an overlapping range meanwhile */
+    node = interval_tree_iter_first(&ci->tree, offset, offset + bytes - 1);
+    while (node) {
+        next = interval_tree_iter_next(node, offset, offset + bytes - 1);
+        qcow2_chain_index_remove_locked(ci, container_of(node,
+                                                         Qcow2ChainIndexEntry,
+                                                         node));
+        node = next;
+    }
+
+    if (ci->nb_entries >= QCOW2_CHAIN_INDEX_MAX_ENTRIES) {
+        qcow2_chain_index_remove_locked(ci, QTAILQ_FIRST(&ci->lru));
+    }
+
+    e = g_new(Qcow2ChainIndexEntry, 1);
+    *e = (Qcow2ChainIndexEntry) {
+        .node.start = offset,
+        .node.last  = offset + bytes - 1,
+        .child      = child,
+        .offset     = child_offset,
+    };
+    interval_tree_insert(&e->node, &ci->tree);
+    QTAILQ_INSERT_TAIL(&ci->lru, e, lru);
+    ci->nb_entries++;
+}
+
+/*
+ * Find the layer of the backing chain that [offset, offset + *bytes) is
+ * read from, and how to read it: from @child at @child_offset, or as
+ * zeroes if *child is NULL.  Shorten *bytes to the part that is stored
+ * in one place.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_chain_index_resolve(BlockDriverState *bs, int64_t offset,
+                          int64_t *bytes, BdrvChild **child,
+                          int64_t *child_offset)
+{
+    BdrvChild *c;
+
+    for (c = bs->backing; c; c = c->bs->backing) {
+        BlockDriverState *file;
+        int64_t pnum, map;
+        int ret;
+
+        ret = bdrv_co_block_status(c->bs, offset, *bytes, &pnum, &map, &file);
+        if (ret < 0) {
+            return ret;
+        }
+        if (!pnum) {
+            /* Beyond the end of this layer, so it reads as zeroes */
+            break;
+        }
+        *bytes = pnum;
+
+        if (!(ret & BDRV_BLOCK_ALLOCATED)) {
+            continue;
+        }
+        if (ret & BDRV_BLOCK_ZERO) {
+            break;
+        }
+
+        /*
+         * Read plain data directly from the child of the owner that stores
+         * it.  Anything else (e.g. compressed or encrypted data) must be
+         * read through the owner.
+         */
+        if ((ret & BDRV_BLOCK_OFFSET_VALID) && (ret & BDRV_BLOCK_DATA)) {
+            BdrvChild *owner_child;
+
+            QLIST_FOREACH(owner_child, &c->bs->children, next) {
+                if (owner_child->bs == file) {
+                    *child = owner_child;
+                    *child_offset = map;
+                    return 0;
+                }
+            }
+        }
+        *child = c;
+        *child_offset = offset;
+        return 0;
+    }
+
+    *child = NULL;
+    *child_offset = 0;
+    return 0;
+}
+
+int coroutine_fn GRAPH_RDLOCK
+qcow2_chain_index_co_preadv(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes, QEMUIOVector *qiov,
+                            size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2ChainIndex *ci = s->chain_index;
+
+    while (bytes) {
+        int64_t n = bytes;
+        int64_t child_offset;
+        BdrvChild *child;
+        uint64_t resets;
+        bool found;
+        int ret;
+
+        WITH_QEMU_LOCK_GUARD(&ci->lock) {
+            if (!qcow2_chain_index_validate_locked(ci, bs)) {
+                return -ENOTSUP;
+            }
+            found = qcow2_chain_index_lookup_locked(ci, offset, &n, &child,
+                                                    &child_offset);
+            resets = ci->resets;
+        }
+
+        if (!found) {
+            ret = qcow2_chain_index_resolve(bs, offset, &n, &child,
+                                            &child_offset);
+            if (ret < 0) {
+                return ret;
+            }
+            WITH_QEMU_LOCK_GUARD(&ci->lock) {
+                /*
+                 * If a layer changed while we were looking at it, the index
+                 * was reset, and the result may be outdated already.
+                 */
+                if (qcow2_chain_index_validate_locked(ci, bs) &&
+                    ci->resets == resets) {
+                    qcow2_chain_index_insert_locked(ci, offset, n, child,
+                                                    child_offset);
+                }
+            }
+            trace_qcow2_chain_index_resolve(bs, offset, n, child,
+                                            child_offset);
+        }
+
+        if (child) {
+            ret = bdrv_co_preadv_part(child, child_offset, n,
+                                      qiov, qiov_offset, 0);
+            if (ret < 0) {
+                return ret;
+            }
+        } else {
+            qemu_iovec_memset(qiov, qiov_offset, 0, n);
+        }
+
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+    }
+
+    return 0;
+}
@@ -379,6 +379,25 @@ fail:
     return ret;
 }
 
+/*
+ * Allocate the L2 table for guest @offset if it does not exist yet, ahead of
+ * the writes that will need it.
+ *
+ * Called with s->lock held.
+ */
+int coroutine_fn qcow2_prealloc_l2_table(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l1_index = offset_to_l1_index(s, offset);
+
+    if (l1_index >= s->l1_vm_state_index || l1_index >= s->l1_size ||
+        s->l1_table[l1_index]) {
+        return 0;
+    }
+
+    return l2_allocate(bs, l1_index);
+}
+
 /*
  * For a given L2 entry, count the number of contiguous subclusters of
  * the same type starting from @sc_from. Compressed clusters are
@@ -1619,22 +1638,7 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
 
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
-    if (*host_offset == INV_OFFSET) {
-        int64_t cluster_offset =
-            qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
-        if (cluster_offset < 0) {
-            return cluster_offset;
-        }
-        *host_offset = cluster_offset;
-        return 0;
-    } else {
-        int64_t ret = qcow2_alloc_clusters_at(bs, *host_offset, *nb_clusters);
-        if (ret < 0) {
-            return ret;
-        }
-        *nb_clusters = ret;
-        return 0;
-    }
+    return qcow2_alloc_data_clusters(bs, host_offset, nb_clusters);
 }
 
 /*
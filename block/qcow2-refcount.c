@@ -1065,6 +1065,143 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
     return i;
 }
 
+/*
+ * Return the cluster pool of the current AioContext, or NULL if pools are not
+ * in use.  They only pay off once allocating writes come from more than one
+ * AioContext; until then, clusters are allocated for each request.
+ */
+static Qcow2ClusterPool *cluster_pool_get(BDRVQcow2State *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    Qcow2ClusterPool *pool;
+
+    if (!s->use_cluster_pools) {
+        if (!s->alloc_ctx || s->alloc_ctx == ctx) {
+            s->alloc_ctx = ctx;
+            return NULL;
+        }
+        s->use_cluster_pools = true;
+    }
+
+    QLIST_FOREACH(pool, &s->cluster_pools, next) {
+        if (pool->ctx == ctx) {
+            return pool;
+        }
+    }
+
+    pool = g_new0(Qcow2ClusterPool, 1);
+    pool->ctx = ctx;
+    QLIST_INSERT_HEAD(&s->cluster_pools, pool, next);
+    return pool;
+}
+
+/*
+ * Allocate clusters for the data of an allocating write, taking them from
+ * the pool of the current AioContext if pools are in use.  A pool is
+ * refilled with QCOW2_CLUSTER_POOL_SIZE bytes of clusters at a time.
+ *
+ * If *host_offset is INV_OFFSET, allocate *nb_clusters contiguous clusters
+ * and return their offset in *host_offset.  Otherwise, like
+ * qcow2_alloc_clusters_at(), only allocate clusters starting at
+ * *host_offset, and return their number in *nb_clusters.
+ *
+ * Called with s->lock held.
+ */
+int coroutine_fn
+qcow2_alloc_data_clusters(BlockDriverState *bs, uint64_t *host_offset,
+                          uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2ClusterPool *pool = cluster_pool_get(s);
+    uint64_t batch;
+    int64_t ret;
+
+    if (*host_offset != INV_OFFSET) {
+        if (!pool || !pool->nb_clusters || pool->offset != *host_offset) {
+            ret = qcow2_alloc_clusters_at(bs, *host_offset, *nb_clusters);
+            if (ret < 0) {
+                return ret;
+            }
+            *nb_clusters = ret;
+            return 0;
+        }
+        *nb_clusters = MIN(*nb_clusters, pool->nb_clusters);
+    } else if (!pool) {
+        ret = qcow2_alloc_clusters(bs, *nb_clusters << s->cluster_bits);
+        if (ret < 0) {
+            return ret;
+        }
+        *host_offset = ret;
+        return 0;
+    } else if (pool->nb_clusters < *nb_clusters) {
+        /* Give back the rest of the pool, and reserve a new run */
+        if (pool->nb_clusters) {
+            qcow2_free_clusters(bs, pool->offset,
+                                pool->nb_clusters << s->cluster_bits,
+                                QCOW2_DISCARD_NEVER);
+            pool->nb_clusters = 0;
+        }
+
+        batch = MAX(*nb_clusters, QCOW2_CLUSTER_POOL_SIZE >> s->cluster_bits);
+        ret = qcow2_alloc_clusters(bs, batch << s->cluster_bits);
+        if (ret < 0) {
+            return ret;
+        }
+        pool->offset = ret;
+        pool->nb_clusters = batch;
+        *host_offset = ret;
+    } else {
+        *host_offset = pool->offset;
+    }
+
+    pool->offset += *nb_clusters << s->cluster_bits;
+    pool->nb_clusters -= *nb_clusters;
+    return 0;
+}
+
+/*
+ * Allocate the refcount block for host cluster @cluster_index if it does not
+ * exist yet, ahead of the cluster allocations that will need it.
+ *
+ * Called with s->lock held.
+ */
+int coroutine_fn
+qcow2_prealloc_refcount_block(BlockDriverState *bs, uint64_t cluster_index)
+{
+    BDRVQcow2State *s = bs->opaque;
+    void *refcount_block = NULL;
+    int ret;
+
+    ret = alloc_refcount_block(bs, cluster_index, &refcount_block);
+    if (refcount_block) {
+        qcow2_cache_put(s->refcount_block_cache, &refcount_block);
+    }
+
+    /* -EAGAIN only means that a new block had to be allocated */
+    return ret == -EAGAIN ? 0 : ret;
+}
+
+/*
+ * Free the clusters left in all pools.  This must happen before the
+ * refcounts are written out for good, or rebuilt from the L2 tables, or
+ * the reserved clusters would leak.
+ */
+void qcow2_release_cluster_pools(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2ClusterPool *pool, *next_pool;
+
+    QLIST_FOREACH_SAFE(pool, &s->cluster_pools, next, next_pool) {
+        if (pool->nb_clusters) {
+            qcow2_free_clusters(bs, pool->offset,
+                                pool->nb_clusters << s->cluster_bits,
+                                QCOW2_DISCARD_NEVER);
+        }
+        QLIST_REMOVE(pool, next);
+        g_free(pool);
+    }
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -33,7 +33,12 @@
 #include <zstd_errors.h>
 #endif
 
+#ifdef CONFIG_LZ4
+#include <lz4.h>
+#endif
+
 #include "qcow2.h"
+#include "block/aio_task.h"
 #include "block/block-io.h"
 #include "block/thread-pool.h"
 #include "crypto.h"
@@ -325,6 +330,59 @@ static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
 }
 #endif
 
+#ifdef CONFIG_LZ4
+
+/*
+ * qcow2_lz4_compress()
+ *
+ * Compress @src_size bytes of data using lz4 compression method
+ *
+ * @dest - destination buffer, @dest_size bytes
+ * @src - source buffer, @src_size bytes
+ *
+ * Returns: compressed size on success
+ *          -ENOMEM destination buffer is not enough to store compressed data
+ */
+static ssize_t qcow2_lz4_compress(void *dest, size_t dest_size,
+                                  const void *src, size_t src_size)
+{
+    int ret;
+
+    ret = LZ4_compress_default(src, dest, src_size, dest_size);
+
+    /* lz4 returns 0 if the output does not fit, which is its only error */
+    return ret > 0 ? ret : -ENOMEM;
+}
+
+/*
+ * qcow2_lz4_decompress()
+ *
+ * Decompress some data (not more than @src_size bytes) to produce exactly
+ * @dest_size bytes using lz4 compression method
+ *
+ * @dest - destination buffer, @dest_size bytes
+ * @src - source buffer, @src_size bytes
+ *
+ * Returns: 0 on success
+ *          -EIO on fail
+ */
+static ssize_t qcow2_lz4_decompress(void *dest, size_t dest_size,
+                                    const void *src, size_t src_size)
+{
+    int ret;
+
+    /*
+     * @src may extend past the end of the block up to the next sector
+     * boundary.  Stop as soon as @dest is full instead of trying to decode
+     * what follows.
+     */
+    ret = LZ4_decompress_safe_partial(src, dest, src_size,
+                                      dest_size, dest_size);
+
+    return ret == dest_size ? 0 : -EIO;
+}
+#endif
+
 static int qcow2_compress_pool_func(void *opaque)
 {
     Qcow2CompressData *data = opaque;
@@ -335,9 +393,15 @@ static int qcow2_compress_pool_func(void *opaque)
     return 0;
 }
 
+/*
+ * Run @func in the thread pool.  Unless @background is true, wait for one
+ * of the QCOW2_MAX_THREADS slots of guest requests.  Background work is
+ * bounded by its callers instead, so that it never delays guest requests.
+ */
 static ssize_t coroutine_fn
 qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
-                     const void *src, size_t src_size, Qcow2CompressFunc func)
+                     const void *src, size_t src_size, Qcow2CompressFunc func,
+                     bool background)
 {
     Qcow2CompressData arg = {
         .dest = dest,
@@ -347,7 +411,11 @@ qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
         .func = func,
     };
 
-    qcow2_co_process(bs, qcow2_compress_pool_func, &arg);
+    if (background) {
+        thread_pool_submit_co(qcow2_compress_pool_func, &arg);
+    } else {
+        qcow2_co_process(bs, qcow2_compress_pool_func, &arg);
+    }
 
     return arg.ret;
 }
@@ -380,12 +448,48 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
     case QCOW2_COMPRESSION_TYPE_ZSTD:
         fn = qcow2_zstd_compress;
         break;
+#endif
+#ifdef CONFIG_LZ4
+    case QCOW2_COMPRESSION_TYPE_LZ4:
+        fn = qcow2_lz4_compress;
+        break;
+#endif
+    default:
+        abort();
+    }
+
+    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn,
+                                false);
+}
+
+static ssize_t coroutine_fn
+qcow2_co_do_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
+                       const void *src, size_t src_size, bool background)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressFunc fn;
+
+    switch (s->compression_type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        fn = qcow2_zlib_decompress;
+        break;
+
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        fn = qcow2_zstd_decompress;
+        break;
+#endif
+#ifdef CONFIG_LZ4
+    case QCOW2_COMPRESSION_TYPE_LZ4:
+        fn = qcow2_lz4_decompress;
+        break;
 #endif
     default:
         abort();
     }
 
-    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
+    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn,
+                                background);
 }
 
 /*
@@ -404,27 +508,244 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
 ssize_t coroutine_fn
 qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
                     const void *src, size_t src_size)
+{
+    return qcow2_co_do_decompress(bs, dest, dest_size, src, src_size, false);
+}
+
+typedef struct Qcow2DecompressTask {
+    AioTask task;
+    BlockDriverState *bs;
+    Qcow2DecompressJob *job;
+} Qcow2DecompressTask;
+
+static int coroutine_fn qcow2_decompress_task_entry(AioTask *task)
+{
+    Qcow2DecompressTask *t = container_of(task, Qcow2DecompressTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+    Qcow2DecompressJob *job = t->job;
+
+    job->ret = qcow2_co_do_decompress(t->bs, job->dest, s->cluster_size,
+                                      job->src, job->src_size, true);
+    return 0;
+}
+
+/*
+ * qcow2_co_decompress_many()
+ *
+ * Decompress the clusters described by @jobs ahead of the guest, using up
+ * to QCOW2_MAX_READAHEAD_THREADS pool threads in parallel.  These do not
+ * take the slots that guest requests wait for.  The result of each is
+ * stored in its ret field.
+ */
+void coroutine_fn
+qcow2_co_decompress_many(BlockDriverState *bs, Qcow2DecompressJob *jobs,
+                         int nb_jobs)
+{
+    AioTaskPool *aio = aio_task_pool_new(QCOW2_MAX_READAHEAD_THREADS);
+    int i;
+
+    for (i = 0; i < nb_jobs; i++) {
+        Qcow2DecompressTask *t = g_new(Qcow2DecompressTask, 1);
+
+        *t = (Qcow2DecompressTask) {
+            .task.func = qcow2_decompress_task_entry,
+            .bs = bs,
+            .job = &jobs[i],
+        };
+        aio_task_pool_start_task(aio, &t->task);
+    }
+
+    aio_task_pool_wait_all(aio);
+    aio_task_pool_free(aio);
+}
+
+
+/*
+ * Decompressed cluster cache
+ *
+ * Guests often read a compressed cluster in several requests, and read-ahead
+ * decompresses clusters before they are requested, so keep the most recently
+ * decompressed clusters around.  They are looked up by the host offset of the
+ * compressed data.  Different data can only appear at that offset after the
+ * compressed cluster was freed and another one was written in its place, so
+ * every compressed write invalidates the whole cache; the generation number
+ * keeps clusters that were being decompressed at that time out of it.
+ *
+ * As in the metadata caches, entries are found through a hash table on
+ * their offset, and the first entry of the LRU list is replaced on a miss,
+ * so that both take constant time however small the clusters are.
+ */
+
+typedef struct Qcow2DecompressedCluster {
+    uint64_t coffset;   /* 0 if the entry is unused */
+    void *data;
+    QLIST_ENTRY(Qcow2DecompressedCluster) hash_next;
+    QTAILQ_ENTRY(Qcow2DecompressedCluster) lru_next;
+} Qcow2DecompressedCluster;
+
+struct Qcow2DecompressCache {
+    QemuMutex lock;
+    int size;
+    uint64_t generation;
+    Qcow2DecompressedCluster *entries;
+    QLIST_HEAD(, Qcow2DecompressedCluster) *buckets;
+    unsigned bucket_mask;
+    /* Least recently used first, empty entries at the head */
+    QTAILQ_HEAD(, Qcow2DecompressedCluster) lru;
+};
+
+void qcow2_decompress_cache_create(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
-    Qcow2CompressFunc fn;
+    Qcow2DecompressCache *c = g_new0(Qcow2DecompressCache, 1);
+    unsigned nb_buckets;
+    int i;
 
-    switch (s->compression_type) {
-    case QCOW2_COMPRESSION_TYPE_ZLIB:
-        fn = qcow2_zlib_decompress;
-        break;
+    qemu_mutex_init(&c->lock);
+    c->size = MAX(QCOW2_DECOMPRESS_CACHE_SIZE / s->cluster_size, 2);
+    c->entries = g_new0(Qcow2DecompressedCluster, c->size);
 
-#ifdef CONFIG_ZSTD
-    case QCOW2_COMPRESSION_TYPE_ZSTD:
-        fn = qcow2_zstd_decompress;
-        break;
-#endif
-    default:
-        abort();
+    nb_buckets = pow2ceil(c->size);
+    c->buckets = g_new0(typeof(*c->buckets), nb_buckets);
+    c->bucket_mask = nb_buckets - 1;
+
+    QTAILQ_INIT(&c->lru);
+    for (i = 0; i < c->size; i++) {
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru_next);
+    }
+    s->decompress_cache = c;
+}
+
+void qcow2_decompress_cache_destroy(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressCache *c = s->decompress_cache;
+    int i;
+
+    if (!c) {
+        return;
+    }
+
+    for (i = 0; i < c->size; i++) {
+        g_free(c->entries[i].data);
+    }
+    g_free(c->entries);
+    g_free(c->buckets);
+    qemu_mutex_destroy(&c->lock);
+    g_free(c);
+    s->decompress_cache = NULL;
+}
+
+static unsigned decompress_cache_bucket(Qcow2DecompressCache *c,
+                                        uint64_t coffset)
+{
+    /* Compressed clusters are packed, so they start in different sectors */
+    return (coffset / QCOW2_COMPRESSED_SECTOR_SIZE) & c->bucket_mask;
+}
+
+void qcow2_decompress_cache_invalidate(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressCache *c = s->decompress_cache;
+    Qcow2DecompressedCluster *e;
+
+    QEMU_LOCK_GUARD(&c->lock);
+    c->generation++;
+    QTAILQ_FOREACH(e, &c->lru, lru_next) {
+        if (e->coffset) {
+            QLIST_REMOVE(e, hash_next);
+            e->coffset = 0;
+        }
+    }
+}
+
+uint64_t qcow2_decompress_cache_generation(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressCache *c = s->decompress_cache;
+
+    QEMU_LOCK_GUARD(&c->lock);
+    return c->generation;
+}
+
+static Qcow2DecompressedCluster *
+decompress_cache_find(Qcow2DecompressCache *c, uint64_t coffset)
+{
+    Qcow2DecompressedCluster *e;
+
+    QLIST_FOREACH(e, &c->buckets[decompress_cache_bucket(c, coffset)],
+                  hash_next) {
+        if (e->coffset == coffset) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+bool qcow2_decompress_cache_contains(BlockDriverState *bs, uint64_t coffset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressCache *c = s->decompress_cache;
+
+    QEMU_LOCK_GUARD(&c->lock);
+    return decompress_cache_find(c, coffset) != NULL;
+}
+
+/*
+ * Copy @bytes bytes at @offset_in_cluster of the cluster compressed at
+ * @coffset into @qiov, if it is in the cache.  Return whether it was.
+ */
+bool qcow2_decompress_cache_read(BlockDriverState *bs, uint64_t coffset,
+                                 size_t offset_in_cluster, size_t bytes,
+                                 QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressCache *c = s->decompress_cache;
+    Qcow2DecompressedCluster *e;
+
+    QEMU_LOCK_GUARD(&c->lock);
+    e = decompress_cache_find(c, coffset);
+    if (!e) {
+        return false;
     }
 
-    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
+    QTAILQ_REMOVE(&c->lru, e, lru_next);
+    QTAILQ_INSERT_TAIL(&c->lru, e, lru_next);
+    qemu_iovec_from_buf(qiov, qiov_offset,
+                        (uint8_t *)e->data + offset_in_cluster, bytes);
+    return true;
 }
 
+/*
+ * Add the cluster compressed at @coffset, decompressed into @data, to the
+ * cache, unless it was invalidated since @generation.  The cache takes
+ * ownership of @data, which must have been allocated with g_malloc().
+ */
+void qcow2_decompress_cache_insert(BlockDriverState *bs, uint64_t generation,
+                                   uint64_t coffset, void *data)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressCache *c = s->decompress_cache;
+    Qcow2DecompressedCluster *victim;
+
+    QEMU_LOCK_GUARD(&c->lock);
+    if (generation != c->generation || decompress_cache_find(c, coffset)) {
+        g_free(data);
+        return;
+    }
+
+    victim = QTAILQ_FIRST(&c->lru);
+    if (victim->coffset) {
+        QLIST_REMOVE(victim, hash_next);
+    }
+    g_free(victim->data);
+    victim->coffset = coffset;
+    victim->data = data;
+    QLIST_INSERT_HEAD(&c->buckets[decompress_cache_bucket(c, coffset)],
+                      victim, hash_next);
+    QTAILQ_REMOVE(&c->lru, victim, lru_next);
+    QTAILQ_INSERT_TAIL(&c->lru, victim, lru_next);
+}
 
 /*
  * Cryptography
@@ -685,6 +685,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_DISCARD_SNAPSHOT,
     QCOW2_OPT_DISCARD_OTHER,
     QCOW2_OPT_DISCARD_NO_UNREF,
+    QCOW2_OPT_CHAIN_INDEX,
     QCOW2_OPT_OVERLAP,
     QCOW2_OPT_OVERLAP_TEMPLATE,
     QCOW2_OPT_OVERLAP_MAIN_HEADER,
@@ -734,6 +735,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "Do not unreference discarded clusters",
         },
+        {
+            .name = QCOW2_OPT_CHAIN_INDEX,
+            .type = QEMU_OPT_BOOL,
+            .help = "Index which backing file layer unallocated areas are "
+                    "read from",
+        },
         {
             .name = QCOW2_OPT_OVERLAP,
             .type = QEMU_OPT_STRING,
@@ -978,6 +985,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
+    bool chain_index;
     uint64_t cache_clean_interval;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
@@ -1157,6 +1165,8 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    r->chain_index = qemu_opt_get_bool(opts, QCOW2_OPT_CHAIN_INDEX, false);
+
     switch (s->crypt_method_header) {
     case QCOW_CRYPT_NONE:
         if (encryptfmt) {
@@ -1239,6 +1249,13 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
 
     s->discard_no_unref = r->discard_no_unref;
 
+    if (r->chain_index && !s->chain_index) {
+        s->chain_index = qcow2_chain_index_create();
+    } else if (!r->chain_index && s->chain_index) {
+        qcow2_chain_index_destroy(s->chain_index);
+        s->chain_index = NULL;
+    }
+
     if (s->cache_clean_interval != r->cache_clean_interval) {
         cache_clean_timer_del(bs);
         s->cache_clean_interval = r->cache_clean_interval;
@@ -1278,12 +1295,57 @@ qcow2_update_options(BlockDriverState *bs, QDict *options, int flags,
     return ret;
 }
 
+static uint8_t compression_type_to_header(Qcow2CompressionType type)
+{
+    switch (type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        return QCOW2_HEADER_COMPRESSION_ZLIB;
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        return QCOW2_HEADER_COMPRESSION_ZSTD;
+#endif
+#ifdef CONFIG_LZ4
+    case QCOW2_COMPRESSION_TYPE_LZ4:
+        return QCOW2_HEADER_COMPRESSION_LZ4;
+#endif
+    default:
+        abort();
+    }
+}
+
+static int compression_type_from_header(uint8_t value,
+                                        Qcow2CompressionType *type,
+                                        Error **errp)
+{
+    switch (value) {
+    case QCOW2_HEADER_COMPRESSION_ZLIB:
+        *type = QCOW2_COMPRESSION_TYPE_ZLIB;
+        return 0;
+#ifdef CONFIG_ZSTD
+    case QCOW2_HEADER_COMPRESSION_ZSTD:
+        *type = QCOW2_COMPRESSION_TYPE_ZSTD;
+        return 0;
+#endif
+#ifdef CONFIG_LZ4
+    case QCOW2_HEADER_COMPRESSION_LZ4:
+        *type = QCOW2_COMPRESSION_TYPE_LZ4;
+        return 0;
+#endif
+    default:
+        error_setg(errp, "qcow2: unknown compression type: %u", value);
+        return -ENOTSUP;
+    }
+}
+
 static int validate_compression_type(BDRVQcow2State *s, Error **errp)
 {
     switch (s->compression_type) {
     case QCOW2_COMPRESSION_TYPE_ZLIB:
 #ifdef CONFIG_ZSTD
     case QCOW2_COMPRESSION_TYPE_ZSTD:
+#endif
+#ifdef CONFIG_LZ4
+    case QCOW2_COMPRESSION_TYPE_LZ4:
 #endif
         break;
 
@@ -1438,7 +1500,11 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
      * the only valid (default) compression type in that case
      */
     if (header.header_length > offsetof(QCowHeader, compression_type)) {
-        s->compression_type = header.compression_type;
+        ret = compression_type_from_header(header.compression_type,
+                                           &s->compression_type, errp);
+        if (ret < 0) {
+            goto fail;
+        }
     } else {
         s->compression_type = QCOW2_COMPRESSION_TYPE_ZLIB;
     }
@@ -1627,6 +1693,7 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     QLIST_INIT(&s->cluster_allocs);
+    QLIST_INIT(&s->cluster_pools);
     QTAILQ_INIT(&s->discards);
 
     /* read qcow2 extensions */
@@ -1888,6 +1955,7 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    qcow2_decompress_cache_create(bs);
 
     return ret;
 
@@ -2013,6 +2081,8 @@ qcow2_reopen_prepare(BDRVReopenState *state,BlockReopenQueue *queue,
             goto fail;
         }
 
+        qcow2_release_cluster_pools(state->bs);
+
         ret = bdrv_flush(state->bs);
         if (ret < 0) {
             goto fail;
@@ -2346,6 +2416,13 @@ qcow2_co_preadv_task(BlockDriverState *bs, QCow2SubclusterType subc_type,
         assert(bs->backing); /* otherwise handled in qcow2_co_preadv_part */
 
         BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
+        if (s->chain_index) {
+            int ret = qcow2_chain_index_co_preadv(bs, offset, bytes,
+                                                  qiov, qiov_offset);
+            if (ret != -ENOTSUP) {
+                return ret;
+            }
+        }
         return bdrv_co_preadv_part(bs->backing, offset, bytes,
                                    qiov, qiov_offset, 0);
 
@@ -2675,6 +2752,87 @@ static coroutine_fn GRAPH_RDLOCK int qcow2_co_pwritev_task_entry(AioTask *task)
                                  t->l2meta);
 }
 
+/*
+ * For a sequential writer, the guest offset whose L2 table, and the host
+ * cluster whose refcount block, are allocated ahead.  Both are half a table
+ * past the current position, so that there is time to allocate them before
+ * the writer gets there.
+ */
+static uint64_t prealloc_l2_target(BDRVQcow2State *s)
+{
+    return s->alloc_frontier + ((uint64_t)s->l2_size << s->cluster_bits) / 2;
+}
+
+static uint64_t prealloc_refblock_target(BDRVQcow2State *s)
+{
+    return s->free_cluster_index + s->refcount_block_size / 2;
+}
+
+static bool GRAPH_RDLOCK qcow2_need_prealloc(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l1_index = offset_to_l1_index(s, prealloc_l2_target(s));
+    uint64_t reftable_index =
+        prealloc_refblock_target(s) >> s->refcount_block_bits;
+
+    if (l1_index < s->l1_vm_state_index && l1_index < s->l1_size &&
+        !s->l1_table[l1_index]) {
+        return true;
+    }
+    return reftable_index >= s->refcount_table_size ||
+           !(s->refcount_table[reftable_index] & REFT_OFFSET_MASK);
+}
+
+static void coroutine_fn qcow2_prealloc_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    GRAPH_RDLOCK_GUARD();
+
+    qemu_co_mutex_lock(&s->lock);
+    ret = qcow2_prealloc_l2_table(bs, prealloc_l2_target(s));
+    if (ret >= 0) {
+        ret = qcow2_prealloc_refcount_block(bs, prealloc_refblock_target(s));
+    }
+    trace_qcow2_prealloc_metadata(bs, s->alloc_frontier, ret);
+    s->prealloc_running = false;
+    qemu_co_mutex_unlock(&s->lock);
+
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Called with s->lock held after allocating clusters for a write of @bytes
+ * at guest @offset.  Once the guest has been filling the image sequentially
+ * for a while, allocate the L2 table and refcount block that it will need
+ * next in the background, instead of making a later write wait for them.
+ */
+static void GRAPH_RDLOCK
+qcow2_prealloc_kick(BlockDriverState *bs, uint64_t offset, uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Coroutine *co;
+
+    if (offset == s->alloc_frontier) {
+        s->alloc_sequential += bytes;
+    } else {
+        s->alloc_sequential = bytes;
+    }
+    s->alloc_frontier = offset + bytes;
+
+    if (s->alloc_sequential < QCOW2_PREALLOC_MIN_SEQUENTIAL ||
+        s->prealloc_running || !qcow2_need_prealloc(bs)) {
+        return;
+    }
+
+    s->prealloc_running = true;
+    bdrv_inc_in_flight(bs);
+    co = qemu_coroutine_create(qcow2_prealloc_entry, bs);
+    aio_co_schedule(qemu_get_current_aio_context(), co);
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                       QEMUIOVector *qiov, size_t qiov_offset,
@@ -2717,6 +2875,10 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
             goto out_locked;
         }
 
+        if (l2meta) {
+            qcow2_prealloc_kick(bs, offset, cur_bytes);
+        }
+
         qemu_co_mutex_unlock(&s->lock);
 
         if (!aio && cur_bytes != bytes) {
@@ -2772,6 +2934,8 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    qcow2_release_cluster_pools(bs);
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2808,6 +2972,9 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    qcow2_decompress_cache_destroy(bs);
+    qcow2_chain_index_destroy(s->chain_index);
+    s->chain_index = NULL;
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -2975,7 +3142,8 @@ int qcow2_update_header(BlockDriverState *bs)
         .autoclear_features     = cpu_to_be64(s->autoclear_features),
         .refcount_order         = cpu_to_be32(s->refcount_order),
         .header_length          = cpu_to_be32(header_length),
-        .compression_type       = s->compression_type,
+        .compression_type       =
+            compression_type_to_header(s->compression_type),
     };
 
     /* For older versions, write a shorter header */
@@ -3526,7 +3694,7 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
     int refcount_order;
     uint64_t *refcount_table;
     int ret;
-    uint8_t compression_type = QCOW2_COMPRESSION_TYPE_ZLIB;
+    Qcow2CompressionType compression_type = QCOW2_COMPRESSION_TYPE_ZLIB;
 
     assert(create_options->driver == BLOCKDEV_DRIVER_QCOW2);
     qcow2_opts = &create_options->u.qcow2;
@@ -3695,8 +3863,11 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         switch (qcow2_opts->compression_type) {
 #ifdef CONFIG_ZSTD
         case QCOW2_COMPRESSION_TYPE_ZSTD:
-            break;
 #endif
+#ifdef CONFIG_LZ4
+        case QCOW2_COMPRESSION_TYPE_LZ4:
+#endif
+            break;
         default:
             error_setg(errp, "Unknown compression type");
             goto out;
@@ -3728,7 +3899,8 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         .refcount_table_clusters    = cpu_to_be32(1),
         .refcount_order             = cpu_to_be32(refcount_order),
         /* don't deal with endianness since compression_type is 1 byte long */
-        .compression_type           = compression_type,
+        .compression_type           =
+            compression_type_to_header(compression_type),
         .header_length              = cpu_to_be32(sizeof(*header)),
     };
 
@@ -4325,6 +4497,9 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
 
     qemu_co_mutex_lock(&s->lock);
 
+    /* Shrinking requires that no clusters past the new end are in use */
+    qcow2_release_cluster_pools(bs);
+
     /*
      * Even though we store snapshot size for all images, it was not
      * required until v3, so it is not safe to proceed for v2.
@@ -4719,6 +4894,8 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
         qemu_co_mutex_unlock(&s->lock);
         goto fail;
     }
+    /* The new cluster may reuse the host offset of one that was freed */
+    qcow2_decompress_cache_invalidate(bs);
 
     ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len, true);
     qemu_co_mutex_unlock(&s->lock);
@@ -4822,6 +4999,101 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
     return ret;
 }
 
+typedef struct Qcow2DecompressAhead {
+    BlockDriverState *bs;
+    uint64_t generation;
+    uint8_t *buf;           /* Compressed data, starting at coffset[0] */
+    int nb_clusters;
+    uint64_t coffset[QCOW2_DECOMPRESS_READAHEAD + 1];
+    int csize[QCOW2_DECOMPRESS_READAHEAD + 1];
+} Qcow2DecompressAhead;
+
+/*
+ * Decompress the clusters following the one that was just read into the
+ * decompressed cluster cache.  The first cluster in @opaque is the one that
+ * was read, and it is skipped.
+ */
+static void coroutine_fn qcow2_decompress_ahead_entry(void *opaque)
+{
+    Qcow2DecompressAhead *ra = opaque;
+    BlockDriverState *bs = ra->bs;
+    BDRVQcow2State *s = bs->opaque;
+    int nb_jobs = ra->nb_clusters - 1;
+    g_autofree Qcow2DecompressJob *jobs = g_new(Qcow2DecompressJob, nb_jobs);
+    int i;
+
+    for (i = 0; i < nb_jobs; i++) {
+        jobs[i] = (Qcow2DecompressJob) {
+            .dest = g_malloc(s->cluster_size),
+            .src = ra->buf + (ra->coffset[i + 1] - ra->coffset[0]),
+            .src_size = ra->csize[i + 1],
+        };
+    }
+
+    qcow2_co_decompress_many(bs, jobs, nb_jobs);
+
+    for (i = 0; i < nb_jobs; i++) {
+        if (jobs[i].ret < 0) {
+            g_free(jobs[i].dest);
+            continue;
+        }
+        qcow2_decompress_cache_insert(bs, ra->generation,
+                                      ra->coffset[i + 1], jobs[i].dest);
+    }
+    trace_qcow2_decompress_ahead(bs, ra->coffset[0], nb_jobs);
+
+    qemu_co_mutex_lock(&s->lock);
+    s->decompress_readahead = false;
+    qemu_co_mutex_unlock(&s->lock);
+
+    g_free(ra->buf);
+    g_free(ra);
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Collect the compressed clusters following guest @offset whose data
+ * directly follows that of the previous one, so that they can be read
+ * along with it.  ra->coffset[0] and ra->csize[0] must describe the cluster
+ * at @offset.  Called with s->lock held.
+ */
+static void GRAPH_RDLOCK
+qcow2_find_decompress_ahead(BlockDriverState *bs, uint64_t offset,
+                            Qcow2DecompressAhead *ra)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t end = ra->coffset[0] + ra->csize[0];
+
+    ra->nb_clusters = 1;
+    while (ra->nb_clusters <= QCOW2_DECOMPRESS_READAHEAD) {
+        QCow2SubclusterType type;
+        unsigned int cur_bytes = s->cluster_size;
+        uint64_t l2_entry, coffset;
+        int csize;
+
+        offset = start_of_cluster(s, offset) + s->cluster_size;
+        if (offset >= bs->total_sectors * BDRV_SECTOR_SIZE ||
+            qcow2_get_host_offset(bs, offset, &cur_bytes, &l2_entry,
+                                  &type) < 0 ||
+            type != QCOW2_SUBCLUSTER_COMPRESSED) {
+            break;
+        }
+
+        qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
+        /* Compressed clusters may share their first and last sector */
+        if (coffset < end - QCOW2_COMPRESSED_SECTOR_SIZE || coffset > end ||
+            coffset + csize <= end ||
+            qcow2_decompress_cache_contains(bs, coffset)) {
+            break;
+        }
+
+        ra->coffset[ra->nb_clusters] = coffset;
+        ra->csize[ra->nb_clusters] = csize;
+        ra->nb_clusters++;
+        end = coffset + csize;
+    }
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_preadv_compressed(BlockDriverState *bs,
                            uint64_t l2_entry,
@@ -4832,21 +5104,62 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     int ret = 0, csize;
-    uint64_t coffset;
-    uint8_t *buf, *out_buf;
+    uint64_t coffset, generation;
+    uint8_t *buf = NULL, *out_buf = NULL;
     int offset_in_cluster = offset_into_cluster(s, offset);
+    Qcow2DecompressAhead *ra = NULL;
+    int64_t read_bytes;
 
     qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
 
-    buf = g_try_malloc(csize);
+    if (qcow2_decompress_cache_read(bs, coffset, offset_in_cluster, bytes,
+                                    qiov, qiov_offset)) {
+        return 0;
+    }
+
+    /*
+     * Sequential readers of compressed images, like qemu-img convert, are
+     * limited by decompression.  When the guest cluster that follows the
+     * previous miss is read, read the compressed data of the following
+     * clusters too and decompress it in parallel in the background, unless
+     * that is already being done.
+     */
+    qemu_co_mutex_lock(&s->lock);
+    generation = qcow2_decompress_cache_generation(bs);
+    if (start_of_cluster(s, offset) == s->decompress_next &&
+        !s->decompress_readahead) {
+        ra = g_new0(Qcow2DecompressAhead, 1);
+        ra->coffset[0] = coffset;
+        ra->csize[0] = csize;
+        qcow2_find_decompress_ahead(bs, offset, ra);
+        if (ra->nb_clusters > 1) {
+            s->decompress_readahead = true;
+        } else {
+            g_free(ra);
+            ra = NULL;
+        }
+    }
+    s->decompress_next = start_of_cluster(s, offset) +
+        (ra ? ra->nb_clusters : 1) * s->cluster_size;
+    qemu_co_mutex_unlock(&s->lock);
+
+    if (ra) {
+        int last = ra->nb_clusters - 1;
+        read_bytes = ra->coffset[last] + ra->csize[last] - coffset;
+    } else {
+        read_bytes = csize;
+    }
+
+    buf = g_try_malloc(read_bytes);
     if (!buf) {
-        return -ENOMEM;
+        ret = -ENOMEM;
+        goto fail;
     }
 
-    out_buf = qemu_blockalign(bs, s->cluster_size);
+    out_buf = g_malloc(s->cluster_size);
 
     BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
-    ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
+    ret = bdrv_co_pread(bs->file, coffset, read_bytes, buf, 0);
     if (ret < 0) {
         goto fail;
     }
@@ -4857,9 +5170,29 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
     }
 
     qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
+    qcow2_decompress_cache_insert(bs, generation, coffset, out_buf);
+    out_buf = NULL;
+
+    if (ra) {
+        Coroutine *co;
+
+        ra->bs = bs;
+        ra->generation = generation;
+        ra->buf = buf;
+        bdrv_inc_in_flight(bs);
+        co = qemu_coroutine_create(qcow2_decompress_ahead_entry, ra);
+        aio_co_schedule(qemu_get_current_aio_context(), co);
+        return 0;
+    }
 
 fail:
-    qemu_vfree(out_buf);
+    if (ra) {
+        qemu_co_mutex_lock(&s->lock);
+        s->decompress_readahead = false;
+        qemu_co_mutex_unlock(&s->lock);
+        g_free(ra);
+    }
+    g_free(out_buf);
     g_free(buf);
 
     return ret;
@@ -5023,6 +5356,8 @@ static int GRAPH_RDLOCK qcow2_make_empty(BlockDriverState *bs)
     int step = QEMU_ALIGN_DOWN(INT_MAX, s->cluster_size);
     int l1_clusters, ret = 0;
 
+    qcow2_release_cluster_pools(bs);
+
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
 
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
@@ -5528,8 +5863,8 @@ qcow2_downgrade(BlockDriverState *bs, int target_version,
             return -EINVAL;
         }
         if (ret) {
-            error_setg(errp, "Cannot downgrade an image with zstd compression "
-                       "type and existing compressed clusters");
+            error_setg(errp, "Cannot downgrade an image with non-zlib "
+                       "compression type and existing compressed clusters");
             return -ENOTSUP;
         }
         /*
@@ -5704,6 +6039,9 @@ qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
     Qcow2AmendHelperCBInfo helper_cb_info;
     bool encryption_update = false;
 
+    /* Changing the refcount width rebuilds the refcounts from the L2 tables */
+    qcow2_release_cluster_pools(bs);
+
     while (desc && desc->name) {
         if (!qemu_opt_find(opts, desc->name)) {
             /* only change explicitly defined options */
@@ -128,12 +128,25 @@
 
 #define DEFAULT_CLUSTER_SIZE 65536
 
+/* Clusters reserved at a time for the allocating writes of one AioContext */
+#define QCOW2_CLUSTER_POOL_SIZE (4 * MiB)
+
+/* Sequential allocating writes after which metadata is allocated ahead */
+#define QCOW2_PREALLOC_MIN_SEQUENTIAL (32 * MiB)
+
+/* Memory for recently decompressed clusters */
+#define QCOW2_DECOMPRESS_CACHE_SIZE (2 * MiB)
+
+/* Compressed clusters that may be decompressed ahead of a reader */
+#define QCOW2_DECOMPRESS_READAHEAD 16
+
 #define QCOW2_OPT_DATA_FILE "data-file"
 #define QCOW2_OPT_LAZY_REFCOUNTS "lazy-refcounts"
 #define QCOW2_OPT_DISCARD_REQUEST "pass-discard-request"
 #define QCOW2_OPT_DISCARD_SNAPSHOT "pass-discard-snapshot"
 #define QCOW2_OPT_DISCARD_OTHER "pass-discard-other"
 #define QCOW2_OPT_DISCARD_NO_UNREF "discard-no-unref"
+#define QCOW2_OPT_CHAIN_INDEX "chain-index"
 #define QCOW2_OPT_OVERLAP "overlap-check"
 #define QCOW2_OPT_OVERLAP_TEMPLATE "overlap-check.template"
 #define QCOW2_OPT_OVERLAP_MAIN_HEADER "overlap-check.main-header"
@@ -183,6 +196,16 @@ typedef struct QCowHeader {
 
 QEMU_BUILD_BUG_ON(!QEMU_IS_ALIGNED(sizeof(QCowHeader), 8));
 
+/*
+ * Values of the compression_type header field.  Qcow2CompressionType omits
+ * the types that QEMU is built without, so it cannot be stored directly.
+ */
+enum {
+    QCOW2_HEADER_COMPRESSION_ZLIB   = 0,
+    QCOW2_HEADER_COMPRESSION_ZSTD   = 1,
+    QCOW2_HEADER_COMPRESSION_LZ4    = 2,
+};
+
 typedef struct QEMU_PACKED QCowSnapshotHeader {
     /* header is 8 byte aligned */
     uint64_t l1_table_offset;
@@ -310,6 +333,22 @@ typedef struct Qcow2DiscardRegion {
     QTAILQ_ENTRY(Qcow2DiscardRegion) next;
 } Qcow2DiscardRegion;
 
+typedef struct Qcow2DecompressCache Qcow2DecompressCache;
+typedef struct Qcow2ChainIndex Qcow2ChainIndex;
+
+/*
+ * Clusters that are allocated (refcount 1) but not yet used, reserved for
+ * the data of allocating writes issued from one AioContext.  Taking them
+ * needs no refcount update, and each iothread gets runs of contiguous
+ * clusters instead of interleaving its writes with those of the others.
+ */
+typedef struct Qcow2ClusterPool {
+    AioContext *ctx;
+    uint64_t offset;
+    uint64_t nb_clusters;
+    QLIST_ENTRY(Qcow2ClusterPool) next;
+} Qcow2ClusterPool;
+
 typedef uint64_t Qcow2GetRefcountFunc(const void *refcount_array,
                                       uint64_t index);
 typedef void Qcow2SetRefcountFunc(void *refcount_array,
@@ -323,6 +362,8 @@ typedef struct Qcow2BitmapHeaderExt {
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
 #define QCOW2_MAX_THREADS 4
+/* Decompression ahead of a reader runs alongside, in fewer threads */
+#define QCOW2_MAX_READAHEAD_THREADS 2
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -349,6 +390,15 @@ typedef struct BDRVQcow2State {
     unsigned cache_clean_interval;
 
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
+    QLIST_HEAD(, Qcow2ClusterPool) cluster_pools;
+    AioContext *alloc_ctx;      /* AioContext of the first allocating write */
+    bool use_cluster_pools;     /* ... and another one has been seen since */
+
+    /* Guest offset following the last allocating write */
+    uint64_t alloc_frontier;
+    /* Bytes allocated sequentially up to alloc_frontier */
+    uint64_t alloc_sequential;
+    bool prealloc_running;
 
     uint64_t *refcount_table;
     uint64_t refcount_table_offset;
@@ -411,6 +461,13 @@ typedef struct BDRVQcow2State {
     CoQueue thread_task_queue;
     int nb_threads;
 
+    Qcow2DecompressCache *decompress_cache;
+    uint64_t decompress_next;   /* Guest cluster after the last one read */
+    bool decompress_readahead;  /* A read-ahead coroutine is running */
+
+    /* Where unallocated areas are read from, if the chain-index option is on */
+    Qcow2ChainIndex *chain_index;
+
     BdrvChild *data_file;
 
     bool metadata_preallocation_checked;
@@ -873,6 +930,13 @@ int64_t GRAPH_RDLOCK coroutine_fn
 qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                         int64_t nb_clusters);
 
+int coroutine_fn GRAPH_RDLOCK
+qcow2_alloc_data_clusters(BlockDriverState *bs, uint64_t *host_offset,
+                          uint64_t *nb_clusters);
+void GRAPH_RDLOCK qcow2_release_cluster_pools(BlockDriverState *bs);
+int coroutine_fn GRAPH_RDLOCK
+qcow2_prealloc_refcount_block(BlockDriverState *bs, uint64_t cluster_index);
+
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size);
 void GRAPH_RDLOCK qcow2_free_clusters(BlockDriverState *bs,
                                       int64_t offset, int64_t size,
@@ -936,6 +1000,8 @@ int coroutine_fn GRAPH_RDLOCK
 qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
                         unsigned int *bytes, uint64_t *host_offset,
                         QCowL2Meta **m);
+int coroutine_fn GRAPH_RDLOCK
+qcow2_prealloc_l2_table(BlockDriverState *bs, uint64_t offset);
 
 int coroutine_fn GRAPH_RDLOCK
 qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs, uint64_t offset,
@@ -1022,6 +1088,15 @@ void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
 
+/* qcow2-chain-index.c functions */
+Qcow2ChainIndex *qcow2_chain_index_create(void);
+void qcow2_chain_index_destroy(Qcow2ChainIndex *ci);
+
+int coroutine_fn GRAPH_RDLOCK
+qcow2_chain_index_co_preadv(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes, QEMUIOVector *qiov,
+                            size_t qiov_offset);
+
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
 qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
@@ -1064,6 +1139,28 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
 ssize_t coroutine_fn
 qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
                     const void *src, size_t src_size);
+
+typedef struct Qcow2DecompressJob {
+    void *dest;             /* cluster_size bytes */
+    const void *src;
+    size_t src_size;
+    int ret;
+} Qcow2DecompressJob;
+
+void coroutine_fn
+qcow2_co_decompress_many(BlockDriverState *bs, Qcow2DecompressJob *jobs,
+                         int nb_jobs);
+
+void qcow2_decompress_cache_create(BlockDriverState *bs);
+void qcow2_decompress_cache_destroy(BlockDriverState *bs);
+void qcow2_decompress_cache_invalidate(BlockDriverState *bs);
+uint64_t qcow2_decompress_cache_generation(BlockDriverState *bs);
+bool qcow2_decompress_cache_contains(BlockDriverState *bs, uint64_t coffset);
+bool qcow2_decompress_cache_read(BlockDriverState *bs, uint64_t coffset,
+                                 size_t offset_in_cluster, size_t bytes,
+                                 QEMUIOVector *qiov, size_t qiov_offset);
+void qcow2_decompress_cache_insert(BlockDriverState *bs, uint64_t generation,
+                                   uint64_t coffset, void *data);
 int coroutine_fn
 qcow2_co_encrypt(BlockDriverState *bs, uint64_t host_offset,
                  uint64_t guest_offset, void *buf, size_t len);
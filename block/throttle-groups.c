@@ -29,12 +29,25 @@
 #include "qemu/main-loop.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
+#include "qemu/units.h"
 #include "system/qtest.h"
 #include "qapi/error.h"
 #include "qapi/qapi-visit-block-core.h"
 #include "qom/object.h"
 #include "qom/object_interfaces.h"
 
+/* Maximum credit that a group hands out at once, per direction */
+#define THROTTLE_GROUP_CREDIT_BYTES (64 * MiB)
+#define THROTTLE_GROUP_CREDIT_OPS   1024
+
+/*
+ * Credit is only used for this long after it was handed out.  The buckets
+ * keep leaking while it is unused, so older credit would let more I/O
+ * through than the limits allow.  Without bursts, a bucket holds a tenth
+ * of a second of I/O, so this allows at most 1% more than that.
+ */
+#define THROTTLE_GROUP_CREDIT_NS    SCALE_MS
+
 static void throttle_group_obj_init(Object *obj);
 static void throttle_group_obj_complete(UserCreatable *obj, Error **errp);
 static void timer_cb(ThrottleGroupMember *tgm, ThrottleDirection direction);
@@ -62,6 +75,17 @@ static void timer_cb(ThrottleGroupMember *tgm, ThrottleDirection direction);
  * blk_set_aio_context()). Therefore in this file a thread will
  * access some other ThrottleGroupMember's timers only after verifying that
  * that ThrottleGroupMember has throttled requests in the queue.
+ *
+ * To avoid taking the lock for every request, the group hands out credit:
+ * I/O that the ThrottleState has already accounted for, and that requests
+ * can use up with atomic operations as long as no request in the group is
+ * throttled, and for at most THROTTLE_GROUP_CREDIT_NS.  Whenever a request
+ * does take the lock, the unused credit is given back first, so the limits
+ * and the round-robin order are enforced as before; new credit is only
+ * handed out while nothing is waiting.  With limits on the total I/O, the
+ * credit of both directions is charged to the same buckets, so it is given
+ * back for both directions, and not handed out while requests of either
+ * direction are waiting.
  */
 struct ThrottleGroup {
     Object parent_obj;
@@ -74,9 +98,23 @@ struct ThrottleGroup {
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
     ThrottleGroupMember *tokens[THROTTLE_MAX];
-    bool any_timer_armed[THROTTLE_MAX];
     QEMUClockType clock_type;
 
+    /*
+     * These fields are written with atomics under the lock, but can be read
+     * without it.  pending_reqs is the sum of the members' pending_reqs.
+     */
+    bool any_timer_armed[THROTTLE_MAX];
+    unsigned int pending_reqs[THROTTLE_MAX];
+
+    /*
+     * Unused credit, taken with atomics without the lock, and when it was
+     * handed out
+     */
+    unsigned long credit_bytes[THROTTLE_MAX];
+    unsigned long credit_ops[THROTTLE_MAX];
+    int64_t credit_time[THROTTLE_MAX];
+
     /* This field is protected by the global QEMU mutex */
     QTAILQ_ENTRY(ThrottleGroup) list;
 };
@@ -286,7 +324,7 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
     /* If a timer just got armed, set tgm as the current token */
     if (must_wait) {
         tg->tokens[direction] = tgm;
-        tg->any_timer_armed[direction] = true;
+        qatomic_set(&tg->any_timer_armed[direction], true);
     }
 
     return must_wait;
@@ -310,6 +348,162 @@ static bool coroutine_fn throttle_group_co_restart_queue(ThrottleGroupMember *tg
     return ret;
 }
 
+/* Take @n from a credit counter of a ThrottleGroup if enough is left.
+ *
+ * @credit: the counter
+ * @n:      the amount to take
+ * @ret:    whether @n could be taken
+ */
+static bool throttle_group_take(unsigned long *credit, unsigned long n)
+{
+    unsigned long old, cur = qatomic_read(credit);
+
+    do {
+        if (cur < n) {
+            return false;
+        }
+        old = cur;
+        cur = qatomic_cmpxchg(credit, old, old - n);
+    } while (cur != old);
+
+    return true;
+}
+
+/* Let an I/O request through on the group's credit, without taking the
+ * lock.  This is only done while no request in the group is waiting, so
+ * that it cannot overtake any of them, and while the credit is recent.
+ * Expired credit is given back by the next request that takes the lock.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @direction: the ThrottleDirection
+ * @ret:       whether the request can go through
+ */
+static bool throttle_group_use_credit(ThrottleGroupMember *tgm, int64_t bytes,
+                                      ThrottleDirection direction)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    if (qatomic_read(&tg->any_timer_armed[direction]) ||
+        qatomic_read(&tg->pending_reqs[direction])) {
+        return false;
+    }
+
+    if (qemu_clock_get_ns(tg->clock_type) -
+        qatomic_read(&tg->credit_time[direction]) > THROTTLE_GROUP_CREDIT_NS) {
+        return false;
+    }
+
+    if (!throttle_group_take(&tg->credit_ops[direction], 1)) {
+        return false;
+    }
+    if (!throttle_group_take(&tg->credit_bytes[direction], bytes)) {
+        /* The operation is still accounted for, so it can be given back */
+        qatomic_add(&tg->credit_ops[direction], 1);
+        return false;
+    }
+
+    return true;
+}
+
+/* Whether requests of @direction and @other are accounted in the same
+ * buckets, i.e. the group has a limit on the total I/O.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg:        the ThrottleGroup
+ * @direction: the ThrottleDirection
+ * @other:     another ThrottleDirection
+ * @ret:       whether the two directions share a bucket
+ */
+static bool throttle_group_shares_buckets(ThrottleGroup *tg,
+                                          ThrottleDirection direction,
+                                          ThrottleDirection other)
+{
+    return direction == other ||
+        tg->ts.cfg.buckets[THROTTLE_BPS_TOTAL].avg ||
+        tg->ts.cfg.buckets[THROTTLE_OPS_TOTAL].avg;
+}
+
+/* Give the unused credit of a ThrottleGroup back to its ThrottleState, so
+ * that the ThrottleState only counts I/O that was actually done.  This
+ * includes the credit of the other direction if it shares a bucket with
+ * @direction, because that credit would otherwise keep the bucket full.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg:        the ThrottleGroup
+ * @direction: the ThrottleDirection
+ */
+static void throttle_group_return_credit(ThrottleGroup *tg,
+                                         ThrottleDirection direction)
+{
+    ThrottleDirection dir;
+
+    for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
+        unsigned long bytes, ops;
+
+        if (!throttle_group_shares_buckets(tg, direction, dir)) {
+            continue;
+        }
+
+        bytes = qatomic_xchg(&tg->credit_bytes[dir], 0);
+        ops = qatomic_xchg(&tg->credit_ops[dir], 0);
+        if (bytes || ops) {
+            throttle_return_credit(&tg->ts, dir, bytes, ops);
+        }
+    }
+}
+
+/* Drop the unused credit of a ThrottleGroup before throttle_config() resets
+ * the bucket levels.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg: the ThrottleGroup
+ */
+static void throttle_group_drop_credit(ThrottleGroup *tg)
+{
+    ThrottleDirection dir;
+
+    for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
+        qatomic_set(&tg->credit_bytes[dir], 0);
+        qatomic_set(&tg->credit_ops[dir], 0);
+    }
+}
+
+/* Hand out new credit if no request in the group is waiting for the
+ * buckets that the credit is charged to.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg:        the ThrottleGroup
+ * @direction: the ThrottleDirection
+ */
+static void throttle_group_grant_credit(ThrottleGroup *tg,
+                                        ThrottleDirection direction)
+{
+    uint64_t bytes = THROTTLE_GROUP_CREDIT_BYTES;
+    uint64_t ops = THROTTLE_GROUP_CREDIT_OPS;
+    int64_t now = qemu_clock_get_ns(tg->clock_type);
+    ThrottleDirection dir;
+
+    for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
+        if (throttle_group_shares_buckets(tg, direction, dir) &&
+            (tg->any_timer_armed[dir] || tg->pending_reqs[dir])) {
+            return;
+        }
+    }
+
+    throttle_grant_credit(&tg->ts, direction, now, &bytes, &ops);
+    if (ops) {
+        /* The old credit was given back, so all credit is this recent */
+        qatomic_set(&tg->credit_time[direction], now);
+        qatomic_add(&tg->credit_bytes[direction], bytes);
+        qatomic_add(&tg->credit_ops[direction], ops);
+    }
+}
+
 /* Look for the next pending I/O request and schedule it.
  *
  * This assumes that tg->lock is held.
@@ -325,6 +519,8 @@ static void coroutine_mixed_fn schedule_next_request(ThrottleGroupMember *tgm,
     bool must_wait;
     ThrottleGroupMember *token;
 
+    throttle_group_return_credit(tg, direction);
+
     /* Check if there's any pending request to schedule next */
     token = next_throttle_token(tgm, direction);
     if (!tgm_has_pending_reqs(token, direction)) {
@@ -344,7 +540,7 @@ static void coroutine_mixed_fn schedule_next_request(ThrottleGroupMember *tgm,
             ThrottleTimers *tt = &token->throttle_timers;
             int64_t now = qemu_clock_get_ns(tg->clock_type);
             timer_mod(tt->timers[direction], now);
-            tg->any_timer_armed[direction] = true;
+            qatomic_set(&tg->any_timer_armed[direction], true);
         }
         tg->tokens[direction] = token;
     }
@@ -369,7 +565,12 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     assert(bytes >= 0);
     assert(direction < THROTTLE_MAX);
 
+    if (throttle_group_use_credit(tgm, bytes, direction)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
+    throttle_group_return_credit(tg, direction);
 
     /* First we check if this I/O has to be throttled. */
     token = next_throttle_token(tgm, direction);
@@ -378,6 +579,7 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[direction]) {
         tgm->pending_reqs[direction]++;
+        qatomic_inc(&tg->pending_reqs[direction]);
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[direction],
@@ -385,6 +587,7 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
         tgm->pending_reqs[direction]--;
+        qatomic_dec(&tg->pending_reqs[direction]);
     }
 
     /* The I/O will be executed, so do the accounting */
@@ -393,6 +596,9 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* Schedule the next request */
     schedule_next_request(tgm, direction);
 
+    /* Let the following requests through without the lock if possible */
+    throttle_group_grant_credit(tg, direction);
+
     qemu_mutex_unlock(&tg->lock);
 }
 
@@ -477,6 +683,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
+    throttle_group_drop_credit(tg);
     throttle_config(ts, tg->clock_type, cfg);
     qemu_mutex_unlock(&tg->lock);
 
@@ -512,7 +719,7 @@ static void timer_cb(ThrottleGroupMember *tgm, ThrottleDirection direction)
 
     /* The timer has just been fired, so we can update the flag */
     qemu_mutex_lock(&tg->lock);
-    tg->any_timer_armed[direction] = false;
+    qatomic_set(&tg->any_timer_armed[direction], false);
     qemu_mutex_unlock(&tg->lock);
 
     /* Run the request that was waiting for this timer */
@@ -645,7 +852,7 @@ void throttle_group_detach_aio_context(ThrottleGroupMember *tgm)
     WITH_QEMU_LOCK_GUARD(&tg->lock) {
         for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
             if (timer_pending(tt->timers[dir])) {
-                tg->any_timer_armed[dir] = false;
+                qatomic_set(&tg->any_timer_armed[dir], false);
                 schedule_next_request(tgm, dir);
             }
         }
@@ -902,6 +1109,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
     if (local_err) {
         goto unlock;
     }
+    throttle_group_drop_credit(tg);
     throttle_config(&tg->ts, tg->clock_type, &cfg);
 
 unlock:
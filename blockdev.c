@@ -2678,7 +2678,7 @@ static BlockJob *do_backup_common(BackupCommon *backup,
 {
     BlockJob *job = NULL;
     BdrvDirtyBitmap *bmap = NULL;
-    BackupPerf perf = { .max_workers = 64 };
+    BackupPerf perf = { .max_workers = 64, .adaptive = true };
     int job_flags = JOB_DEFAULT;
     OnCbwError on_cbw_error = ON_CBW_ERROR_BREAK_GUEST_WRITE;
 
@@ -2714,6 +2714,9 @@ static BlockJob *do_backup_common(BackupCommon *backup,
         if (backup->x_perf->has_min_cluster_size) {
             perf.min_cluster_size = backup->x_perf->min_cluster_size;
         }
+        if (backup->x_perf->has_adaptive) {
+            perf.adaptive = backup->x_perf->adaptive;
+        }
     }
 
     if ((backup->sync == MIRROR_SYNC_MODE_BITMAP) ||
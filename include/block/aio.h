@@ -58,6 +58,16 @@ struct ThreadPoolAio;
 struct LinuxAioState;
 typedef struct LuringState LuringState;
 
+/* How to set up an io_uring ring, see aio_setup_linux_io_uring() */
+typedef struct LuringSetup {
+    bool sqpoll;        /* Submit from a kernel thread (IORING_SETUP_SQPOLL) */
+    int sqpoll_cpu;     /* CPU to pin the kernel thread to, or -1 */
+    bool iopoll;        /* Poll for completions (IORING_SETUP_IOPOLL) */
+} LuringSetup;
+
+/* Maximum number of io_uring rings with a LuringSetup per AioContext */
+#define AIO_MAX_POLLED_LURINGS 4
+
 /* Is polling disabled? */
 bool aio_poll_disabled(AioContext *ctx);
 
@@ -218,6 +228,7 @@ struct AioContext {
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     LuringState *linux_io_uring;
+    LuringState *linux_io_uring_polled[AIO_MAX_POLLED_LURINGS];
 
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
@@ -512,11 +523,17 @@ struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
-/* Setup the LuringState bound to this AioContext */
-LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
+/*
+ * Setup the LuringState bound to this AioContext that is set up as described
+ * by @setup, or the default one if @setup is NULL
+ */
+LuringState *aio_setup_linux_io_uring(AioContext *ctx,
+                                      const LuringSetup *setup,
+                                      Error **errp);
 
-/* Return the LuringState bound to this AioContext */
-LuringState *aio_get_linux_io_uring(AioContext *ctx);
+/* Return the LuringState bound to this AioContext for @setup */
+LuringState *aio_get_linux_io_uring(AioContext *ctx,
+                                    const LuringSetup *setup);
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
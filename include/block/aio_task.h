@@ -43,6 +43,13 @@ int aio_task_pool_status(AioTaskPool *pool);
 /* User provides filled @task, however task->pool will be set automatically */
 void coroutine_fn aio_task_pool_start_task(AioTaskPool *pool, AioTask *task);
 
+/*
+ * Change the number of tasks that may run in parallel.  Tasks above a new,
+ * lower limit keep running; no new ones are started until enough of them
+ * are done.
+ */
+void aio_task_pool_set_max_busy_tasks(AioTaskPool *pool, int max_busy_tasks);
+
 void coroutine_fn aio_task_pool_wait_slot(AioTaskPool *pool);
 void coroutine_fn aio_task_pool_wait_one(AioTaskPool *pool);
 void coroutine_fn aio_task_pool_wait_all(AioTaskPool *pool);
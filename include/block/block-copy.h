@@ -59,10 +59,15 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
  * must be > 0.
  *
  * @max_chunk means maximum length for one IO operation. Zero means unlimited.
+ *
+ * If @adaptive is true, the number of parallel coroutines and the length of
+ * IO operations are chosen at runtime from the observed latency, with
+ * @max_workers and @max_chunk as upper bounds.
  */
 BlockCopyCallState *block_copy_async(BlockCopyState *s,
                                      int64_t offset, int64_t bytes,
                                      int max_workers, int64_t max_chunk,
+                                     bool adaptive,
                                      BlockCopyAsyncCallbackFunc cb,
                                      void *cb_opaque);
 
@@ -99,6 +104,13 @@ void block_copy_call_cancel(BlockCopyCallState *call_state);
 
 BdrvDirtyBitmap *block_copy_dirty_bitmap(BlockCopyState *s);
 int64_t block_copy_cluster_size(BlockCopyState *s);
+
+/*
+ * Get the number of parallel coroutines and the maximum length of IO
+ * operations last chosen for adaptive calls.  Returns false if there was
+ * no adaptive call yet, or if a speed limit turns adaptation off.
+ */
+bool block_copy_get_adapt(BlockCopyState *s, int *workers, int64_t *chunk);
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip);
 
 #endif /* BLOCK_COPY_H */
@@ -28,6 +28,7 @@
 #include "block/block-common.h"
 #include "block/block-global-state.h"
 #include "block/snapshot.h"
+#include "qemu/interval-tree.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
 #include "qemu/stats64.h"
@@ -84,6 +85,8 @@ typedef struct BdrvTrackedRequest {
     int64_t overlap_bytes;
 
     QLIST_ENTRY(BdrvTrackedRequest) list;
+    /* [overlap_offset, overlap_offset + overlap_bytes), if not empty */
+    IntervalTreeNode node;
     Coroutine *co; /* owner, used for deadlock detection */
     CoQueue wait_queue; /* coroutines blocked on this request */
 
@@ -1072,21 +1075,54 @@ struct BdrvChild {
 };
 
 /*
- * Allows bdrv_co_block_status() to cache one data region for a
- * protocol node.
+ * One region in the block-status cache, i.e. the result of a
+ * .bdrv_co_block_status() call for [node.start, node.last].
  *
- * @valid: Whether the cache is valid (should be accessed with atomic
- *         functions so this can be reset by RCU readers)
- * @data_start: Offset where we know (or strongly assume) is data
- * @data_end: Offset where the data region ends (which is not necessarily
- *            the start of a zeroed region)
+ * @ret: The driver's return value (without BDRV_BLOCK_EOF)
+ * @map: Host offset of node.start, if @ret has BDRV_BLOCK_OFFSET_VALID
+ * @file: The node that @map refers to
  */
-typedef struct BdrvBlockStatusCache {
-    struct rcu_head rcu;
+typedef struct BdrvBlockStatusCacheEntry {
+    IntervalTreeNode node;
+    int ret;
+    int64_t map;
+    BlockDriverState *file;
+    QTAILQ_ENTRY(BdrvBlockStatusCacheEntry) lru;
+} BdrvBlockStatusCacheEntry;
+
+/* Maximum number of regions cached per node */
+#define BDRV_BSC_MAX_ENTRIES 256
 
-    bool valid;
-    int64_t data_start;
-    int64_t data_end;
+/*
+ * Allows bdrv_co_block_status() to cache driver results, so that repeated
+ * queries (e.g. from jobs walking a backing chain) do not need to ask the
+ * driver again.
+ *
+ * Format nodes cache all results, because their block status is only
+ * changed through their own write requests, which invalidate the
+ * overlapping regions.  Protocol nodes only cache data regions: others may
+ * write to the underlying storage behind our back, but reporting zeroes as
+ * data is fine.
+ *
+ * @lock: Protects @tree, @lru and @granularity
+ * @tree: Cached regions, which never overlap
+ * @lru: Cached regions in least recently used order
+ * @nb_entries: Number of cached regions (accessed atomically, so that
+ *              invalidating an empty cache does not need @lock)
+ * @generation: Incremented by every invalidation (accessed atomically);
+ *              results of driver calls that started before an invalidation
+ *              are not cached
+ * @granularity: Invalidated ranges are extended to multiples of this (the
+ *               cluster size of format nodes, whose writes can change the
+ *               status of whole clusters), or 0
+ */
+typedef struct BdrvBlockStatusCache {
+    QemuMutex lock;
+    IntervalTreeRoot tree;
+    QTAILQ_HEAD(, BdrvBlockStatusCacheEntry) lru;
+    int nb_entries;
+    unsigned int generation;
+    int64_t granularity;
 } BdrvBlockStatusCache;
 
 struct BlockDriverState {
@@ -1261,6 +1297,8 @@ struct BlockDriverState {
     /* Protected by reqs_lock.  */
     QemuMutex reqs_lock;
     QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
+    /* The same requests, indexed by their overlap range */
+    IntervalTreeRoot tracked_request_tree;
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
 
@@ -1270,10 +1308,7 @@ struct BlockDriverState {
     /* BdrvChild links to this node may never be frozen */
     bool never_freeze;
 
-    /* Lock for block-status cache RCU writers */
-    CoMutex bsc_modify_lock;
-    /* Always non-NULL, but must only be dereferenced under an RCU read guard */
-    BdrvBlockStatusCache *block_status_cache;
+    BdrvBlockStatusCache block_status_cache;
 
     /* array of write pointers' location of each zone in the zoned device. */
     BlockZoneWps *wps;
@@ -166,29 +166,46 @@ bdrv_primary_bs(BlockDriverState *bs)
 }
 
 /**
- * Check whether the given offset is in the cached block-status data
- * region.
+ * Look up the cached block status of the region starting at @offset.
  *
- * If it is, and @pnum is not NULL, *pnum is set to
- * `bsc.data_end - offset`, i.e. how many bytes, starting from
- * @offset, are data (according to the cache).
- * Otherwise, *pnum is not touched.
+ * If it is cached, return true, set *ret to the driver's result, *pnum to
+ * the number of bytes from @offset that have this status, and *map and
+ * *file as .bdrv_co_block_status() would.  Otherwise, return false and
+ * leave the output parameters untouched.
  */
-bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum);
+bool bdrv_bsc_lookup(BlockDriverState *bs, int64_t offset, int *ret,
+                     int64_t *pnum, int64_t *map, BlockDriverState **file);
 
 /**
- * If [offset, offset + bytes) overlaps with the currently cached
- * block-status region, invalidate the cache.
+ * Return the current generation of the block-status cache, to be passed
+ * to bdrv_bsc_fill() for a result that the driver returns after this call.
+ */
+unsigned int bdrv_bsc_generation(BlockDriverState *bs);
+
+/**
+ * Cache the driver result @ret (with @map and @file) for the range
+ * [offset, offset + bytes), unless the cache was invalidated after
+ * @generation was returned by bdrv_bsc_generation().
+ *
+ * If writes can change the status of whole clusters, @granularity must be
+ * the cluster size, otherwise 0.
+ */
+void bdrv_bsc_fill(BlockDriverState *bs, unsigned int generation,
+                   int64_t granularity, int64_t offset, int64_t bytes,
+                   int ret, int64_t map, BlockDriverState *file);
+
+/**
+ * Drop all cached block status that overlaps [offset, offset + bytes).
  *
- * (To be used by I/O paths that cause data regions to be zero or
- * holes.)
+ * (To be used by I/O paths that change the block status.)
  */
 void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes);
 
 /**
- * Mark the range [offset, offset + bytes) as a data region.
+ * Drop all cached block status of @bs, e.g. after its metadata was changed
+ * outside of the I/O paths or its children changed.
  */
-void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes);
+void bdrv_bsc_invalidate(BlockDriverState *bs);
 
 #endif /* BLOCK_INT_IO_H */
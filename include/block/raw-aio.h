@@ -74,16 +74,39 @@ static inline bool laio_has_fua(void)
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(const LuringSetup *setup, Error **errp);
 void luring_cleanup(LuringState *s);
+bool luring_has_setup(LuringState *s, const LuringSetup *setup);
 
-/* luring_co_submit: submit I/O requests in the thread's current AioContext. */
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type,
-                                  BdrvRequestFlags flags);
+/*
+ * luring_co_submit: submit I/O requests in the thread's current AioContext,
+ * to the ring for @setup (see aio_setup_linux_io_uring()).  IOPOLL rings only
+ * support reads and writes on files opened with O_DIRECT.
+ */
+int coroutine_fn luring_co_submit(BlockDriverState *bs,
+                                  const LuringSetup *setup, int fd,
+                                  uint64_t offset, QEMUIOVector *qiov,
+                                  int type, BdrvRequestFlags flags);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 bool luring_has_fua(void);
+
+/*
+ * luring_register_buf/luring_unregister_buf: register memory as fixed
+ * buffers with all rings, for requests with BDRV_REQ_REGISTERED_BUF.  This
+ * pins the memory.  Registering the same range again only takes another
+ * reference.  Failure is not fatal, requests just use normal buffers then.
+ */
+void luring_register_buf(void *host, size_t size);
+void luring_unregister_buf(void *host, size_t size);
+
+/*
+ * luring_unregister_fd: drop @fd from the fixed file tables of all rings.
+ * Must be called before closing an fd that was used with luring_co_submit(),
+ * with no requests for it in flight, because the rings hold a reference to
+ * the file (and with it, any locks on it).
+ */
+void luring_unregister_fd(int fd);
 #else
 static inline bool luring_has_fua(void)
 {
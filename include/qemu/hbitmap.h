@@ -311,6 +311,11 @@ int64_t hbitmap_next_dirty(const HBitmap *hb, int64_t start, int64_t count);
  */
 int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count);
 
+/* Switch hbitmap_next_zero() to the next slower implementation of its
+ * word scan.  Returns false once the plain C version is in use.  For tests.
+ */
+bool test_hbitmap_find_next_accel(void);
+
 /* hbitmap_next_dirty_area:
  * @hb: The HBitmap to operate on
  * @start: the offset to start from
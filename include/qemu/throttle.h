@@ -158,6 +158,13 @@ bool throttle_schedule_timer(ThrottleState *ts,
 
 void throttle_account(ThrottleState *ts, ThrottleDirection direction,
                       uint64_t size);
+
+void throttle_grant_credit(ThrottleState *ts, ThrottleDirection direction,
+                           int64_t now, uint64_t *bytes, uint64_t *ops);
+
+void throttle_return_credit(ThrottleState *ts, ThrottleDirection direction,
+                            uint64_t bytes, uint64_t ops);
+
 void throttle_limits_to_config(ThrottleLimits *arg, ThrottleConfig *cfg,
                                Error **errp);
 void throttle_config_to_limits(ThrottleConfig *cfg, ThrottleLimits *var);
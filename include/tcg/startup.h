@@ -29,12 +29,16 @@
  * tcg_init: Initialize the TCG runtime
  * @tb_size: translation buffer size
  * @splitwx: use separate rw and rx mappings
+ * @huge_pages: back the JIT buffer with explicit huge pages, if possible
  * @max_threads: number of vcpu threads in system mode
  *
  * Allocate and initialize TCG resources, especially the JIT buffer.
+ * Without @huge_pages, or if there are not enough huge pages, the
+ * buffer is aligned for and advised to use transparent huge pages.
  * In user-only mode, @max_threads is unused.
  */
-void tcg_init(size_t tb_size, int splitwx, unsigned max_threads);
+void tcg_init(size_t tb_size, int splitwx, bool huge_pages,
+              unsigned max_threads);
 
 /**
  * tcg_register_thread: Register this thread with the TCG runtime
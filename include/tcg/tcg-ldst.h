@@ -60,4 +60,17 @@ void helper_stq_mmu(CPUArchState *env, uint64_t addr, uint64_t val,
 void helper_st16_mmu(CPUArchState *env, uint64_t addr, Int128 val,
                      MemOpIdx oi, uintptr_t retaddr);
 
+/*
+ * Specialized for accesses in host byte order with MO_ATOM_IFALIGN,
+ * and for loads, zero-extended.  Only the alignment may vary.
+ */
+tcg_target_ulong helper_ldul_he_mmu(CPUArchState *env, uint64_t addr,
+                                    MemOpIdx oi, uintptr_t retaddr);
+uint64_t helper_ldq_he_mmu(CPUArchState *env, uint64_t addr,
+                           MemOpIdx oi, uintptr_t retaddr);
+void helper_stl_he_mmu(CPUArchState *env, uint64_t addr, uint32_t val,
+                       MemOpIdx oi, uintptr_t retaddr);
+void helper_stq_he_mmu(CPUArchState *env, uint64_t addr, uint64_t val,
+                       MemOpIdx oi, uintptr_t retaddr);
+
 #endif /* TCG_LDST_H */
@@ -654,6 +654,7 @@ void tcg_region_reset_all(void);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
+const char *tcg_code_page_type(void);
 
 /**
  * tcg_tb_insert:
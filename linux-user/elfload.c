@@ -18,6 +18,8 @@
 #include "signal-common.h"
 #include "loader.h"
 #include "user-mmap.h"
+#include "libcall.h"
+#include "vdso-data.h"
 #include "disas/disas.h"
 #include "qemu/bitops.h"
 #include "qemu/path.h"
@@ -56,6 +58,7 @@ typedef struct {
     unsigned reloc_count;
     unsigned sigreturn_ofs;
     unsigned rt_sigreturn_ofs;
+    unsigned data_ofs;
 } VdsoImageInfo;
 
 #define ELF_OSABI   ELFOSABI_SYSV
@@ -3574,7 +3577,7 @@ static void load_elf_image(const char *image_name, const ImageSource *src,
         info->end_data = info->end_code;
     }
 
-    if (qemu_log_enabled()) {
+    if (qemu_log_enabled() || libcall_enabled) {
         load_symbols(ehdr, src, load_bias);
     }
 
@@ -3668,6 +3671,15 @@ static void load_elf_vdso(struct image_info *info, const VdsoImageInfo *vdso)
     /* Remove write from VDSO segment. */
     target_mprotect(info->start_data, info->end_data - info->start_data,
                     PROT_READ | PROT_EXEC);
+
+    /*
+     * Provide the time to the vdso, if it can use it.  The data area is
+     * .bss, which the guest must not write even if we leave it zero.
+     */
+    if (vdso->data_ofs) {
+        target_mprotect(load_addr + vdso->data_ofs, VDSO_DATA_SIZE, PROT_READ);
+        vdso_data_init(load_addr + vdso->data_ofs);
+    }
 }
 
 static int symfind(const void *s0, const void *s1)
@@ -3740,7 +3752,17 @@ static void load_symbols(struct elfhdr *hdr, const ImageSource *src,
         }
     }
 
-    /* There will be no symbol table if the file was stripped.  */
+    /*
+     * There will be no symbol table if the file was stripped, but
+     * a shared object still has the dynamic symbols it exports.
+     */
+    for (i = 0; i < shnum; ++i) {
+        if (shdr[i].sh_type == SHT_DYNSYM) {
+            sym_idx = i;
+            str_idx = shdr[i].sh_link;
+            goto found;
+        }
+    }
     return;
 
  found:
@@ -3787,6 +3809,10 @@ static void load_symbols(struct elfhdr *hdr, const ImageSource *src,
             syms[i].st_value &= ~(target_ulong)1;
 #endif
             syms[i].st_value += load_bias;
+            if (libcall_enabled && syms[i].st_name < shdr[str_idx].sh_size) {
+                libcall_register(strings + syms[i].st_name,
+                                 syms[i].st_value);
+            }
             i++;
         }
     }
@@ -0,0 +1,196 @@
+/*
+ * Host implementations of guest libc string routines
+ *
+ * Programs spend much of their time in memcpy, memset and strlen,
+ * which are expensive to emulate one guest instruction at a time.
+ * When enabled with -libc-accel, the entry points of these routines
+ * are collected from the symbol tables of the images that we load
+ * (the main executable and the ELF interpreter, which for musl is
+ * the C library itself).  The target translators recognise a block
+ * starting at one of them and replace it with a call to libcall_exec(),
+ * followed by an emulated function return.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu.h"
+#include "accel/tcg/cpu-ldst.h"
+#include "accel/tcg/cpu-mmu-index.h"
+#include "accel/tcg/helper-retaddr.h"
+#include "accel/tcg/probe.h"
+#include "exec/target_page.h"
+#include "libcall.h"
+
+bool libcall_enabled;
+
+/*
+ * Map from guest entry point to LibcallKind.  This is filled in while
+ * loading the guest images, before any guest code runs, and is read
+ * only afterward.
+ */
+static GHashTable *libcall_table;
+
+static const struct {
+    const char *name;
+    LibcallKind kind;
+} libcall_names[] = {
+    { "memcpy", LIBCALL_MEMMOVE },
+    { "memmove", LIBCALL_MEMMOVE },
+    { "memset", LIBCALL_MEMSET },
+    { "strlen", LIBCALL_STRLEN },
+};
+
+static LibcallKind libcall_match(const char *name)
+{
+    for (int i = 0; i < ARRAY_SIZE(libcall_names); i++) {
+        const char *base = libcall_names[i].name;
+        size_t len = strlen(base);
+
+        if (strcmp(name, base) == 0) {
+            return libcall_names[i].kind;
+        }
+
+        /*
+         * glibc selects one of several implementations with an ifunc,
+         * and only the variants, named __<routine>_<variant>, are plain
+         * functions.  The _chk variants take an additional argument.
+         */
+        if (name[0] == '_' && name[1] == '_'
+            && strncmp(name + 2, base, len) == 0
+            && name[2 + len] == '_'
+            && !strstr(name, "_chk")) {
+            return libcall_names[i].kind;
+        }
+    }
+    return LIBCALL_NONE;
+}
+
+void libcall_register(const char *name, abi_ulong addr)
+{
+    LibcallKind kind = libcall_match(name);
+
+    if (kind == LIBCALL_NONE) {
+        return;
+    }
+    if (!libcall_table) {
+        libcall_table = g_hash_table_new(NULL, NULL);
+    }
+    g_hash_table_insert(libcall_table, (gpointer)(uintptr_t)addr,
+                        GINT_TO_POINTER(kind));
+}
+
+LibcallKind libcall_lookup(abi_ptr pc)
+{
+    if (!libcall_table) {
+        return LIBCALL_NONE;
+    }
+    return GPOINTER_TO_INT(g_hash_table_lookup(libcall_table,
+                                               (gpointer)(uintptr_t)pc));
+}
+
+/*
+ * Return true if [addr, addr + len) may be accessed directly in host
+ * memory.  Return false if some page does not permit the access, or
+ * if plugins have asked to see each memory operation; the caller then
+ * falls back to byte accesses, which raise the guest fault (if any)
+ * at the correct address.
+ */
+static bool libcall_access_ok(CPUArchState *env, MMUAccessType access_type,
+                              abi_ptr addr, abi_ulong len)
+{
+    CPUState *cs = env_cpu(env);
+    int mmu_idx = cpu_mmu_index(cs, false);
+    void *host;
+
+    addr = cpu_untagged_addr(cs, addr);
+    if (probe_access_flags(env, addr, 0, access_type, mmu_idx,
+                           true, &host, 0)) {
+        return false;
+    }
+    return access_ok_untagged(access_type == MMU_DATA_STORE
+                              ? VERIFY_WRITE : VERIFY_READ, addr, len);
+}
+
+static abi_ulong libcall_memmove(CPUArchState *env, abi_ptr dst, abi_ptr src,
+                                 abi_ulong len, uintptr_t ra)
+{
+    CPUState *cs = env_cpu(env);
+
+    if (libcall_access_ok(env, MMU_DATA_LOAD, src, len)
+        && libcall_access_ok(env, MMU_DATA_STORE, dst, len)) {
+        set_helper_retaddr(ra);
+        memmove(g2h(cs, dst), g2h(cs, src), len);
+        clear_helper_retaddr();
+    } else if (dst - src >= len) {
+        for (abi_ulong i = 0; i < len; i++) {
+            cpu_stb_data_ra(env, dst + i, cpu_ldub_data_ra(env, src + i, ra),
+                            ra);
+        }
+    } else {
+        for (abi_ulong i = len; i-- > 0; ) {
+            cpu_stb_data_ra(env, dst + i, cpu_ldub_data_ra(env, src + i, ra),
+                            ra);
+        }
+    }
+    return dst;
+}
+
+static abi_ulong libcall_memset(CPUArchState *env, abi_ptr dst, int c,
+                                abi_ulong len, uintptr_t ra)
+{
+    if (libcall_access_ok(env, MMU_DATA_STORE, dst, len)) {
+        set_helper_retaddr(ra);
+        memset(g2h(env_cpu(env), dst), c, len);
+        clear_helper_retaddr();
+    } else {
+        for (abi_ulong i = 0; i < len; i++) {
+            cpu_stb_data_ra(env, dst + i, c, ra);
+        }
+    }
+    return dst;
+}
+
+static abi_ulong libcall_strlen(CPUArchState *env, abi_ptr str, uintptr_t ra)
+{
+    abi_ptr addr = str;
+
+    /* Scan a page at a time, so that we never read past the terminator. */
+    while (true) {
+        abi_ulong max_len = TARGET_PAGE_SIZE - (addr & ~TARGET_PAGE_MASK);
+        const char *p, *end;
+
+        if (!libcall_access_ok(env, MMU_DATA_LOAD, addr, max_len)) {
+            break;
+        }
+        p = g2h(env_cpu(env), addr);
+        set_helper_retaddr(ra);
+        end = memchr(p, 0, max_len);
+        clear_helper_retaddr();
+        if (end) {
+            return addr + (end - p) - str;
+        }
+        addr += max_len;
+    }
+
+    while (cpu_ldub_data_ra(env, addr, ra)) {
+        addr++;
+    }
+    return addr - str;
+}
+
+abi_ulong libcall_exec(CPUArchState *env, LibcallKind kind, abi_ulong arg0,
+                       abi_ulong arg1, abi_ulong arg2, uintptr_t ra)
+{
+    switch (kind) {
+    case LIBCALL_MEMMOVE:
+        return libcall_memmove(env, arg0, arg1, arg2, ra);
+    case LIBCALL_MEMSET:
+        return libcall_memset(env, arg0, (uint8_t)arg1, arg2, ra);
+    case LIBCALL_STRLEN:
+        return libcall_strlen(env, arg0, ra);
+    default:
+        g_assert_not_reached();
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * Host implementations of guest libc string routines
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef LINUX_USER_LIBCALL_H
+#define LINUX_USER_LIBCALL_H
+
+#include "user/abitypes.h"
+
+/*
+ * The guest routines that may be replaced.  The argument and return
+ * conventions are those of the C library function of the same name;
+ * memcpy is handled as memmove, which is a valid implementation of it.
+ */
+typedef enum LibcallKind {
+    LIBCALL_NONE,
+    LIBCALL_MEMMOVE,
+    LIBCALL_MEMSET,
+    LIBCALL_STRLEN,
+} LibcallKind;
+
+extern bool libcall_enabled;
+
+/**
+ * libcall_register:
+ * @name: symbol name from the guest image
+ * @addr: guest address of the symbol, including the load bias
+ *
+ * Record @addr as an entry point to be replaced, if @name is one
+ * of the routines we recognise.  Other names are ignored.
+ */
+void libcall_register(const char *name, abi_ulong addr);
+
+/**
+ * libcall_lookup:
+ * @pc: guest address of the start of a translation block
+ *
+ * Return the routine registered at @pc, or LIBCALL_NONE.  This is
+ * called by the target translators at the start of each block.
+ */
+LibcallKind libcall_lookup(abi_ptr pc);
+
+/**
+ * libcall_exec:
+ * @env: CPU state
+ * @kind: routine to run
+ * @arg0: first integer argument
+ * @arg1: second integer argument
+ * @arg2: third integer argument
+ * @ra: host return address of the calling helper
+ *
+ * Perform @kind on guest memory and return the value the guest
+ * routine would have returned.  Accesses are checked against the
+ * guest page protections; a fault is raised as SIGSEGV for the guest
+ * instruction at which the translation block started.
+ */
+abi_ulong libcall_exec(CPUArchState *env, LibcallKind kind, abi_ulong arg0,
+                       abi_ulong arg1, abi_ulong arg2, uintptr_t ra);
+
+#endif /* LINUX_USER_LIBCALL_H */
@@ -55,6 +55,8 @@
 #include "signal-common.h"
 #include "loader.h"
 #include "user-mmap.h"
+#include "libcall.h"
+#include "vdso-data.h"
 #include "tcg/perf.h"
 #include "exec/page-vary.h"
 
@@ -168,6 +170,7 @@ void fork_end(pid_t pid)
         }
         qemu_init_cpu_list();
         get_task_state(thread_cpu)->ts_tid = qemu_get_thread_id();
+        vdso_data_fork_child();
     } else {
         cpu_list_unlock();
     }
@@ -438,6 +441,21 @@ static void handle_arg_strace(const char *arg)
     enable_strace = true;
 }
 
+static void handle_arg_libc_accel(const char *arg)
+{
+    libcall_enabled = true;
+}
+
+static void handle_arg_signal_stats(const char *arg)
+{
+    signal_stats_enabled = true;
+}
+
+static void handle_arg_huge_pages(const char *arg)
+{
+    mmap_huge_pages = true;
+}
+
 static void handle_arg_version(const char *arg)
 {
     printf("qemu-" TARGET_NAME " version " QEMU_FULL_VERSION
@@ -529,6 +547,12 @@ static const struct qemu_argument arg_table[] = {
      "size",       "TCG translation block cache size"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
+    {"libc-accel", "QEMU_LIBC_ACCEL",  false, handle_arg_libc_accel,
+     "",           "run guest memcpy, memset and strlen on the host"},
+    {"signal-stats", "QEMU_SIGNAL_STATS", false, handle_arg_signal_stats,
+     "",           "print signal handling statistics at exit"},
+    {"huge-pages", "QEMU_HUGE_PAGES",  false, handle_arg_huge_pages,
+     "",           "back translated code and guest memory with huge pages"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_seed,
      "",           "Seed for pseudo-random number generator"},
     {"trace",      "QEMU_TRACE",       true,  handle_arg_trace,
@@ -820,6 +844,8 @@ int main(int argc, char **argv, char **envp)
                                  opt_one_insn_per_tb, &error_abort);
         object_property_set_int(OBJECT(accel), "tb-size",
                                 opt_tb_size, &error_abort);
+        object_property_set_bool(OBJECT(accel), "huge-pages",
+                                 mmap_huge_pages, &error_abort);
         ac->init_machine(NULL);
     }
 
@@ -30,6 +30,7 @@
 #include "user-mmap.h"
 #include "target_mman.h"
 #include "qemu/interval-tree.h"
+#include "qemu/madvise.h"
 
 #ifdef TARGET_ARM
 #include "target/arm/cpu-features.h"
@@ -552,6 +553,24 @@ abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size, abi_ulong align)
     }
 }
 
+bool mmap_huge_pages;
+
+/*
+ * Ask for transparent huge pages for the host pages that back
+ * [start, last], if the range covers at least one huge page.
+ */
+static void mmap_advise_huge_pages(abi_ulong start, abi_ulong last)
+{
+    size_t host_page_size = qemu_real_host_page_size();
+    void *host_start = QEMU_ALIGN_PTR_UP(g2h_untagged(start), host_page_size);
+    void *host_end = QEMU_ALIGN_PTR_DOWN(g2h_untagged(last) + 1,
+                                         host_page_size);
+
+    if (host_end > host_start && host_end - host_start >= QEMU_VMALLOC_ALIGN) {
+        qemu_madvise(host_start, host_end - host_start, QEMU_MADV_HUGEPAGE);
+    }
+}
+
 /*
  * Record a successful mmap within the user-exec interval tree.
  */
@@ -562,6 +581,9 @@ static abi_long mmap_end(abi_ulong start, abi_ulong last,
 {
     if (flags & MAP_ANONYMOUS) {
         page_flags |= PAGE_ANON;
+        if (mmap_huge_pages) {
+            mmap_advise_huge_pages(start, last);
+        }
     }
     page_flags |= PAGE_RESET;
     if (passthrough_start > passthrough_last) {
@@ -1222,6 +1244,12 @@ abi_long target_madvise(abi_ulong start, abi_ulong len_in, int advice)
     case TARGET_MADV_KEEPONFORK:    /* parisc */
         advice = MADV_KEEPONFORK;
         break;
+    case TARGET_MADV_HUGEPAGE:
+        advice = MADV_HUGEPAGE;
+        break;
+    case TARGET_MADV_NOHUGEPAGE:
+        advice = MADV_NOHUGEPAGE;
+        break;
     /* we do not care about the other MADV_xxx values yet */
     }
 
@@ -1244,6 +1272,9 @@ abi_long target_madvise(abi_ulong start, abi_ulong len_in, int advice)
      * success, which is broken but some userspace programs fail to work
      * otherwise. Completely implementing such emulation is quite complicated
      * though.
+     *
+     * MADV_HUGEPAGE and MADV_NOHUGEPAGE are hints that do not change the
+     * contents, so pass them through for any anonymous memory.
      */
     mmap_lock();
     switch (advice) {
@@ -1258,6 +1289,13 @@ abi_long target_madvise(abi_ulong start, abi_ulong len_in, int advice)
                 page_reset_target_data(start, start + len - 1);
             }
         }
+        break;
+    case MADV_HUGEPAGE:
+    case MADV_NOHUGEPAGE:
+        if (page_check_range(start, len, PAGE_ANON)) {
+            madvise(g2h_untagged(start), len, advice);
+        }
+        break;
     }
     mmap_unlock();
 
@@ -158,6 +158,14 @@ struct TaskState {
      */
     int signal_pending;
 
+    /*
+     * Nonzero if all host signals, including SIGSEGV and SIGBUS, are known
+     * to be blocked for this thread because block_signals() blocked them,
+     * so that process_pending_signals() need not block them again.
+     * Cleared when process_pending_signals() restores the mask.
+     */
+    int signals_blocked;
+
     /* This thread's sigaltstack, if it has one */
     struct target_sigaltstack sigaltstack_used;
 
@@ -57,6 +57,10 @@ void setup_rt_frame(int sig, struct target_sigaction *ka,
 
 void process_pending_signals(CPUArchState *cpu_env);
 void signal_init(const char *rtsig_map);
+
+/* Set by -signal-stats; signal_stats_report() prints the counters. */
+extern bool signal_stats_enabled;
+void signal_stats_report(void);
 void queue_signal(CPUArchState *env, int sig, int si_type,
                   target_siginfo_t *info);
 void host_to_target_siginfo(target_siginfo_t *tinfo, const siginfo_t *info);
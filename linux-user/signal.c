@@ -19,6 +19,8 @@
 #include "qemu/osdep.h"
 #include "qemu/bitops.h"
 #include "qemu/cutils.h"
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
 #include "gdbstub/user.h"
 #include "exec/page-protection.h"
 #include "accel/tcg/cpu-ops.h"
@@ -68,6 +70,48 @@ static uint8_t host_to_target_signal_table[_NSIG] = {
 
 static uint8_t target_to_host_signal_table[TARGET_NSIG + 1];
 
+/*
+ * Counters for -signal-stats.  The times only cover the work done by
+ * QEMU, not the kernel's cost of delivering the host signal.
+ */
+bool signal_stats_enabled;
+static Stat64 host_signal_count, host_signal_ns;
+static Stat64 smc_fault_count, smc_fault_ns;
+static Stat64 guest_signal_count, guest_signal_ns;
+
+static inline int64_t signal_stats_start(void)
+{
+    return unlikely(signal_stats_enabled) ? get_clock() : 0;
+}
+
+static inline void signal_stats_end(Stat64 *count, Stat64 *ns, int64_t start)
+{
+    if (unlikely(signal_stats_enabled)) {
+        stat64_inc(count);
+        stat64_add(ns, get_clock() - start);
+    }
+}
+
+static void signal_stats_print(const char *what, Stat64 *count, Stat64 *ns)
+{
+    uint64_t n = stat64_get(count);
+
+    fprintf(stderr, "  %-20s %12" PRIu64 " %12" PRIu64 " ns/event\n",
+            what, n, n ? stat64_get(ns) / n : 0);
+}
+
+void signal_stats_report(void)
+{
+    if (!signal_stats_enabled) {
+        return;
+    }
+    fprintf(stderr, "qemu: signal statistics (pid %d):\n", getpid());
+    signal_stats_print("host signals", &host_signal_count, &host_signal_ns);
+    signal_stats_print("SMC write faults", &smc_fault_count, &smc_fault_ns);
+    signal_stats_print("guest deliveries", &guest_signal_count,
+                       &guest_signal_ns);
+}
+
 /* valid sig is between 1 and _NSIG - 1 */
 int host_to_target_signal(int sig)
 {
@@ -189,6 +233,7 @@ int block_signals(void)
      */
     sigfillset(&set);
     sigprocmask(SIG_SETMASK, &set, 0);
+    qatomic_set(&ts->signals_blocked, 1);
 
     return qatomic_xchg(&ts->signal_pending, 1);
 }
@@ -1044,6 +1089,7 @@ static void host_signal_handler(int host_sig, siginfo_t *info, void *puc)
     uintptr_t pc = 0;
     bool sync_sig = false;
     void *sigmask;
+    int64_t start = signal_stats_start();
 
     if (host_sig == host_interrupt_signal) {
         ts->signal_pending = 1;
@@ -1061,6 +1107,7 @@ static void host_signal_handler(int host_sig, siginfo_t *info, void *puc)
         case SIGSEGV:
             /* Only returns on handle_sigsegv_accerr_write success. */
             host_sigsegv_handler(cpu, info, uc);
+            signal_stats_end(&smc_fault_count, &smc_fault_ns, start);
             return;
         case SIGBUS:
             pc = host_sigbus_handler(cpu, info, uc);
@@ -1118,6 +1165,8 @@ static void host_signal_handler(int host_sig, siginfo_t *info, void *puc)
 
     /* interrupt the virtual CPU as soon as possible */
     cpu_exit(thread_cpu);
+
+    signal_stats_end(&host_signal_count, &host_signal_ns, start);
 }
 
 /* do_sigaltstack() returns target values and errnos. */
@@ -1264,6 +1313,7 @@ static void handle_pending_signal(CPUArchState *cpu_env, int sig,
     target_sigset_t target_old_set;
     struct target_sigaction *sa;
     TaskState *ts = get_task_state(cpu);
+    int64_t start = signal_stats_start();
 
     trace_user_handle_signal(cpu_env, sig);
     /* dequeue signal */
@@ -1350,6 +1400,8 @@ static void handle_pending_signal(CPUArchState *cpu_env, int sig,
             sa->_sa_handler = TARGET_SIG_DFL;
         }
     }
+
+    signal_stats_end(&guest_signal_count, &guest_signal_ns, start);
 }
 
 void process_pending_signals(CPUArchState *cpu_env)
@@ -1361,8 +1413,17 @@ void process_pending_signals(CPUArchState *cpu_env)
     sigset_t *blocked_set;
 
     while (qatomic_read(&ts->signal_pending)) {
-        sigfillset(&set);
-        sigprocmask(SIG_SETMASK, &set, 0);
+        /*
+         * After block_signals() every host signal is blocked already;
+         * avoid the syscall.  Anywhere else SIGSEGV and SIGBUS may still
+         * be deliverable, and they must not interrupt the walk of
+         * ts->sigtab or the setup of a guest signal frame.
+         */
+        if (!qatomic_read(&ts->signals_blocked)) {
+            sigfillset(&set);
+            sigprocmask(SIG_SETMASK, &set, 0);
+            qatomic_set(&ts->signals_blocked, 1);
+        }
 
     restart_scan:
         sig = ts->sync_signal.pending;
@@ -1408,6 +1469,7 @@ void process_pending_signals(CPUArchState *cpu_env)
         set = ts->signal_mask;
         sigdelset(&set, SIGSEGV);
         sigdelset(&set, SIGBUS);
+        qatomic_set(&ts->signals_blocked, 0);
         sigprocmask(SIG_SETMASK, &set, 0);
     }
     ts->in_sigsuspend = 0;
@@ -41,6 +41,9 @@
 extern abi_ulong task_unmapped_base;
 extern abi_ulong elf_et_dyn_base;
 
+/* Request transparent huge pages for large anonymous guest mappings. */
+extern bool mmap_huge_pages;
+
 abi_long target_madvise(abi_ulong start, abi_ulong len_in, int advice);
 
 abi_ulong target_shmat(CPUArchState *cpu_env, int shmid,
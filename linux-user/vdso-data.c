@@ -0,0 +1,221 @@
+/*
+ * Time data for the replacement vdso.
+ *
+ * The vdso computes CLOCK_REALTIME and CLOCK_MONOTONIC from the guest
+ * cycle counter, which reads the host cycle counter, and the scale and
+ * base values in a page that a host thread refreshes every period.
+ * Like the kernel's timekeeping, each update keeps the guest monotonic
+ * clock continuous, and adjusts the rate so that it converges on the
+ * host clock by the next update instead of stepping to it.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/memfd.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "exec/tswap.h"
+#include "qemu.h"
+#include "user/guest-host.h"
+#include "vdso-data.h"
+
+/* Interval between updates of the data page. */
+#define VDSO_DATA_PERIOD_NS  (50 * SCALE_MS)
+
+/* Data older than this is not used; the vdso makes syscalls instead. */
+#define VDSO_DATA_MAX_AGE_NS  NANOSECONDS_PER_SECOND
+
+/* The guest clock is stepped instead of adjusted when this far behind. */
+#define VDSO_DATA_MAX_ERROR_NS  (10 * VDSO_DATA_PERIOD_NS)
+
+typedef struct ClockSample {
+    uint64_t ticks;
+    int64_t mono;
+    int64_t real;
+} ClockSample;
+
+static abi_ulong vdso_data_addr;
+static VdsoData *vdso_data;
+static uint32_t vdso_data_seq;
+
+static bool vdso_data_usable(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    /*
+     * The TSC need not be synchronized between cpus.  Trust it only
+     * if the kernel does so for its own timekeeping.
+     */
+    g_autofree char *cs = NULL;
+
+    if (!g_file_get_contents("/sys/devices/system/clocksource/"
+                             "clocksource0/current_clocksource",
+                             &cs, NULL, NULL)) {
+        return false;
+    }
+    return strcmp(g_strstrip(cs), "tsc") == 0;
+#else
+    return true;
+#endif
+}
+
+static void clock_sample(ClockSample *s)
+{
+    struct timespec ts;
+    uint64_t t0, t1;
+
+    t0 = cpu_get_host_ticks();
+    s->mono = get_clock();
+    t1 = cpu_get_host_ticks();
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    s->ticks = t0 + (t1 - t0) / 2;
+    s->real = ts.tv_sec * NANOSECONDS_PER_SECOND + ts.tv_nsec;
+}
+
+static void vdso_data_publish(uint64_t ticks_base, int64_t mono,
+                              int64_t real, uint32_t mult, uint32_t shift,
+                              uint32_t max_delta)
+{
+    VdsoData *d = vdso_data;
+
+    qatomic_set(&d->seq, tswap32(++vdso_data_seq));
+    smp_wmb();
+
+    d->mult = tswap32(mult);
+    d->shift = tswap32(shift);
+    d->max_delta = tswap32(max_delta);
+    d->ticks_base = tswap64(ticks_base);
+    d->mono_sec = tswap64(mono / NANOSECONDS_PER_SECOND);
+    d->mono_nsec = tswap32(mono % NANOSECONDS_PER_SECOND);
+    d->real_sec = tswap64(real / NANOSECONDS_PER_SECOND);
+    d->real_nsec = tswap32(real % NANOSECONDS_PER_SECOND);
+
+    smp_wmb();
+    qatomic_set(&d->seq, tswap32(++vdso_data_seq));
+}
+
+static void *vdso_data_thread(void *opaque)
+{
+    ClockSample prev, now;
+    uint64_t ticks_base = 0;
+    int64_t mono_base = 0;
+    uint32_t mult = 0, shift = 0, max_delta = 0;
+
+    clock_sample(&prev);
+    while (true) {
+        double rate, scale;
+
+        g_usleep(VDSO_DATA_PERIOD_NS / SCALE_US);
+        clock_sample(&now);
+
+        if (now.ticks <= prev.ticks || now.mono <= prev.mono) {
+            /* The counter is not usable after all. */
+            vdso_data_publish(0, 0, 0, 0, 0, 0);
+            return NULL;
+        }
+
+        /* Host nanoseconds per tick over the last period. */
+        rate = (double)(now.mono - prev.mono) / (now.ticks - prev.ticks);
+
+        if (mult && now.ticks - ticks_base <= max_delta) {
+            int64_t pred = mono_base +
+                (((now.ticks - ticks_base) * mult) >> shift);
+            int64_t err = now.mono - pred;
+
+            if (err > VDSO_DATA_MAX_ERROR_NS) {
+                mono_base = now.mono;
+                scale = 1;
+            } else {
+                /*
+                 * Continue from the time the guest sees now, and run
+                 * fast or slow until the next update to make up err.
+                 * Bound the adjustment, so that the clock never stops.
+                 */
+                err = MIN(err, VDSO_DATA_PERIOD_NS / 2);
+                err = MAX(err, -VDSO_DATA_PERIOD_NS / 2);
+                mono_base = pred;
+                scale = (double)(VDSO_DATA_PERIOD_NS + err)
+                        / VDSO_DATA_PERIOD_NS;
+            }
+        } else {
+            /* First update, or the previous one is too old to be used. */
+            mono_base = now.mono;
+            scale = 1;
+        }
+
+        /* Use the largest shift, up to 31, for which mult fits. */
+        for (shift = 31; shift > 0; shift--) {
+            if (rate * scale * (1ull << shift) < UINT32_MAX) {
+                break;
+            }
+        }
+        mult = MAX(rate * scale * (1ull << shift), 1);
+        max_delta = MIN(VDSO_DATA_MAX_AGE_NS / rate, UINT32_MAX);
+        ticks_base = now.ticks;
+
+        vdso_data_publish(ticks_base, mono_base,
+                          mono_base + (now.real - now.mono),
+                          mult, shift, max_delta);
+        prev = now;
+    }
+    return NULL;
+}
+
+/*
+ * Map a fresh page at vdso_data_addr and start a thread to update it.
+ * Until the first update, the vdso makes syscalls.
+ */
+static void vdso_data_start(void)
+{
+    size_t size = qemu_real_host_page_size();
+    QemuThread thread;
+    void *host;
+    int fd;
+
+    if (size > VDSO_DATA_SIZE) {
+        return;
+    }
+
+    fd = qemu_memfd_create("qemu-vdso-data", size, false, 0, 0, NULL);
+    if (fd < 0) {
+        return;
+    }
+    host = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (host == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+    if (mmap(g2h_untagged(vdso_data_addr), size, PROT_READ,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(host, size);
+        close(fd);
+        return;
+    }
+    close(fd);
+
+    vdso_data = host;
+    vdso_data_seq = 0;
+    qemu_thread_create(&thread, "vdso-data", vdso_data_thread, NULL,
+                       QEMU_THREAD_DETACHED);
+}
+
+void vdso_data_init(abi_ulong addr)
+{
+    if (vdso_data_usable()) {
+        vdso_data_addr = addr;
+        vdso_data_start();
+    }
+}
+
+void vdso_data_fork_child(void)
+{
+    VdsoData *old = vdso_data;
+
+    if (old) {
+        /* The old page is still shared with the parent; replace it. */
+        vdso_data = NULL;
+        vdso_data_start();
+        munmap(old, qemu_real_host_page_size());
+    }
+}
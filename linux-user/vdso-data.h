@@ -0,0 +1,93 @@
+/*
+ * Data page shared between QEMU and the replacement vdso.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef LINUX_USER_VDSO_DATA_H
+#define LINUX_USER_VDSO_DATA_H
+
+/*
+ * A vdso image that provides the symbol named by gen-vdso -d reserves
+ * VDSO_DATA_SIZE bytes there, aligned to VDSO_DATA_SIZE, so that the
+ * area covers whole host pages.  QEMU maps a page there that a host
+ * thread keeps up to date, and the vdso computes the time from it
+ * without a syscall:
+ *
+ *   ns = ((ticks - ticks_base) * mult) >> shift
+ *   time = { base_sec, base_nsec + ns }, normalized
+ *
+ * where ticks is the value of the guest cycle counter, which must be
+ * cpu_get_host_ticks().  The vdso falls back to the syscall if mult is
+ * zero (the page is not maintained, which is the case until the first
+ * update), if ticks - ticks_base exceeds max_delta, and for clocks
+ * other than CLOCK_{REALTIME,MONOTONIC}{,_COARSE}.
+ *
+ * All fields are in guest byte order.  seq is odd while an update is
+ * in progress; readers retry until they see the same even value before
+ * and after reading the other fields.
+ */
+
+#define VDSO_DATA_SIZE          0x10000
+
+#define VDSO_DATA_SEQ           0   /* uint32_t */
+#define VDSO_DATA_MULT          4   /* uint32_t */
+#define VDSO_DATA_SHIFT         8   /* uint32_t, at most 31 */
+#define VDSO_DATA_MAX_DELTA     12  /* uint32_t */
+#define VDSO_DATA_TICKS_BASE    16  /* uint64_t */
+#define VDSO_DATA_MONO_SEC      24  /* int64_t */
+#define VDSO_DATA_MONO_NSEC     32  /* uint32_t */
+#define VDSO_DATA_REAL_SEC      40  /* int64_t */
+#define VDSO_DATA_REAL_NSEC     48  /* uint32_t */
+
+/* The distance between the two bases, used to select one. */
+#define VDSO_DATA_REAL_MONO     (VDSO_DATA_REAL_SEC - VDSO_DATA_MONO_SEC)
+
+#ifndef __ASSEMBLER__
+
+typedef struct VdsoData {
+    uint32_t seq;
+    uint32_t mult;
+    uint32_t shift;
+    uint32_t max_delta;
+    uint64_t ticks_base;
+    int64_t mono_sec;
+    uint32_t mono_nsec;
+    uint32_t pad0;
+    int64_t real_sec;
+    uint32_t real_nsec;
+    uint32_t pad1;
+} VdsoData;
+
+QEMU_BUILD_BUG_ON(offsetof(VdsoData, seq) != VDSO_DATA_SEQ);
+QEMU_BUILD_BUG_ON(offsetof(VdsoData, mult) != VDSO_DATA_MULT);
+QEMU_BUILD_BUG_ON(offsetof(VdsoData, shift) != VDSO_DATA_SHIFT);
+QEMU_BUILD_BUG_ON(offsetof(VdsoData, max_delta) != VDSO_DATA_MAX_DELTA);
+QEMU_BUILD_BUG_ON(offsetof(VdsoData, ticks_base) != VDSO_DATA_TICKS_BASE);
+QEMU_BUILD_BUG_ON(offsetof(VdsoData, mono_sec) != VDSO_DATA_MONO_SEC);
+QEMU_BUILD_BUG_ON(offsetof(VdsoData, mono_nsec) != VDSO_DATA_MONO_NSEC);
+QEMU_BUILD_BUG_ON(offsetof(VdsoData, real_sec) != VDSO_DATA_REAL_SEC);
+QEMU_BUILD_BUG_ON(offsetof(VdsoData, real_nsec) != VDSO_DATA_REAL_NSEC);
+QEMU_BUILD_BUG_ON(offsetof(VdsoData, real_nsec) - offsetof(VdsoData, mono_nsec)
+                  != VDSO_DATA_REAL_MONO);
+
+/**
+ * vdso_data_init:
+ * @addr: guest address of the data area within the loaded vdso
+ *
+ * Map the data page at @addr and start the thread that updates it.
+ * If the host cycle counter is not suitable, leave the area alone,
+ * so that the vdso always uses the syscalls.
+ */
+void vdso_data_init(abi_ulong addr);
+
+/**
+ * vdso_data_fork_child:
+ *
+ * In a child process after fork, give the child its own data page
+ * and updater thread.  The parent's thread did not survive the fork.
+ */
+void vdso_data_fork_child(void);
+
+#endif /* __ASSEMBLER__ */
+#endif /* LINUX_USER_VDSO_DATA_H */
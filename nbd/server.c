@@ -42,6 +42,19 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * Read payloads of at least NBD_ZERO_COPY_MIN_BYTES are sent with
+ * MSG_ZEROCOPY on exports with zero-copy enabled.  Below that, pinning
+ * the pages and handling the completion costs more than the copy.
+ */
+#define NBD_ZERO_COPY_MIN_BYTES (64 * KiB)
+
+/*
+ * Buffers sent with MSG_ZEROCOPY are freed in batches once this many bytes
+ * are pending, after waiting for the kernel to finish sending all of them.
+ */
+#define NBD_ZERO_COPY_MAX_PENDING (32 * MiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -99,6 +112,7 @@ struct NBDExport {
     Notifier eject_notifier;
 
     bool allocation_depth;
+    bool zero_copy;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
 };
@@ -140,6 +154,13 @@ struct NBDClient {
     CoMutex send_lock;
     Coroutine *send_coroutine;
 
+    /*
+     * Read buffers that may still be in use by MSG_ZEROCOPY sends, and their
+     * total size.  Protected by send_lock.
+     */
+    GSList *zero_copy_bufs;
+    size_t zero_copy_pending;
+
     bool read_yielding; /* protected by lock */
     bool quiescing; /* protected by lock */
 
@@ -1560,6 +1581,43 @@ void nbd_client_get(NBDClient *client)
     qatomic_inc(&client->refcount);
 }
 
+/*
+ * Wait until the kernel has finished sending all buffers that were passed to
+ * nbd_co_release_zero_copy_buf() and free them.  If that fails, the kernel
+ * may still read from them at any time, so they are leaked instead: once
+ * freed, the memory could be reused for other data, which would then go out
+ * on the wire.
+ *
+ * Called with send_lock held.
+ */
+static int nbd_client_flush_zero_copy(NBDClient *client, Error **errp)
+{
+    Error *local_err = NULL;
+    int ret = 0;
+
+    if (!client->zero_copy_bufs) {
+        return 0;
+    }
+
+    trace_nbd_client_flush_zero_copy(client->zero_copy_pending);
+
+    /* Corked data would never be sent, so the flush would never end */
+    qio_channel_set_cork(client->ioc, false);
+    if (qio_channel_flush(client->ioc, &local_err) < 0) {
+        trace_nbd_client_leak_zero_copy(client->zero_copy_pending,
+                                        error_get_pretty(local_err));
+        error_propagate(errp, local_err);
+        g_slist_free(client->zero_copy_bufs);
+        ret = -EIO;
+    } else {
+        g_slist_free_full(client->zero_copy_bufs, qemu_vfree);
+    }
+
+    client->zero_copy_bufs = NULL;
+    client->zero_copy_pending = 0;
+    return ret;
+}
+
 void nbd_client_put(NBDClient *client)
 {
     assert(qemu_in_main_thread());
@@ -1570,6 +1628,17 @@ void nbd_client_put(NBDClient *client)
          */
         assert(client->closing);
 
+        /*
+         * The socket is shut down, so waiting for the completion of pending
+         * zero-copy sends could block the main loop until TCP times out.
+         * Leak their buffers instead, as nbd_client_flush_zero_copy() does
+         * when it fails.
+         */
+        if (client->zero_copy_bufs) {
+            trace_nbd_client_leak_zero_copy(client->zero_copy_pending,
+                                            "client closed");
+            g_slist_free(client->zero_copy_bufs);
+        }
         object_unref(OBJECT(client->sioc));
         object_unref(OBJECT(client->ioc));
         if (client->tlscreds) {
@@ -1931,6 +2000,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -2049,6 +2119,93 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Whether read payloads are sent with MSG_ZEROCOPY.  This is never the case
+ * with TLS, because client->ioc is then the TLS channel, which encrypts
+ * into its own buffers.
+ */
+static bool nbd_client_zero_copy(NBDClient *client)
+{
+    return client->exp->zero_copy &&
+        qio_channel_has_feature(client->ioc,
+                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+}
+
+/*
+ * Like nbd_co_send_iov(), but the last element of @iov is read payload, which
+ * the kernel may send directly from memory.  In that case, request->zero_copy
+ * is set, even if sending fails, and the caller must pass the buffer to
+ * nbd_co_release_zero_copy_buf() instead of freeing it.
+ */
+static int coroutine_fn nbd_co_send_iov_payload(NBDClient *client,
+                                                NBDRequest *request,
+                                                struct iovec *iov,
+                                                unsigned niov, Error **errp)
+{
+    int ret;
+
+    if (!nbd_client_zero_copy(client) ||
+        iov[niov - 1].iov_len < NBD_ZERO_COPY_MIN_BYTES) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    /* The header is on the stack, so it must be copied */
+    ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+    if (ret == 0) {
+        request->zero_copy = true;
+        ret = qio_channel_writev_full_all(client->ioc, &iov[niov - 1], 1,
+                                          NULL, 0,
+                                          QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                          errp);
+    }
+    ret = ret < 0 ? -EIO : 0;
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
+/*
+ * Take ownership of a read buffer that was sent with
+ * nbd_co_send_iov_payload().  Once enough buffers have accumulated, wait for
+ * all zero-copy sends to complete and free them.
+ */
+static int coroutine_fn nbd_co_release_zero_copy_buf(NBDClient *client,
+                                                     void *data, size_t size,
+                                                     Error **errp)
+{
+    int ret = 0;
+
+    qemu_co_mutex_lock(&client->send_lock);
+
+    client->zero_copy_bufs = g_slist_prepend(client->zero_copy_bufs, data);
+    client->zero_copy_pending += size;
+
+    if (client->zero_copy_pending >= NBD_ZERO_COPY_MAX_PENDING) {
+        ret = nbd_client_flush_zero_copy(client, errp);
+    }
+
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
+/*
+ * Wait for all zero-copy sends to complete and free their buffers, before
+ * the client is closed.
+ */
+static void coroutine_fn nbd_co_flush_zero_copy(NBDClient *client)
+{
+    qemu_co_mutex_lock(&client->send_lock);
+    nbd_client_flush_zero_copy(client, NULL);
+    qemu_co_mutex_unlock(&client->send_lock);
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2080,6 +2237,9 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
+    if (len) {
+        return nbd_co_send_iov_payload(client, request, iov, 2, errp);
+    }
     return nbd_co_send_iov(client, iov, 2, errp);
 }
 
@@ -2161,7 +2321,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_iov_payload(client, request, iov, 3, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -3071,6 +3231,7 @@ static coroutine_fn void nbd_trip(void *opaque)
     NBDRequestData *req = opaque;
     NBDClient *client = req->client;
     NBDRequest request = { 0 };    /* GCC thinks it can be used uninitialized */
+    bool closing;
     int ret;
     Error *local_err = NULL;
 
@@ -3154,6 +3315,23 @@ static coroutine_fn void nbd_trip(void *opaque)
     }
 
     qio_channel_set_cork(client->ioc, false);
+
+    /*
+     * Even if sending failed, the kernel may still read from a buffer that
+     * it was asked to send with MSG_ZEROCOPY, so it must not be freed here
+     */
+    if (request.zero_copy) {
+        int release_ret;
+
+        release_ret = nbd_co_release_zero_copy_buf(client, req->data,
+                                                   request.len,
+                                                   ret < 0 ? NULL : &local_err);
+        req->data = NULL;
+        if (ret == 0) {
+            ret = release_ret;
+        }
+    }
+
     qemu_mutex_lock(&client->lock);
 
     if (ret < 0) {
@@ -3186,9 +3364,19 @@ disconnect:
         error_reportf_err(local_err, "Disconnect client, due to: ");
     }
 
+    closing = client->closing;
     nbd_request_put(req);
     qemu_mutex_unlock(&client->lock);
 
+    /*
+     * Wait for pending zero-copy sends while the socket is still open, so
+     * that their buffers can be freed.  Once the client is closed,
+     * nbd_client_put() leaks them instead.
+     */
+    if (!closing) {
+        nbd_co_flush_zero_copy(client);
+    }
+
     aio_co_reschedule_self(qemu_get_aio_context());
     client_close(client, true);
     nbd_client_put(client);
@@ -34,6 +34,7 @@
 #include "qapi/qobject-output-visitor.h"
 #include "qobject/qjson.h"
 #include "qobject/qdict.h"
+#include "qobject/qnum.h"
 #include "qemu/cutils.h"
 #include "qemu/config-file.h"
 #include "qemu/option.h"
@@ -44,12 +45,14 @@
 #include "qemu/sockets.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/rcu.h"
 #include "qom/object_interfaces.h"
 #include "system/block-backend.h"
 #include "block/block_int.h"
 #include "block/blockjob.h"
 #include "block/dirty-bitmap.h"
 #include "block/qapi.h"
+#include "block/thread-pool.h"
 #include "crypto/init.h"
 #include "trace/control.h"
 #include "qemu/throttle.h"
@@ -86,6 +89,10 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_THREADS = 278,
+    OPTION_RW_MIX = 279,
+    OPTION_RANDOM = 280,
+    OPTION_JOBS = 281,
 };
 
 typedef enum OutputFormat {
@@ -188,6 +195,11 @@ void help(void)
            "  '-n' skips the target volume creation (useful if the volume is created\n"
            "       prior to running qemu-img)\n"
            "\n"
+           "Parameters to bench subcommand:\n"
+           "  '--rw-mix' sets the percentage of reads in a mixed read/write test\n"
+           "  '--random' sets the percentage of requests sent to random offsets\n"
+           "  '--jobs' runs that many jobs in parallel, each in its own thread\n"
+           "\n"
            "Parameters to bitmap subcommand:\n"
            "  'bitmap' is the name of the bitmap to manipulate, through one or more\n"
            "       actions from '--add', '--remove', '--clear', '--enable', '--disable',\n"
@@ -207,6 +219,9 @@ void help(void)
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
            "       process (defaults to 8)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '--threads' specifies how many threads may be used for zero detection,\n"
+           "       compression and encryption, and looks up the block status of the\n"
+           "       source ahead of the copy\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -1667,6 +1682,15 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/* Block status extents looked up ahead of the copy with --threads */
+#define CONVERT_STATUS_AHEAD 64
+
+typedef struct ConvertExtent {
+    int64_t sector_num;
+    int n;
+    enum ImgConvertBlockStatus status;
+} ConvertExtent;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1699,6 +1723,20 @@ typedef struct ImgConvertState {
     int64_t wait_sector_num[MAX_COROUTINES];
     CoMutex lock;
     int ret;
+
+    /*
+     * With --threads, zero detection runs in the thread pool, and a
+     * separate coroutine looks up the block status ahead of the copy.
+     * The extents it found are protected by lock.
+     */
+    int num_threads;
+    bool status_running;
+    int status_ret;
+    ConvertExtent status_ahead[CONVERT_STATUS_AHEAD];
+    int status_first;
+    int status_count;
+    CoQueue status_avail;       /* copy coroutines wait for extents */
+    CoQueue status_space;       /* the status coroutine waits for room */
 } ImgConvertState;
 
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
@@ -1713,12 +1751,22 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
+/*
+ * Look up the block status at @sector_num.  Store the number of sectors
+ * with the same status in *@pnum and the status in *@status.
+ */
 static int coroutine_mixed_fn GRAPH_RDLOCK
-convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
+convert_block_status(ImgConvertState *s, int64_t sector_num, int *pnum,
+                     enum ImgConvertBlockStatus *status)
 {
     int64_t src_cur_offset;
     int ret, n, src_cur;
     bool post_backing_zero = false;
+    uint64_t offset;
+    int64_t count;
+    int tail;
+    BlockDriverState *src_bs;
+    BlockDriverState *base;
 
     convert_select_part(s, sector_num, &src_cur, &src_cur_offset);
 
@@ -1735,72 +1783,179 @@ convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
     }
 
-    if (s->sector_next_status <= sector_num) {
-        uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
-        int64_t count;
-        int tail;
-        BlockDriverState *src_bs = blk_bs(s->src[src_cur]);
-        BlockDriverState *base;
-
-        if (s->target_has_backing) {
-            base = bdrv_cow_bs(bdrv_skip_filters(src_bs));
-        } else {
-            base = NULL;
-        }
+    offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
+    src_bs = blk_bs(s->src[src_cur]);
 
-        do {
-            count = n * BDRV_SECTOR_SIZE;
+    if (s->target_has_backing) {
+        base = bdrv_cow_bs(bdrv_skip_filters(src_bs));
+    } else {
+        base = NULL;
+    }
 
-            ret = bdrv_block_status_above(src_bs, base, offset, count, &count,
-                                          NULL, NULL);
+    do {
+        count = n * BDRV_SECTOR_SIZE;
 
-            if (ret < 0) {
-                if (s->salvage) {
-                    if (n == 1) {
-                        if (!s->quiet) {
-                            warn_report("error while reading block status at "
-                                        "offset %" PRIu64 ": %s", offset,
-                                        strerror(-ret));
-                        }
-                        /* Just try to read the data, then */
-                        ret = BDRV_BLOCK_DATA;
-                        count = BDRV_SECTOR_SIZE;
-                    } else {
-                        /* Retry on a shorter range */
-                        n = DIV_ROUND_UP(n, 4);
+        ret = bdrv_block_status_above(src_bs, base, offset, count, &count,
+                                      NULL, NULL);
+
+        if (ret < 0) {
+            if (s->salvage) {
+                if (n == 1) {
+                    if (!s->quiet) {
+                        warn_report("error while reading block status at "
+                                    "offset %" PRIu64 ": %s", offset,
+                                    strerror(-ret));
                     }
+                    /* Just try to read the data, then */
+                    ret = BDRV_BLOCK_DATA;
+                    count = BDRV_SECTOR_SIZE;
                 } else {
-                    error_report("error while reading block status at offset "
-                                 "%" PRIu64 ": %s", offset, strerror(-ret));
-                    return ret;
+                    /* Retry on a shorter range */
+                    n = DIV_ROUND_UP(n, 4);
                 }
+            } else {
+                error_report("error while reading block status at offset "
+                             "%" PRIu64 ": %s", offset, strerror(-ret));
+                return ret;
             }
-        } while (ret < 0);
+        }
+    } while (ret < 0);
 
-        n = DIV_ROUND_UP(count, BDRV_SECTOR_SIZE);
+    n = DIV_ROUND_UP(count, BDRV_SECTOR_SIZE);
 
-        /*
-         * Avoid that s->sector_next_status becomes unaligned to the source
-         * request alignment and/or cluster size to avoid unnecessary read
-         * cycles.
-         */
-        tail = (sector_num - src_cur_offset + n) % s->src_alignment[src_cur];
-        if (n > tail) {
-            n -= tail;
+    /*
+     * Avoid that s->sector_next_status becomes unaligned to the source
+     * request alignment and/or cluster size to avoid unnecessary read
+     * cycles.
+     */
+    tail = (sector_num - src_cur_offset + n) % s->src_alignment[src_cur];
+    if (n > tail) {
+        n -= tail;
+    }
+
+    if (ret & BDRV_BLOCK_ZERO) {
+        *status = post_backing_zero ? BLK_BACKING_FILE : BLK_ZERO;
+    } else if (ret & BDRV_BLOCK_DATA) {
+        *status = BLK_DATA;
+    } else {
+        *status = s->target_has_backing ? BLK_BACKING_FILE : BLK_DATA;
+    }
+
+    *pnum = n;
+    return 0;
+}
+
+/*
+ * Like convert_block_status(), but take the result from the extents that
+ * convert_co_status_ahead() looked up.  Called with s->lock held.
+ */
+static int coroutine_fn
+convert_co_block_status_ahead(ImgConvertState *s, int64_t sector_num,
+                              int *pnum, enum ImgConvertBlockStatus *status)
+{
+    while (true) {
+        ConvertExtent *e;
+
+        if (!s->status_count) {
+            if (!s->status_running) {
+                assert(s->status_ret < 0);
+                return s->status_ret;
+            }
+            qemu_co_queue_wait(&s->status_avail, &s->lock);
+            continue;
         }
 
-        if (ret & BDRV_BLOCK_ZERO) {
-            s->status = post_backing_zero ? BLK_BACKING_FILE : BLK_ZERO;
-        } else if (ret & BDRV_BLOCK_DATA) {
-            s->status = BLK_DATA;
+        e = &s->status_ahead[s->status_first];
+        if (e->sector_num + e->n <= sector_num) {
+            /* Skipped by rounding up to whole clusters */
+            s->status_first = (s->status_first + 1) % CONVERT_STATUS_AHEAD;
+            s->status_count--;
+            qemu_co_queue_next(&s->status_space);
+            continue;
+        }
+
+        assert(e->sector_num <= sector_num);
+        *pnum = e->sector_num + e->n - sector_num;
+        *status = e->status;
+        return 0;
+    }
+}
+
+/*
+ * Look up the block status of the source ahead of the copy coroutines, so
+ * that they do not have to wait for it, and so that the lookups overlap
+ * with the copy.
+ */
+static void coroutine_fn convert_co_status_ahead(void *opaque)
+{
+    ImgConvertState *s = opaque;
+    int64_t sector_num = 0;
+    int ret = 0;
+
+    qemu_co_mutex_lock(&s->lock);
+    while (sector_num < s->total_sectors && s->ret == -EINPROGRESS) {
+        enum ImgConvertBlockStatus status;
+        int n, i;
+
+        if (s->status_count == CONVERT_STATUS_AHEAD) {
+            qemu_co_queue_wait(&s->status_space, &s->lock);
+            continue;
+        }
+
+        qemu_co_mutex_unlock(&s->lock);
+        WITH_GRAPH_RDLOCK_GUARD() {
+            ret = convert_block_status(s, sector_num, &n, &status);
+        }
+        qemu_co_mutex_lock(&s->lock);
+        if (ret < 0) {
+            break;
+        }
+
+        i = (s->status_first + s->status_count) % CONVERT_STATUS_AHEAD;
+        s->status_ahead[i] = (ConvertExtent) {
+            .sector_num = sector_num,
+            .n = n,
+            .status = status,
+        };
+        s->status_count++;
+        sector_num += n;
+        qemu_co_queue_restart_all(&s->status_avail);
+    }
+
+    /* Copy coroutines that still wait after an error get it, too */
+    if (ret < 0) {
+        s->status_ret = ret;
+    } else if (s->ret != -EINPROGRESS) {
+        s->status_ret = s->ret;
+    }
+    s->status_running = false;
+    qemu_co_queue_restart_all(&s->status_avail);
+    qemu_co_mutex_unlock(&s->lock);
+}
+
+static int coroutine_mixed_fn GRAPH_RDLOCK
+convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
+{
+    int n;
+
+    if (s->sector_next_status <= sector_num) {
+        enum ImgConvertBlockStatus status;
+        int ret;
+
+        if (s->num_threads && qemu_in_coroutine()) {
+            ret = convert_co_block_status_ahead(s, sector_num, &n, &status);
         } else {
-            s->status = s->target_has_backing ? BLK_BACKING_FILE : BLK_DATA;
+            ret = convert_block_status(s, sector_num, &n, &status);
+        }
+        if (ret < 0) {
+            return ret;
         }
 
+        s->status = status;
         s->sector_next_status = sector_num + n;
     }
 
-    n = MIN(n, s->sector_next_status - sector_num);
+    n = s->sector_next_status - sector_num;
     if (s->status == BLK_DATA) {
         n = MIN(n, s->buf_sectors);
     }
@@ -1874,6 +2029,39 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
 }
 
 
+typedef struct ConvertCheckData {
+    ImgConvertState *s;
+    const uint8_t *buf;
+    int n;
+    int64_t sector_num;
+} ConvertCheckData;
+
+/*
+ * Return whether the first d->n sectors of d->buf must be written as data
+ * rather than as zeroes, and update d->n to the number of sectors at the
+ * start of the buffer for which that is the case.
+ */
+static int convert_check_data(void *opaque)
+{
+    ConvertCheckData *d = opaque;
+    ImgConvertState *s = d->s;
+
+    /* If we're told to keep the target fully allocated (-S 0) or there
+     * is real non-zero data, we must write it. Otherwise we can treat
+     * it as zero sectors.
+     * Compressed clusters need to be written as a whole, so in that
+     * case we can only save the write if the buffer is completely
+     * zeroed. */
+    if (!s->min_sparse) {
+        return true;
+    }
+    if (s->compressed) {
+        return !buffer_is_zero(d->buf, d->n * BDRV_SECTOR_SIZE);
+    }
+    return is_allocated_sectors_min(d->buf, d->n, &d->n, s->min_sparse,
+                                    d->sector_num, s->alignment);
+}
+
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
                                          enum ImgConvertBlockStatus status)
@@ -1883,6 +2071,8 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
     while (nb_sectors > 0) {
         int n = nb_sectors;
         BdrvRequestFlags flags = s->compressed ? BDRV_REQ_WRITE_COMPRESSED : 0;
+        ConvertCheckData d;
+        bool is_data;
 
         switch (status) {
         case BLK_BACKING_FILE:
@@ -1893,19 +2083,21 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
             break;
 
         case BLK_DATA:
-            /* If we're told to keep the target fully allocated (-S 0) or there
-             * is real non-zero data, we must write it. Otherwise we can treat
-             * it as zero sectors.
-             * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
-            if (!s->min_sparse ||
-                (!s->compressed &&
-                 is_allocated_sectors_min(buf, n, &n, s->min_sparse,
-                                          sector_num, s->alignment)) ||
-                (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
-            {
+            d = (ConvertCheckData) {
+                .s = s,
+                .buf = buf,
+                .n = n,
+                .sector_num = sector_num,
+            };
+            /* Scanning the buffer for zeroes is worth a thread of its own */
+            if (s->num_threads && s->min_sparse) {
+                is_data = thread_pool_submit_co(convert_check_data, &d);
+            } else {
+                is_data = convert_check_data(&d);
+            }
+            n = d.n;
+
+            if (is_data) {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
                 if (ret < 0) {
@@ -2086,9 +2278,13 @@ retry:
     qemu_vfree(buf);
     s->co[index] = NULL;
     s->running_coroutines--;
-    if (!s->running_coroutines && s->ret == -EINPROGRESS) {
-        /* the convert job finished successfully */
-        s->ret = 0;
+    if (!s->running_coroutines) {
+        if (s->ret == -EINPROGRESS) {
+            /* the convert job finished successfully */
+            s->ret = 0;
+        }
+        /* let the block status coroutine see that it can stop */
+        qemu_co_queue_restart_all(&s->status_space);
     }
 }
 
@@ -2134,13 +2330,19 @@ static int convert_do_copy(ImgConvertState *s)
     s->ret = -EINPROGRESS;
 
     qemu_co_mutex_init(&s->lock);
+    qemu_co_queue_init(&s->status_avail);
+    qemu_co_queue_init(&s->status_space);
+    if (s->num_threads) {
+        s->status_running = true;
+        qemu_coroutine_enter(qemu_coroutine_create(convert_co_status_ahead, s));
+    }
     for (i = 0; i < s->num_coroutines; i++) {
         s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
         s->wait_sector_num[i] = -1;
         qemu_coroutine_enter(s->co[i]);
     }
 
-    while (s->running_coroutines) {
+    while (s->running_coroutines || s->status_running) {
         main_loop_wait(false);
     }
 
@@ -2253,6 +2455,7 @@ static int img_convert(int argc, char **argv)
     bool explict_min_sparse = false;
     bool bitmaps = false;
     bool skip_broken = false;
+    bool explicit_num_coroutines = false;
     int64_t rate_limit = 0;
 
     ImgConvertState s = (ImgConvertState) {
@@ -2275,6 +2478,7 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"threads", required_argument, 0, OPTION_THREADS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:CcF:o:l:S:pt:T:qnm:WUr:",
@@ -2370,6 +2574,7 @@ static int img_convert(int argc, char **argv)
                              " coroutines is between 1 and %d", MAX_COROUTINES);
                 goto fail_getopt;
             }
+            explicit_num_coroutines = true;
             break;
         case 'W':
             s.wr_in_order = false;
@@ -2409,6 +2614,13 @@ static int img_convert(int argc, char **argv)
         case OPTION_SKIP_BROKEN:
             skip_broken = true;
             break;
+        case OPTION_THREADS:
+            if (qemu_strtoi(optarg, NULL, 0, &s.num_threads) ||
+                s.num_threads < 1) {
+                error_report("Invalid number of threads: '%s'", optarg);
+                goto fail_getopt;
+            }
+            break;
         }
     }
 
@@ -2416,6 +2628,12 @@ static int img_convert(int argc, char **argv)
         out_fmt = "raw";
     }
 
+    if (s.num_threads && !explicit_num_coroutines) {
+        /* Keep all threads busy while other requests wait for I/O */
+        s.num_coroutines = MIN(MAX(s.num_coroutines, 2 * s.num_threads),
+                               MAX_COROUTINES);
+    }
+
     if (skip_broken && !bitmaps) {
         error_report("Use of --skip-broken-bitmaps requires --bitmaps");
         goto fail_getopt;
@@ -2783,6 +3001,11 @@ static int img_convert(int argc, char **argv)
         set_rate_limit(s.target, rate_limit);
     }
 
+    if (s.num_threads) {
+        aio_context_set_thread_pool_params(qemu_get_aio_context(), 0,
+                                           s.num_threads, &error_abort);
+    }
+
     ret = convert_do_copy(&s);
 
     /* Now copy the bitmaps */
@@ -4412,10 +4635,37 @@ out_no_progress:
     return 0;
 }
 
-typedef struct BenchData {
+/*
+ * Latency histogram with a relative error of at most 1/BENCH_HIST_SUB:
+ * values below BENCH_HIST_SUB nanoseconds have a bucket each, and every
+ * power of two above is split into BENCH_HIST_SUB buckets.
+ */
+#define BENCH_HIST_SUB_BITS 4
+#define BENCH_HIST_SUB (1 << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_BUCKETS ((64 - BENCH_HIST_SUB_BITS + 1) * BENCH_HIST_SUB)
+
+typedef struct BenchHistogram {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t buckets[BENCH_HIST_BUCKETS];
+} BenchHistogram;
+
+typedef struct BenchData BenchData;
+
+typedef struct BenchRequest {
+    BenchData *b;
+    QEMUIOVector *qiov;
+    bool write;
+    int64_t start_ns;
+} BenchRequest;
+
+struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
-    bool write;
+    int write_percent;
+    int random_percent;
     int bufsize;
     int step;
     int nrreq;
@@ -4423,12 +4673,93 @@ typedef struct BenchData {
     int flush_interval;
     bool drain_on_flush;
     uint8_t *buf;
+    size_t buf_size;
     QEMUIOVector *qiov;
 
+    /* Only used with --jobs */
+    AioContext *ctx;
+    QemuThread thread;
+    int *jobs_running;
+
+    GRand *rand;
+    BenchRequest *reqs;
+    int *free_reqs;
+    int nr_free_reqs;
+    BenchHistogram hist[2]; /* indexed by BenchRequest.write */
+
     int in_flight;
     bool in_flush;
     uint64_t offset;
-} BenchData;
+};
+
+static int bench_hist_index(uint64_t ns)
+{
+    int k;
+
+    if (ns < BENCH_HIST_SUB) {
+        return ns;
+    }
+    k = 63 - clz64(ns);
+    return ((k - BENCH_HIST_SUB_BITS + 1) << BENCH_HIST_SUB_BITS) |
+           ((ns >> (k - BENCH_HIST_SUB_BITS)) & (BENCH_HIST_SUB - 1));
+}
+
+/* Lowest value that falls into bucket @index */
+static uint64_t bench_hist_value(int index)
+{
+    int k;
+
+    if (index < BENCH_HIST_SUB) {
+        return index;
+    }
+    k = (index >> BENCH_HIST_SUB_BITS) + BENCH_HIST_SUB_BITS - 1;
+    return (uint64_t)(BENCH_HIST_SUB | (index & (BENCH_HIST_SUB - 1)))
+           << (k - BENCH_HIST_SUB_BITS);
+}
+
+static void bench_hist_add(BenchHistogram *h, uint64_t ns)
+{
+    if (!h->count || ns < h->min_ns) {
+        h->min_ns = ns;
+    }
+    h->max_ns = MAX(h->max_ns, ns);
+    h->count++;
+    h->sum_ns += ns;
+    h->buckets[bench_hist_index(ns)]++;
+}
+
+static void bench_hist_merge(BenchHistogram *dst, const BenchHistogram *src)
+{
+    int i;
+
+    if (!src->count) {
+        return;
+    }
+    if (!dst->count || src->min_ns < dst->min_ns) {
+        dst->min_ns = src->min_ns;
+    }
+    dst->max_ns = MAX(dst->max_ns, src->max_ns);
+    dst->count += src->count;
+    dst->sum_ns += src->sum_ns;
+    for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+static uint64_t bench_hist_percentile(const BenchHistogram *h, double percent)
+{
+    uint64_t rank = h->count * percent / 100;
+    uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            return MIN(MAX(bench_hist_value(i), h->min_ns), h->max_ns);
+        }
+    }
+    return h->max_ns;
+}
 
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
@@ -4438,6 +4769,8 @@ static void bench_undrained_flush_cb(void *opaque, int ret)
     }
 }
 
+static void bench_request_cb(void *opaque, int ret);
+
 static void bench_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
@@ -4483,7 +4816,22 @@ static void bench_cb(void *opaque, int ret)
     }
 
     while (b->n > b->in_flight && b->in_flight < b->nrreq) {
+        BenchRequest *req = &b->reqs[b->free_reqs[--b->nr_free_reqs]];
         int64_t offset = b->offset;
+
+        if (b->random_percent &&
+            (b->random_percent == 100 ||
+             g_rand_int_range(b->rand, 0, 100) < b->random_percent)) {
+            uint64_t nr_blocks = MAX(b->image_size / b->bufsize, 1);
+            uint64_t r = ((uint64_t)g_rand_int(b->rand) << 32) |
+                         g_rand_int(b->rand);
+
+            offset = (r % nr_blocks) * b->bufsize;
+        }
+        req->write = b->write_percent &&
+                     (b->write_percent == 100 ||
+                      g_rand_int_range(b->rand, 0, 100) < b->write_percent);
+
         /* blk_aio_* might look for completed I/Os and kick bench_cb
          * again, so make sure this operation is counted by in_flight
          * and b->offset is ready for the next submission.
@@ -4495,10 +4843,13 @@ static void bench_cb(void *opaque, int ret)
         } else {
             b->offset %= b->image_size - b->bufsize;
         }
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        req->start_ns = get_clock();
+        if (req->write) {
+            acb = blk_aio_pwritev(b->blk, offset, req->qiov, 0,
+                                  bench_request_cb, req);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_preadv(b->blk, offset, req->qiov, 0,
+                                 bench_request_cb, req);
         }
         if (!acb) {
             error_report("Failed to issue request");
@@ -4507,15 +4858,90 @@ static void bench_cb(void *opaque, int ret)
     }
 }
 
+static void bench_request_cb(void *opaque, int ret)
+{
+    BenchRequest *req = opaque;
+    BenchData *b = req->b;
+
+    bench_hist_add(&b->hist[req->write], get_clock() - req->start_ns);
+    b->free_reqs[b->nr_free_reqs++] = req - b->reqs;
+    bench_cb(b, ret);
+}
+
+/* Runs one job of --jobs in its own thread and AioContext */
+static void *bench_job_thread(void *opaque)
+{
+    BenchData *b = opaque;
+
+    rcu_register_thread();
+    qemu_set_current_aio_context(b->ctx);
+
+    bench_cb(b, 0);
+    while (b->n > 0) {
+        aio_poll(b->ctx, true);
+    }
+
+    /* Wake up the main loop, which waits for all jobs to complete */
+    qatomic_dec(b->jobs_running);
+    qemu_notify_event();
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void bench_print_human(const char *op, const BenchHistogram *h,
+                              double secs)
+{
+    if (!h->count) {
+        return;
+    }
+    printf("%-5s %" PRIu64 " requests, %.0f IOPS, latency (us): "
+           "avg %.1f, p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+           op, h->count, secs > 0 ? h->count / secs : 0,
+           (double)h->sum_ns / h->count / 1000,
+           bench_hist_percentile(h, 50) / 1000.0,
+           bench_hist_percentile(h, 99) / 1000.0,
+           bench_hist_percentile(h, 99.9) / 1000.0,
+           h->max_ns / 1000.0);
+}
+
+static QDict *bench_result_json(const BenchHistogram *h, int bufsize,
+                                double secs)
+{
+    QDict *result = qdict_new();
+    QDict *latency = qdict_new();
+
+    qdict_put_int(latency, "min", h->min_ns);
+    qdict_put_int(latency, "mean", h->sum_ns / h->count);
+    qdict_put_int(latency, "p50", bench_hist_percentile(h, 50));
+    qdict_put_int(latency, "p99", bench_hist_percentile(h, 99));
+    qdict_put_int(latency, "p99.9", bench_hist_percentile(h, 99.9));
+    qdict_put_int(latency, "max", h->max_ns);
+
+    qdict_put_int(result, "requests", h->count);
+    qdict_put(result, "iops",
+              qnum_from_double(secs > 0 ? h->count / secs : 0));
+    qdict_put(result, "bytes-per-second",
+              qnum_from_double(secs > 0 ? h->count * bufsize / secs : 0));
+    qdict_put(result, "latency-ns", latency);
+    return result;
+}
+
 static int img_bench(int argc, char **argv)
 {
     int c, ret = 0;
     const char *fmt = NULL, *filename;
+    const char *output = NULL;
+    OutputFormat output_format = OFORMAT_HUMAN;
     bool quiet = false;
     bool image_opts = false;
     bool is_write = false;
+    int read_percent = -1;
+    int random_percent = 0;
     int count = 75000;
     int depth = 64;
+    int nr_jobs = 1;
+    int jobs_running = 0;
     int64_t offset = 0;
     size_t bufsize = 4096;
     int pattern = 0;
@@ -4524,13 +4950,14 @@ static int img_bench(int argc, char **argv)
     bool drain_on_flush = true;
     int64_t image_size;
     BlockBackend *blk = NULL;
-    BenchData data = {};
+    BenchData *jobs = NULL;
+    BenchHistogram *hist = NULL;
     int flags = 0;
     bool writethrough = false;
     struct timeval t1, t2;
-    int i;
+    double secs;
+    int i, j;
     bool force_share = false;
-    size_t buf_size = 0;
 
     for (;;) {
         static const struct option long_options[] = {
@@ -4540,6 +4967,10 @@ static int img_bench(int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"rw-mix", required_argument, 0, OPTION_RW_MIX},
+            {"random", required_argument, 0, OPTION_RANDOM},
+            {"jobs", required_argument, 0, OPTION_JOBS},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options,
@@ -4639,7 +5070,6 @@ static int img_bench(int argc, char **argv)
             }
             break;
         case 'w':
-            flags |= BDRV_O_RDWR;
             is_write = true;
             break;
         case 'U':
@@ -4673,6 +5103,29 @@ static int img_bench(int argc, char **argv)
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
+        case OPTION_RW_MIX:
+            if (qemu_strtoi(optarg, NULL, 0, &read_percent) ||
+                read_percent < 0 || read_percent > 100) {
+                error_report("Invalid read percentage specified");
+                return 1;
+            }
+            break;
+        case OPTION_RANDOM:
+            if (qemu_strtoi(optarg, NULL, 0, &random_percent) ||
+                random_percent < 0 || random_percent > 100) {
+                error_report("Invalid random percentage specified");
+                return 1;
+            }
+            break;
+        case OPTION_JOBS:
+            if (qemu_strtoi(optarg, NULL, 0, &nr_jobs) || nr_jobs < 1) {
+                error_report("Invalid number of jobs specified");
+                return 1;
+            }
+            break;
+        case OPTION_OUTPUT:
+            output = optarg;
+            break;
         }
     }
 
@@ -4681,8 +5134,28 @@ static int img_bench(int argc, char **argv)
     }
     filename = argv[argc - 1];
 
-    if (!is_write && flush_interval) {
-        error_report("--flush-interval is only available in write tests");
+    if (output && !strcmp(output, "json")) {
+        output_format = OFORMAT_JSON;
+    } else if (output && !strcmp(output, "human")) {
+        output_format = OFORMAT_HUMAN;
+    } else if (output) {
+        error_report("--output must be used with human or json as argument.");
+        return 1;
+    }
+
+    if (is_write && read_percent >= 0) {
+        error_report("-w and --rw-mix are mutually exclusive");
+        return 1;
+    }
+    if (read_percent < 0) {
+        read_percent = is_write ? 0 : 100;
+    }
+    if (read_percent < 100) {
+        flags |= BDRV_O_RDWR;
+    }
+
+    if (read_percent == 100 && flush_interval) {
+        error_report("--flush-interval is only available in tests with writes");
         ret = -1;
         goto out;
     }
@@ -4705,56 +5178,168 @@ static int img_bench(int argc, char **argv)
         goto out;
     }
 
-    data = (BenchData) {
-        .blk            = blk,
-        .image_size     = image_size,
-        .bufsize        = bufsize,
-        .step           = step ?: bufsize,
-        .nrreq          = depth,
-        .n              = count,
-        .offset         = offset,
-        .write          = is_write,
-        .flush_interval = flush_interval,
-        .drain_on_flush = drain_on_flush,
-    };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
-    }
+    if (output_format == OFORMAT_HUMAN) {
+        if (read_percent == 0 || read_percent == 100) {
+            printf("Sending %d %s requests, %d bytes each, %d in parallel "
+                   "(starting at offset %" PRId64 ", step size %d)\n",
+                   count, read_percent ? "read" : "write", (int)bufsize,
+                   depth, offset, (int)(step ?: bufsize));
+        } else {
+            printf("Sending %d requests (%d%% reads), %d bytes each, "
+                   "%d in parallel (starting at offset %" PRId64
+                   ", step size %d)\n",
+                   count, read_percent, (int)bufsize, depth, offset,
+                   (int)(step ?: bufsize));
+        }
+        if (random_percent) {
+            printf("Sending %d%% of requests to random offsets\n",
+                   random_percent);
+        }
+        if (nr_jobs > 1) {
+            printf("Running %d jobs in parallel, each in its own thread\n",
+                   nr_jobs);
+        }
+        if (flush_interval) {
+            printf("Sending flush every %d requests\n", flush_interval);
+        }
+    }
+
+    jobs = g_new0(BenchData, nr_jobs);
+    for (j = 0; j < nr_jobs; j++) {
+        BenchData *b = &jobs[j];
+        /* Spread sequential jobs evenly over the image */
+        uint64_t job_offset = offset +
+            QEMU_ALIGN_DOWN(image_size / nr_jobs, bufsize) * j;
+
+        *b = (BenchData) {
+            .blk            = blk,
+            .image_size     = image_size,
+            .bufsize        = bufsize,
+            .step           = step ?: bufsize,
+            .nrreq          = depth,
+            .n              = count,
+            .offset         = j == 0 ? offset :
+                              image_size > bufsize ?
+                              job_offset % (image_size - bufsize) : 0,
+            .write_percent  = 100 - read_percent,
+            .random_percent = random_percent,
+            .flush_interval = flush_interval,
+            .drain_on_flush = drain_on_flush,
+            /* Fixed seeds, so that runs can be compared */
+            .rand           = g_rand_new_with_seed(j + 1),
+            .jobs_running   = &jobs_running,
+        };
 
-    buf_size = data.nrreq * data.bufsize;
-    data.buf = blk_blockalign(blk, buf_size);
-    memset(data.buf, pattern, data.nrreq * data.bufsize);
+        b->buf_size = b->nrreq * b->bufsize;
+        b->buf = blk_blockalign(blk, b->buf_size);
+        memset(b->buf, pattern, b->buf_size);
 
-    blk_register_buf(blk, data.buf, buf_size, &error_fatal);
+        blk_register_buf(blk, b->buf, b->buf_size, &error_fatal);
 
-    data.qiov = g_new(QEMUIOVector, data.nrreq);
-    for (i = 0; i < data.nrreq; i++) {
-        qemu_iovec_init(&data.qiov[i], 1);
-        qemu_iovec_add(&data.qiov[i],
-                       data.buf + i * data.bufsize, data.bufsize);
+        b->qiov = g_new(QEMUIOVector, b->nrreq);
+        b->reqs = g_new(BenchRequest, b->nrreq);
+        b->free_reqs = g_new(int, b->nrreq);
+        for (i = 0; i < b->nrreq; i++) {
+            qemu_iovec_init(&b->qiov[i], 1);
+            qemu_iovec_add(&b->qiov[i],
+                           b->buf + i * b->bufsize, b->bufsize);
+            b->reqs[i] = (BenchRequest) {
+                .b      = b,
+                .qiov   = &b->qiov[i],
+            };
+            b->free_reqs[i] = b->nrreq - 1 - i;
+        }
+        b->nr_free_reqs = b->nrreq;
+
+        if (nr_jobs > 1) {
+            b->ctx = aio_context_new(&error_fatal);
+        }
     }
 
     gettimeofday(&t1, NULL);
-    bench_cb(&data, 0);
-
-    while (data.n > 0) {
-        main_loop_wait(false);
+    if (nr_jobs == 1) {
+        bench_cb(&jobs[0], 0);
+        while (jobs[0].n > 0) {
+            main_loop_wait(false);
+        }
+    } else {
+        /*
+         * Keep the main loop running: the image may still depend on it,
+         * for example for timers of the block driver.
+         */
+        jobs_running = nr_jobs;
+        for (j = 0; j < nr_jobs; j++) {
+            qemu_thread_create(&jobs[j].thread, "bench-job", bench_job_thread,
+                               &jobs[j], QEMU_THREAD_JOINABLE);
+        }
+        while (qatomic_read(&jobs_running) > 0) {
+            main_loop_wait(false);
+        }
+        for (j = 0; j < nr_jobs; j++) {
+            qemu_thread_join(&jobs[j].thread);
+        }
     }
     gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    secs = (t2.tv_sec - t1.tv_sec)
+           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000);
+
+    hist = g_new0(BenchHistogram, 2);
+    for (j = 0; j < nr_jobs; j++) {
+        bench_hist_merge(&hist[false], &jobs[j].hist[false]);
+        bench_hist_merge(&hist[true], &jobs[j].hist[true]);
+    }
+
+    if (output_format == OFORMAT_HUMAN) {
+        printf("Run completed in %3.3f seconds.\n", secs);
+        bench_print_human("read", &hist[false], secs);
+        bench_print_human("write", &hist[true], secs);
+    } else {
+        QDict *result = qdict_new();
+        GString *str;
+
+        qdict_put(result, "seconds", qnum_from_double(secs));
+        qdict_put_int(result, "jobs", nr_jobs);
+        qdict_put_int(result, "depth", depth);
+        qdict_put_int(result, "buffer-size", bufsize);
+        if (hist[false].count) {
+            qdict_put(result, "read",
+                      bench_result_json(&hist[false], bufsize, secs));
+        }
+        if (hist[true].count) {
+            qdict_put(result, "write",
+                      bench_result_json(&hist[true], bufsize, secs));
+        }
+
+        str = qobject_to_json_pretty(QOBJECT(result), true);
+        printf("%s\n", str->str);
+        g_string_free(str, true);
+        qobject_unref(result);
+    }
 
 out:
-    if (data.buf) {
-        blk_unregister_buf(blk, data.buf, buf_size);
+    for (j = 0; jobs && j < nr_jobs; j++) {
+        BenchData *b = &jobs[j];
+
+        if (b->buf) {
+            blk_unregister_buf(blk, b->buf, b->buf_size);
+            for (i = 0; i < b->nrreq; i++) {
+                qemu_iovec_destroy(&b->qiov[i]);
+            }
+        }
+        if (b->ctx) {
+            aio_context_unref(b->ctx);
+        }
+        if (b->rand) {
+            g_rand_free(b->rand);
+        }
+        qemu_vfree(b->buf);
+        g_free(b->qiov);
+        g_free(b->reqs);
+        g_free(b->free_reqs);
     }
-    qemu_vfree(data.buf);
+    g_free(jobs);
+    g_free(hist);
     blk_unref(blk);
 
     if (ret) {
@@ -227,6 +227,7 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
+    "                huge-pages=on|off (back the TCG translation block cache with huge pages)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
@@ -268,6 +269,14 @@ SRST
         such a case this will default on. On other operating systems, this
         will default off, but one may enable this for testing or debugging.
 
+    ``huge-pages=on|off``
+        Back the TCG translation block cache with explicit (hugetlb)
+        huge pages, which reduces host TLB misses while executing
+        translated code.  The pages must have been reserved, e.g. with
+        ``/proc/sys/vm/nr_hugepages``; otherwise QEMU warns and falls
+        back to transparent huge pages, which it requests in any case.
+        Explicit huge pages are not used with ``split-wx=on``.
+
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
@@ -1426,6 +1435,31 @@ SRST
             Specifies the AIO backend (threads/native/io_uring,
             default: threads)
 
+        ``aio-fixed-buffers``
+            With aio=io_uring, register guest RAM with the kernel as
+            fixed buffers, so that it is not pinned and unpinned for
+            every request.  This keeps all of guest RAM pinned and
+            cannot be combined with features that discard guest RAM,
+            like virtio-mem.  (on/off, default: off)
+
+        ``aio-sqpoll``
+            With aio=io_uring, let a kernel thread pick up requests from
+            the ring, so that submitting them usually does not need a
+            system call.  The thread keeps polling for 10 ms after the
+            last request.  (on/off, default: off)
+
+        ``aio-sqpoll-cpu``
+            Pin the kernel thread of aio-sqpoll to this host CPU.
+
+        ``aio-iopoll``
+            With aio=io_uring, busy-poll the device for completions
+            instead of waiting for interrupts.  This requires
+            cache.direct=on and a host block device with poll queues,
+            or a file system that supports polled I/O.  Completions are
+            polled as part of the event loop's adaptive polling, and
+            the event loop does not sleep while requests are in flight.
+            (on/off, default: off)
+
         ``locking``
             Specifies whether the image file is protected with Linux OFD
             / POSIX locks. The default is to use the Linux Open File
@@ -1534,6 +1568,13 @@ SRST
             images directly on block devices), you should consider enabling
             this option.
 
+        ``chain-index``
+            Whether to keep an index of which layer of the backing chain
+            each area that is unallocated in the image is read from, so
+            that reads go directly to the layer that stores the data
+            instead of passing through every layer above it. This helps
+            with deep backing chains (on/off; default: off)
+
         ``overlap-check``
             Which overlap checks to perform for writes to the image
             (none/constant/cached/all; default: cached). For details or
@@ -41,6 +41,9 @@
 #ifdef CONFIG_USER_ONLY
 #include "user/page-protection.h"
 #endif
+#ifdef CONFIG_LINUX_USER
+#include "linux-user/libcall.h"
+#endif
 #include "vec_internal.h"
 
 /* C2.4.7 Multiply and divide */
@@ -1772,3 +1775,19 @@ void HELPER(guarded_page_br)(CPUARMState *env, target_ulong pc)
      */
     env->btype = is_guarded_page(env, pc, GETPC()) ? 3 : 1;
 }
+
+#ifdef CONFIG_LINUX_USER
+/*
+ * Called in place of the first instruction of a recognised routine.
+ * The arguments are in X0-X2; the result goes in X0.
+ */
+void HELPER(libcall)(CPUARMState *env, uint32_t kind)
+{
+    env->xregs[0] = libcall_exec(env, kind, env->xregs[0], env->xregs[1],
+                                 env->xregs[2], GETPC());
+
+    /* Emulate a ret instruction. */
+    env->pc = env->xregs[30];
+    env->btype = 0;
+}
+#endif
@@ -24,6 +24,9 @@
 #include "arm_ldst.h"
 #include "semihosting/semihost.h"
 #include "cpregs.h"
+#ifdef CONFIG_LINUX_USER
+#include "linux-user/libcall.h"
+#endif
 
 static TCGv_i64 cpu_X[32];
 static TCGv_i64 cpu_pc;
@@ -10246,6 +10249,26 @@ static void aarch64_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
         return;
     }
 
+#ifdef CONFIG_LINUX_USER
+    /*
+     * Replace a guest libc routine with its host implementation.
+     * These are only entered by call, so check just the start of a TB.
+     * The host code does not check MTE tags, so leave it alone then.
+     */
+    if (s->base.num_insns == 1 && !s->mte_active[0]) {
+        LibcallKind kind = libcall_lookup(pc);
+
+        if (kind != LIBCALL_NONE) {
+            s->pc_curr = pc;
+            gen_helper_libcall(tcg_env, tcg_constant_i32(kind));
+            s->pc_save = -1;
+            s->base.pc_next = pc + 4;
+            s->base.is_jmp = DISAS_JUMP;
+            return;
+        }
+    }
+#endif
+
     s->pc_curr = pc;
     insn = arm_ldl_code(env, &s->base, pc, s->sctlr_b);
     s->insn = insn;
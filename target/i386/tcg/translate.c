@@ -34,6 +34,9 @@
 #include "decode-new.h"
 
 #include "exec/log.h"
+#ifdef CONFIG_LINUX_USER
+#include "linux-user/libcall.h"
+#endif
 
 #define HELPER_H "helper.h"
 #include "exec/helper-info.c.inc"
@@ -3835,6 +3838,25 @@ static void i386_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
     }
 #endif
 
+#if defined(CONFIG_LINUX_USER) && defined(TARGET_X86_64)
+    /*
+     * Replace a guest libc routine with its host implementation.
+     * These are only entered by call, so check just the start of a TB.
+     */
+    if (dc->base.num_insns == 1 && CODE64(dc)) {
+        LibcallKind kind = libcall_lookup(dc->base.pc_next);
+
+        if (kind != LIBCALL_NONE) {
+            gen_update_cc_op(dc);
+            gen_helper_libcall(tcg_env, tcg_constant_i32(kind));
+            dc->pc_save = -1;
+            dc->base.pc_next += 1;
+            dc->base.is_jmp = DISAS_JUMP;
+            return;
+        }
+    }
+#endif
+
     switch (sigsetjmp(dc->jmpbuf, 0)) {
     case 0:
         disas_insn(dc, cpu);
@@ -0,0 +1,33 @@
+/*
+ * x86_64 helper for host implementations of guest libc routines
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "exec/helper-proto.h"
+#include "accel/tcg/cpu-ldst.h"
+#include "accel/tcg/getpc.h"
+#include "linux-user/libcall.h"
+
+/*
+ * Called in place of the first instruction of a recognised routine.
+ * The arguments are in the SysV registers; the result goes in RAX.
+ */
+void helper_libcall(CPUX86State *env, uint32_t kind)
+{
+    uintptr_t ra = GETPC();
+    uint64_t caller;
+
+    /* Read the return address first, so that a fault leaves no trace. */
+    caller = cpu_ldq_data_ra(env, env->regs[R_ESP], ra);
+
+    env->regs[R_EAX] = libcall_exec(env, kind, env->regs[R_EDI],
+                                    env->regs[R_ESI], env->regs[R_EDX], ra);
+
+    /* Emulate a ret instruction. */
+    env->eip = caller;
+    env->regs[R_ESP] += 8;
+}
@@ -29,6 +29,7 @@
 #include "qemu/memalign.h"
 #include "qemu/cacheinfo.h"
 #include "qemu/qtree.h"
+#include "qemu/error-report.h"
 #include "qapi/error.h"
 #include "tcg/tcg.h"
 #include "exec/translation-block.h"
@@ -68,6 +69,8 @@ struct tcg_region_state {
     size_t size; /* size of one region */
     size_t stride; /* .size + guard size */
     size_t total_size; /* size of entire buffer, >= n * stride */
+    bool hugetlb; /* backed by explicit huge pages, without guard pages */
+    bool thp; /* transparent huge pages requested */
 
     /* fields protected by the lock */
     size_t current; /* current region index */
@@ -500,7 +503,8 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_threads)
 static uint8_t static_code_gen_buffer[DEFAULT_CODE_GEN_BUFFER_SIZE]
     __attribute__((aligned(CODE_GEN_ALIGN)));
 
-static int alloc_code_gen_buffer(size_t tb_size, int splitwx, Error **errp)
+static int alloc_code_gen_buffer(size_t tb_size, int splitwx,
+                                 bool huge_pages, Error **errp)
 {
     void *buf, *end;
     size_t size;
@@ -509,6 +513,9 @@ static int alloc_code_gen_buffer(size_t tb_size, int splitwx, Error **errp)
         error_setg(errp, "jit split-wx not supported");
         return -1;
     }
+    if (huge_pages) {
+        warn_report("huge pages are not supported for the jit buffer");
+    }
 
     /* page-align the beginning and end of the buffer */
     buf = static_code_gen_buffer;
@@ -529,7 +536,8 @@ static int alloc_code_gen_buffer(size_t tb_size, int splitwx, Error **errp)
     return PROT_READ | PROT_WRITE;
 }
 #elif defined(_WIN32)
-static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
+static int alloc_code_gen_buffer(size_t size, int splitwx,
+                                 bool huge_pages, Error **errp)
 {
     void *buf;
 
@@ -537,6 +545,9 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
         error_setg(errp, "jit split-wx not supported");
         return -1;
     }
+    if (huge_pages) {
+        warn_report("huge pages are not supported for the jit buffer");
+    }
 
     buf = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT,
                              PAGE_EXECUTE_READWRITE);
@@ -555,14 +566,37 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
 static int alloc_code_gen_buffer_anon(size_t size, int prot,
                                       int flags, Error **errp)
 {
-    void *buf;
+    size_t align = QEMU_VMALLOC_ALIGN;
+    void *buf, *aligned;
 
-    buf = mmap(NULL, size, prot, flags, -1, 0);
+#ifdef MAP_HUGETLB
+    if (flags & MAP_HUGETLB) {
+        /* The kernel aligns the mapping to the huge page size. */
+        align = qemu_real_host_page_size();
+    }
+#endif
+
+    /*
+     * Over-allocate so that the buffer can start at a boundary suitable
+     * for transparent huge pages; a huge page cannot be used for a part
+     * of the buffer that does not cover the whole of it.
+     */
+    buf = mmap(NULL, size + align - qemu_real_host_page_size(),
+               prot, flags, -1, 0);
     if (buf == MAP_FAILED) {
         error_setg_errno(errp, errno,
                          "allocate %zu bytes for jit buffer", size);
         return -1;
     }
+    aligned = QEMU_ALIGN_PTR_UP(buf, align);
+    if (aligned > buf) {
+        munmap(buf, aligned - buf);
+    }
+    if (align > qemu_real_host_page_size() + (aligned - buf)) {
+        munmap(aligned + size,
+               align - qemu_real_host_page_size() - (aligned - buf));
+    }
+    buf = aligned;
 
     region.start_aligned = buf;
     region.total_size = size;
@@ -683,7 +717,31 @@ static int alloc_code_gen_buffer_splitwx(size_t size, Error **errp)
     return -1;
 }
 
-static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
+static int alloc_code_gen_buffer_hugetlb(size_t size, Error **errp)
+{
+#ifdef MAP_HUGETLB
+    int prot = PROT_READ | PROT_WRITE;
+
+#ifndef CONFIG_TCG_INTERPRETER
+    prot |= host_prot_read_exec();
+#endif
+    /*
+     * Huge pages cannot be protected individually, so map the buffer
+     * with its final protection; tcg_region_init() omits guard pages.
+     */
+    prot = alloc_code_gen_buffer_anon(size, prot,
+                                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                                      errp);
+    region.hugetlb = prot >= 0;
+    return prot;
+#else
+    error_setg(errp, "huge pages are not supported for the jit buffer");
+    return -1;
+#endif
+}
+
+static int alloc_code_gen_buffer(size_t size, int splitwx,
+                                 bool huge_pages, Error **errp)
 {
     ERRP_GUARD();
     int prot, flags;
@@ -691,6 +749,9 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
     if (splitwx) {
         prot = alloc_code_gen_buffer_splitwx(size, errp);
         if (prot >= 0) {
+            if (huge_pages) {
+                warn_report("jit split-wx uses transparent huge pages only");
+            }
             return prot;
         }
         /*
@@ -703,6 +764,16 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
         error_free_or_abort(errp);
     }
 
+    if (huge_pages) {
+        prot = alloc_code_gen_buffer_hugetlb(size, errp);
+        if (prot >= 0) {
+            return prot;
+        }
+        warn_reportf_err(*errp, "jit buffer falls back to transparent "
+                         "huge pages: ");
+        *errp = NULL;
+    }
+
     /*
      * macOS 11.2 has a bug (Apple Feedback FB8994773) in which mprotect
      * rejects a permission change from RWX -> NONE when reserving the
@@ -746,10 +817,11 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * in practice. Multi-threaded guests share most if not all of their translated
  * code, which makes parallel code generation less appealing than in system-mode
  */
-void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads)
+void tcg_region_init(size_t tb_size, int splitwx, bool huge_pages,
+                     unsigned max_threads)
 {
     const size_t page_size = qemu_real_host_page_size();
-    size_t region_size;
+    size_t region_size, guard_size;
     int have_prot, need_prot;
 
     /* Size the buffer.  */
@@ -769,14 +841,18 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads)
         tb_size = MAX_CODE_GEN_BUFFER_SIZE;
     }
 
-    have_prot = alloc_code_gen_buffer(tb_size, splitwx, &error_fatal);
+    have_prot = alloc_code_gen_buffer(tb_size, splitwx, huge_pages,
+                                      &error_fatal);
     assert(have_prot >= 0);
 
     /* Request large pages for the buffer and the splitwx.  */
-    qemu_madvise(region.start_aligned, region.total_size, QEMU_MADV_HUGEPAGE);
-    if (tcg_splitwx_diff) {
-        qemu_madvise(region.start_aligned + tcg_splitwx_diff,
-                     region.total_size, QEMU_MADV_HUGEPAGE);
+    if (!region.hugetlb) {
+        region.thp = qemu_madvise(region.start_aligned, region.total_size,
+                                  QEMU_MADV_HUGEPAGE) == 0;
+        if (tcg_splitwx_diff) {
+            qemu_madvise(region.start_aligned + tcg_splitwx_diff,
+                         region.total_size, QEMU_MADV_HUGEPAGE);
+        }
     }
 
     /*
@@ -793,8 +869,9 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads)
     region.stride = region_size;
 
     /* Reserve space for guard pages. */
-    region.size = region_size - page_size;
-    region.total_size -= page_size;
+    guard_size = region.hugetlb ? 0 : page_size;
+    region.size = region_size - guard_size;
+    region.total_size -= guard_size;
 
     /*
      * The first region will be smaller than the others, via the prologue,
@@ -841,9 +918,9 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads)
                                  "mprotect of jit buffer");
             }
         }
-        if (have_prot != 0) {
+        if (have_prot != 0 && guard_size) {
             /* Guard pages are nice for bug detection but are not essential. */
-            (void)qemu_mprotect_none(end, page_size);
+            (void)qemu_mprotect_none(end, guard_size);
         }
     }
 
@@ -916,3 +993,14 @@ size_t tcg_code_capacity(void)
 
     return capacity;
 }
+
+/*
+ * Returns a description of the host pages backing the code buffer.
+ */
+const char *tcg_code_page_type(void)
+{
+    if (region.hugetlb) {
+        return "huge pages";
+    }
+    return region.thp ? "transparent huge pages" : "small pages";
+}
@@ -231,6 +231,46 @@ static void * const qemu_st_helpers[MO_SIZE + 1] __attribute__((unused)) = {
 #endif
 };
 
+/*
+ * Host-endian 4 and 8-byte accesses with the default atomicity are by far
+ * the most common, and have slow path helpers specialized for them.
+ */
+static void * const qemu_ld_he_helpers[MO_SIZE + 1] __attribute__((unused)) = {
+    [MO_32] = helper_ldul_he_mmu,
+    [MO_64] = helper_ldq_he_mmu,
+};
+
+static void * const qemu_st_he_helpers[MO_SIZE + 1] __attribute__((unused)) = {
+    [MO_32] = helper_stl_he_mmu,
+    [MO_64] = helper_stq_he_mmu,
+};
+
+/*
+ * Return the slow path helper for the load @opc, where the backend
+ * takes the result size, and optionally the sign, from @opc & @mask.
+ */
+static inline const void *qemu_ld_helper(MemOp opc, MemOp mask)
+{
+    MemOp size = opc & MO_SIZE;
+
+    if (!(opc & (MO_BSWAP | MO_ATOM_MASK | (mask & MO_SIGN)))
+        && qemu_ld_he_helpers[size]) {
+        return qemu_ld_he_helpers[size];
+    }
+    return qemu_ld_helpers[opc & mask];
+}
+
+/* Return the slow path helper for the store @opc. */
+static inline const void *qemu_st_helper(MemOp opc)
+{
+    MemOp size = opc & MO_SIZE;
+
+    if (!(opc & (MO_BSWAP | MO_ATOM_MASK)) && qemu_st_he_helpers[size]) {
+        return qemu_st_he_helpers[size];
+    }
+    return qemu_st_helpers[size];
+}
+
 typedef struct {
     MemOp atom;   /* lg2 bits of atomicity required */
     MemOp align;  /* lg2 bits of alignment to use */
@@ -1854,10 +1894,11 @@ static void tcg_context_init(unsigned max_threads)
     tcg_env = temp_tcgv_ptr(ts);
 }
 
-void tcg_init(size_t tb_size, int splitwx, unsigned max_threads)
+void tcg_init(size_t tb_size, int splitwx, bool huge_pages,
+              unsigned max_threads)
 {
     tcg_context_init(max_threads);
-    tcg_region_init(tb_size, splitwx, max_threads);
+    tcg_region_init(tb_size, splitwx, huge_pages, max_threads);
 }
 
 /*
@@ -0,0 +1,87 @@
+/*
+ * QEMU HBitmap scanning speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/hbitmap.h"
+#include "qemu/units.h"
+
+/*
+ * Look for the end of a dirty area, as incremental backup and mirror do
+ * with hbitmap_next_dirty_area(), over areas of growing size.
+ */
+static void test_next_zero(const void *opaque)
+{
+    uint64_t max = 64 * MiB;
+    HBitmap *hb = hbitmap_alloc(max + 1, 0);
+    int accel_index = 0;
+
+    hbitmap_set(hb, 0, max);
+    do {
+        if (accel_index != 0) {
+            g_test_message("%s", "");  /* gnu_printf Werror for simple "" */
+        }
+        for (uint64_t len = 64 * KiB; len <= max; len *= 4) {
+            double total = 0.0;
+
+            hbitmap_reset(hb, len, 1);
+            g_test_timer_start();
+            do {
+                g_assert(hbitmap_next_zero(hb, 0, INT64_MAX) == len);
+                total += len;
+            } while (g_test_timer_elapsed() < 0.5);
+            hbitmap_set(hb, len, 1);
+
+            total /= MiB;
+            g_test_message("hbitmap_next_zero #%d: %5" PRIu64 "Kbit "
+                           "%8.0f Mbit/sec", accel_index, len / KiB,
+                           total / g_test_timer_last());
+        }
+        accel_index++;
+    } while (test_hbitmap_find_next_accel());
+
+    hbitmap_free(hb);
+}
+
+/* Iterate over sparse dirty bits, which uses the upper levels.  */
+static void test_next_dirty(const void *opaque)
+{
+    uint64_t size = 256 * MiB;
+    HBitmap *hb = hbitmap_alloc(size, 0);
+
+    for (uint64_t stride = 64; stride <= 64 * KiB; stride *= 16) {
+        double total = 0.0;
+
+        hbitmap_reset_all(hb);
+        for (uint64_t i = 0; i < size; i += stride) {
+            hbitmap_set(hb, i, 1);
+        }
+
+        g_test_timer_start();
+        do {
+            int64_t next = 0;
+
+            while ((next = hbitmap_next_dirty(hb, next, INT64_MAX)) >= 0) {
+                next++;
+            }
+            total += size;
+        } while (g_test_timer_elapsed() < 0.5);
+
+        total /= MiB;
+        g_test_message("hbitmap_next_dirty stride %5" PRIu64 ": "
+                       "%8.0f Mbit/sec", stride, total / g_test_timer_last());
+    }
+
+    hbitmap_free(hb);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/hbitmap/next_dirty/speed", NULL, test_next_dirty);
+    g_test_add_data_func("/hbitmap/next_zero/speed", NULL, test_next_zero);
+    return g_test_run();
+}
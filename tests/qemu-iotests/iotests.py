@@ -693,7 +693,7 @@ def filter_img_info(output: str, filename: str,
                       'uuid: XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX',
                       line)
         line = re.sub('cid: [0-9]+', 'cid: XXXXXXXXXX', line)
-        line = re.sub('(compression type: )(zlib|zstd)', r'\1COMPRESSION_TYPE',
+        line = re.sub('(compression type: )(zlib|zstd|lz4)', r'\1COMPRESSION_TYPE',
                       line)
         lines.append(line)
     return '\n'.join(lines)
@@ -0,0 +1,115 @@
+/*
+ * Test the host implementations of libc string routines (-libc-accel).
+ *
+ * The results must match a byte-at-a-time reference, and accesses to
+ * inaccessible pages must still raise SIGSEGV for the guest.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <assert.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static sigjmp_buf jmpbuf;
+static void *fault_addr;
+static volatile size_t result;
+
+static void segv_handler(int sig, siginfo_t *info, void *uc)
+{
+    fault_addr = info->si_addr;
+    siglongjmp(jmpbuf, 1);
+}
+
+static void test_memmove(void)
+{
+    static unsigned char buf[512], ref[512];
+
+    for (size_t len = 0; len < 96; len += 7) {
+        for (int shift = -9; shift <= 9; shift += 3) {
+            for (size_t i = 0; i < sizeof(buf); i++) {
+                buf[i] = ref[i] = i * 7;
+            }
+            memmove(buf + 200 + shift, buf + 200, len);
+            if (shift > 0) {
+                for (size_t i = len; i-- > 0; ) {
+                    ref[200 + shift + i] = ref[200 + i];
+                }
+            } else {
+                for (size_t i = 0; i < len; i++) {
+                    ref[200 + shift + i] = ref[200 + i];
+                }
+            }
+            assert(memcmp(buf, ref, sizeof(buf)) == 0);
+        }
+    }
+}
+
+static void test_memset(void)
+{
+    static unsigned char buf[256];
+
+    memset(buf, 0x5a, sizeof(buf));
+    assert(memset(buf + 3, 0x1a5, 100) == buf + 3);
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        assert(buf[i] == (i >= 3 && i < 103 ? 0xa5 : 0x5a));
+    }
+}
+
+int main(void)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    struct sigaction sa = {
+        .sa_sigaction = segv_handler,
+        .sa_flags = SA_SIGINFO,
+    };
+    char *p;
+    int err;
+
+    test_memmove();
+    test_memset();
+
+    p = mmap(NULL, pagesize * 2, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(p != MAP_FAILED);
+    err = mprotect(p + pagesize, pagesize, PROT_NONE);
+    assert(err == 0);
+    err = sigaction(SIGSEGV, &sa, NULL);
+    assert(err == 0);
+
+    /* A string ending just before an inaccessible page. */
+    memset(p, 'x', pagesize - 1);
+    p[pagesize - 1] = 0;
+    assert(strlen(p) == pagesize - 1);
+    assert(strlen(p + pagesize - 1) == 0);
+
+    /* An unterminated string runs into the inaccessible page. */
+    p[pagesize - 1] = 'x';
+    if (sigsetjmp(jmpbuf, 1) == 0) {
+        result = strlen(p + 16);
+        abort();
+    }
+    assert(fault_addr >= (void *)p && fault_addr < (void *)p + 2 * pagesize);
+
+    /* A store that crosses into the inaccessible page. */
+    if (sigsetjmp(jmpbuf, 1) == 0) {
+        memset(p + pagesize - 8, 0, 16);
+        abort();
+    }
+    assert(fault_addr >= (void *)p && fault_addr < (void *)p + 2 * pagesize);
+
+    /* A copy from a read-only page into itself. */
+    err = mprotect(p, pagesize, PROT_READ);
+    assert(err == 0);
+    if (sigsetjmp(jmpbuf, 1) == 0) {
+        memcpy(p, p + 64, 64);
+        abort();
+    }
+    assert(fault_addr >= (void *)p && fault_addr < (void *)p + pagesize);
+
+    return EXIT_SUCCESS;
+}
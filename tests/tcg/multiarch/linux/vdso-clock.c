@@ -0,0 +1,80 @@
+/*
+ * Test the clocks provided by the vdso against the syscalls.
+ *
+ * Where the vdso computes the time from a data page that QEMU updates,
+ * CLOCK_MONOTONIC must never go backward, also when mixed with the
+ * syscall, and both clocks must stay close to what the kernel reports.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NSEC_PER_SEC  1000000000LL
+
+/* The vdso uses data no older than a second, so allow for that. */
+#define MAX_ERROR_NS  (2 * NSEC_PER_SEC)
+
+static int64_t ts_ns(const struct timespec *ts)
+{
+    return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static int64_t vdso_ns(clockid_t clk)
+{
+    struct timespec ts;
+    int err = clock_gettime(clk, &ts);
+
+    assert(err == 0);
+    assert(ts.tv_nsec >= 0 && ts.tv_nsec < NSEC_PER_SEC);
+    return ts_ns(&ts);
+}
+
+static int64_t syscall_ns(clockid_t clk)
+{
+    struct timespec ts;
+    int err = syscall(SYS_clock_gettime, clk, &ts);
+
+    assert(err == 0);
+    return ts_ns(&ts);
+}
+
+int main(void)
+{
+    int64_t last = 0;
+
+    for (int i = 0; i < 20; i++) {
+        for (int j = 0; j < 1000; j++) {
+            int64_t a = vdso_ns(CLOCK_MONOTONIC);
+            int64_t b = syscall_ns(CLOCK_MONOTONIC);
+            int64_t c = vdso_ns(CLOCK_MONOTONIC);
+
+            assert(last <= a && a <= b + MAX_ERROR_NS && a <= c);
+            assert(c - b < MAX_ERROR_NS);
+            last = c;
+        }
+
+        int64_t real = vdso_ns(CLOCK_REALTIME);
+        int64_t sys = syscall_ns(CLOCK_REALTIME);
+        assert(llabs(real - sys) < MAX_ERROR_NS);
+
+        struct timeval tv;
+        int err = gettimeofday(&tv, NULL);
+        assert(err == 0);
+        assert(tv.tv_usec >= 0 && tv.tv_usec < 1000000);
+        assert(llabs(tv.tv_sec * NSEC_PER_SEC - sys) < MAX_ERROR_NS
+                     + NSEC_PER_SEC);
+        assert(llabs(time(NULL) * NSEC_PER_SEC - sys) < MAX_ERROR_NS
+                     + NSEC_PER_SEC);
+
+        /* Let the data page be updated a few times. */
+        usleep(100 * 1000);
+    }
+
+    return EXIT_SUCCESS;
+}
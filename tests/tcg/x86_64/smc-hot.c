@@ -0,0 +1,75 @@
+/*
+ * Test code that is modified over and over again.
+ *
+ * After a few write faults on the same page, linux-user stops
+ * write-protecting it and lets each translation block verify its code
+ * on entry instead.  Check that modifications are still seen, both
+ * between calls and by the instruction following the store.
+ *
+ * Finally, check that a page whose code is no longer modified is
+ * protected again: the write after the long quiet phase below must
+ * fault, which run-smc-hot checks in the -signal-stats output.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+typedef uint32_t (*func_t)(void);
+
+int main(void)
+{
+    uint8_t *page = mmap(NULL, 4096, PROT_READ | PROT_WRITE | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uint8_t *cold = mmap(NULL, 4096, PROT_READ | PROT_WRITE | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uint8_t *f = page, *g = page + 256;
+    volatile uint32_t *data = (uint32_t *)(page + 2048);
+
+    assert(page != MAP_FAILED && cold != MAP_FAILED);
+
+    /* mov $imm32, %eax; ret */
+    f[0] = 0xb8;
+    f[5] = 0xc3;
+    for (uint32_t i = 0; i < 1000; i++) {
+        memcpy(f + 1, &i, 4);
+        assert(((func_t)f)() == i);
+        /* Data next to the code must not disturb it. */
+        *data = i;
+        assert(((func_t)f)() == i);
+    }
+
+    /*
+     * movb $imm8, 1(%rip); mov $0, %eax; ret
+     * The first insn stores to the low byte of the immediate of the second.
+     */
+    memcpy(g, "\xc6\x05\x01\x00\x00\x00\x00" "\xb8\x00\x00\x00\x00" "\xc3",
+           13);
+    for (uint32_t i = 1; i < 256; i++) {
+        g[6] = i;
+        g[8] = 0;
+        assert(((func_t)g)() == i);
+    }
+
+    /* A burst of modifications makes the page hot... */
+    cold[0] = 0xb8;
+    cold[5] = 0xc3;
+    for (uint32_t i = 0; i < 16; i++) {
+        memcpy(cold + 1, &i, 4);
+        assert(((func_t)cold)() == i);
+    }
+    /* ...a long run without any makes it cold again... */
+    for (uint32_t i = 0; i < 200000; i++) {
+        assert(((func_t)cold)() == 15);
+    }
+    /* ...and modifications are still seen afterwards. */
+    for (uint32_t i = 100; i < 104; i++) {
+        memcpy(cold + 1, &i, 4);
+        assert(((func_t)cold)() == i);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -920,6 +920,26 @@ static void test_hbitmap_next_x_after_truncate(TestHBitmapData *data,
     test_hbitmap_next_x_check(data, 0);
 }
 
+/* Zero bits after runs of full words, for each word scan implementation. */
+static void test_hbitmap_next_x_accel(TestHBitmapData *data,
+                                      const void *unused)
+{
+    int64_t i;
+
+    hbitmap_test_init(data, L3, 0);
+    hbitmap_set(data->hb, 0, L3);
+    do {
+        test_hbitmap_next_x_check(data, 0);
+        for (i = 0; i < L1 * 40; i += L1 - 1) {
+            hbitmap_reset(data->hb, L2 + i, 1);
+            test_hbitmap_next_x_check(data, L2 - 3);
+            test_hbitmap_next_x_check(data, L2 + 1);
+            test_hbitmap_next_x_check_range(data, L2 + 1, i + 1);
+            hbitmap_set(data->hb, L2 + i, 1);
+        }
+    } while (test_hbitmap_find_next_accel());
+}
+
 static void test_hbitmap_next_dirty_area_check_limited(TestHBitmapData *data,
                                                        int64_t offset,
                                                        int64_t count,
@@ -1103,6 +1123,8 @@ int main(int argc, char **argv)
                      test_hbitmap_next_x_4);
     hbitmap_test_add("/hbitmap/next_zero/next_x_after_truncate",
                      test_hbitmap_next_x_after_truncate);
+    hbitmap_test_add("/hbitmap/next_zero/next_x_accel",
+                     test_hbitmap_next_x_accel);
 
     hbitmap_test_add("/hbitmap/next_dirty_area/next_dirty_area_0",
                      test_hbitmap_next_dirty_area_0);
@@ -22,6 +22,8 @@
 #include "qemu/module.h"
 #include "block/throttle-groups.h"
 #include "system/block-backend.h"
+#include "system/cpu-timers.h"
+#include "system/qtest.h"
 
 static AioContext     *ctx;
 static LeakyBucket    bkt;
@@ -30,6 +32,16 @@ static ThrottleGroupMember tgm;
 static ThrottleState  ts;
 static ThrottleTimers *tt;
 
+/* The virtual clock, which the tests advance by hand.  Throttle groups use
+ * it as well, because main() enables qtest.
+ */
+static int64_t virtual_clock_ns;
+
+int64_t cpu_get_clock(void)
+{
+    return virtual_clock_ns;
+}
+
 /* useful function */
 static bool double_cmp(double x, double y)
 {
@@ -734,6 +746,53 @@ static void test_accounting(void)
                                 (64.0 / 13)));
 }
 
+static void test_credit(void)
+{
+    uint64_t bytes, ops;
+
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_BPS_TOTAL].avg = 1000;
+    cfg.buckets[THROTTLE_OPS_READ].avg = 100;
+    throttle_init(&ts);
+    throttle_config(&ts, QEMU_CLOCK_VIRTUAL, &cfg);
+
+    /* without bursts, the buckets hold a tenth of a second of I/O */
+    bytes = ops = 1000;
+    throttle_grant_credit(&ts, THROTTLE_READ, ts.previous_leak, &bytes, &ops);
+    g_assert_cmpint(bytes, ==, 100);
+    g_assert_cmpint(ops, ==, 10);
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_TOTAL].level, 100));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_READ].level, 10));
+
+    /* the credit is all that could go through without waiting */
+    g_assert(!throttle_compute_wait(&ts.cfg.buckets[THROTTLE_BPS_TOTAL]));
+    g_assert(!throttle_compute_wait(&ts.cfg.buckets[THROTTLE_OPS_READ]));
+
+    throttle_return_credit(&ts, THROTTLE_READ, 40, 4);
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_TOTAL].level, 60));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_READ].level, 6));
+
+    /* writes share the total bucket, but have no limit on operations */
+    bytes = ops = 1000;
+    throttle_grant_credit(&ts, THROTTLE_WRITE, ts.previous_leak, &bytes, &ops);
+    g_assert_cmpint(bytes, ==, 40);
+    g_assert_cmpint(ops, ==, 1000);
+
+    /* nothing left */
+    bytes = ops = 1000;
+    throttle_grant_credit(&ts, THROTTLE_READ, ts.previous_leak, &bytes, &ops);
+    g_assert_cmpint(bytes, ==, 0);
+    g_assert_cmpint(ops, ==, 0);
+
+    /* no credit if the number of operations depends on the size */
+    cfg.op_size = 4096;
+    throttle_config(&ts, QEMU_CLOCK_VIRTUAL, &cfg);
+    bytes = ops = 1000;
+    throttle_grant_credit(&ts, THROTTLE_READ, ts.previous_leak, &bytes, &ops);
+    g_assert_cmpint(bytes, ==, 0);
+    g_assert_cmpint(ops, ==, 0);
+}
+
 static void test_groups(void)
 {
     ThrottleConfig cfg1, cfg2;
@@ -801,6 +860,127 @@ static void test_groups(void)
     g_assert(tgm3->throttle_state == NULL);
 }
 
+typedef struct {
+    ThrottleGroupMember *tgm;
+    int64_t bytes;
+    ThrottleDirection direction;
+    bool done;
+} GroupRequest;
+
+static void coroutine_fn group_request_entry(void *opaque)
+{
+    GroupRequest *req = opaque;
+
+    throttle_group_co_io_limits_intercept(req->tgm, req->bytes,
+                                          req->direction);
+    req->done = true;
+}
+
+/* Issue a request of @bytes, and return whether it went through without
+ * waiting.  If it has to wait, @req is needed until req->done is set.
+ */
+static bool group_request(GroupRequest *req, ThrottleGroupMember *tgm,
+                          int64_t bytes, ThrottleDirection direction)
+{
+    *req = (GroupRequest) {
+        .tgm = tgm,
+        .bytes = bytes,
+        .direction = direction,
+    };
+    qemu_coroutine_enter(qemu_coroutine_create(group_request_entry, req));
+    return req->done;
+}
+
+/* Advance the virtual clock until a throttled request has gone through */
+static void group_wait(GroupRequest *req)
+{
+    while (!req->done) {
+        int64_t deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                                      QEMU_TIMER_ATTR_ALL);
+        if (deadline > 0) {
+            virtual_clock_ns += deadline;
+        }
+        aio_poll(ctx, false);
+    }
+}
+
+static void test_group_credit(void)
+{
+    ThrottleConfig cfg1;
+    BlockBackend *blk;
+    ThrottleGroupMember *tgm;
+    GroupRequest req;
+    int64_t burst = 0;
+
+    blk = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    tgm = &blk_get_public(blk)->throttle_group_member;
+    throttle_group_register_tgm(tgm, "credit", blk_get_aio_context(blk));
+
+    /* the bucket holds 100 bytes */
+    throttle_config_init(&cfg1);
+    cfg1.buckets[THROTTLE_BPS_READ].avg = 1000;
+    throttle_group_config(tgm, &cfg1);
+
+    /* this request leaves the rest of the bucket as credit */
+    g_assert(group_request(&req, tgm, 4, THROTTLE_READ));
+
+    /* the bucket is empty again after this, but the credit is stale */
+    virtual_clock_ns += NANOSECONDS_PER_SECOND;
+
+    /* a burst may fill the bucket once, and one more request may go
+     * through at a level of 100 bytes, as without credit: 104 bytes */
+    while (group_request(&req, tgm, 4, THROTTLE_READ)) {
+        burst += 4;
+        g_assert_cmpint(burst, <=, 200);
+    }
+    g_assert_cmpint(burst, >=, 100);
+    g_assert_cmpint(burst, <=, 108);
+
+    group_wait(&req);
+
+    throttle_group_unregister_tgm(tgm);
+    blk_unref(blk);
+}
+
+static void test_group_credit_total(void)
+{
+    ThrottleConfig cfg1;
+    BlockBackend *blk;
+    ThrottleGroupMember *tgm;
+    GroupRequest req, req2;
+    int64_t burst;
+
+    blk = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    tgm = &blk_get_public(blk)->throttle_group_member;
+    throttle_group_register_tgm(tgm, "credit-total", blk_get_aio_context(blk));
+
+    /* the bucket holds 100 bytes of reads and writes */
+    throttle_config_init(&cfg1);
+    cfg1.buckets[THROTTLE_BPS_TOTAL].avg = 1000;
+    throttle_group_config(tgm, &cfg1);
+
+    /* this read leaves the rest of the bucket as read credit */
+    g_assert(group_request(&req, tgm, 4, THROTTLE_READ));
+    burst = 4;
+
+    /* the unused read credit must not keep writes from filling the bucket */
+    while (group_request(&req, tgm, 4, THROTTLE_WRITE)) {
+        burst += 4;
+        g_assert_cmpint(burst, <=, 200);
+    }
+    g_assert_cmpint(burst, >=, 100);
+    g_assert_cmpint(burst, <=, 108);
+
+    /* and reads must not overtake the waiting write on credit */
+    g_assert(!group_request(&req2, tgm, 4, THROTTLE_READ));
+
+    group_wait(&req);
+    group_wait(&req2);
+
+    throttle_group_unregister_tgm(tgm);
+    blk_unref(blk);
+}
+
 int main(int argc, char **argv)
 {
     qemu_init_main_loop(&error_fatal);
@@ -808,6 +988,9 @@ int main(int argc, char **argv)
     bdrv_init();
     module_call_init(MODULE_INIT_QOM);
 
+    /* let throttle groups use the virtual clock */
+    qtest_allowed = true;
+
     do {} while (g_main_context_iteration(NULL, false));
 
     /* tests in the same order as the header function declarations */
@@ -829,7 +1012,10 @@ int main(int argc, char **argv)
                     test_iops_size_is_missing_limit);
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
+    g_test_add_func("/throttle/credit",             test_credit);
     g_test_add_func("/throttle/groups",             test_groups);
+    g_test_add_func("/throttle/group_credit",       test_group_credit);
+    g_test_add_func("/throttle/group_credit_total", test_group_credit_total);
     return g_test_run();
 }
 
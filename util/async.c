@@ -385,6 +385,13 @@ aio_ctx_finalize(GSource     *source)
         luring_cleanup(ctx->linux_io_uring);
         ctx->linux_io_uring = NULL;
     }
+    for (int i = 0; i < AIO_MAX_POLLED_LURINGS; i++) {
+        if (ctx->linux_io_uring_polled[i]) {
+            luring_detach_aio_context(ctx->linux_io_uring_polled[i], ctx);
+            luring_cleanup(ctx->linux_io_uring_polled[i]);
+            ctx->linux_io_uring_polled[i] = NULL;
+        }
+    }
 #endif
 
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
@@ -463,25 +470,60 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 #endif
 
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
+/*
+ * Return the slot for the ring with @setup, which is empty if there is no
+ * such ring yet, or NULL if all slots are taken by other setups.
+ */
+static LuringState **aio_find_linux_io_uring(AioContext *ctx,
+                                             const LuringSetup *setup)
 {
-    if (ctx->linux_io_uring) {
-        return ctx->linux_io_uring;
+    int i;
+
+    if (!setup) {
+        return &ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
-    if (!ctx->linux_io_uring) {
+    /* Slots are filled in order and only freed with the AioContext */
+    for (i = 0; i < AIO_MAX_POLLED_LURINGS; i++) {
+        LuringState *s = ctx->linux_io_uring_polled[i];
+
+        if (!s || luring_has_setup(s, setup)) {
+            return &ctx->linux_io_uring_polled[i];
+        }
+    }
+    return NULL;
+}
+
+LuringState *aio_setup_linux_io_uring(AioContext *ctx,
+                                      const LuringSetup *setup,
+                                      Error **errp)
+{
+    LuringState **s = aio_find_linux_io_uring(ctx, setup);
+
+    if (!s) {
+        error_setg(errp, "Too many different io_uring setups in one "
+                   "AioContext");
         return NULL;
     }
+    if (*s) {
+        return *s;
+    }
 
-    luring_attach_aio_context(ctx->linux_io_uring, ctx);
-    return ctx->linux_io_uring;
+    *s = luring_init(setup, errp);
+    if (!*s) {
+        return NULL;
+    }
+
+    luring_attach_aio_context(*s, ctx);
+    return *s;
 }
 
-LuringState *aio_get_linux_io_uring(AioContext *ctx)
+LuringState *aio_get_linux_io_uring(AioContext *ctx, const LuringSetup *setup)
 {
-    assert(ctx->linux_io_uring);
-    return ctx->linux_io_uring;
+    LuringState **s = aio_find_linux_io_uring(ctx, setup);
+
+    assert(s && *s);
+    return *s;
 }
 #endif
 
@@ -603,6 +645,7 @@ AioContext *aio_context_new(Error **errp)
 
 #ifdef CONFIG_LINUX_IO_URING
     ctx->linux_io_uring = NULL;
+    memset(ctx->linux_io_uring_polled, 0, sizeof(ctx->linux_io_uring_polled));
 #endif
 
     ctx->thread_pool = NULL;
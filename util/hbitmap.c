@@ -14,6 +14,7 @@
 #include "qemu/host-utils.h"
 #include "trace.h"
 #include "crypto/hash.h"
+#include "host/cpuinfo.h"
 
 /* HBitmaps provides an array of bits.  The bits are stored as usual in an
  * array of unsigned longs, but HBitmap is also optimized to provide fast
@@ -101,6 +102,64 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/* Runs shorter than this many words are not worth the vector setup.  */
+#define HBITMAP_FIND_ACCEL_MIN  (128 / sizeof(unsigned long))
+
+typedef size_t (*hbitmap_find_fn)(const unsigned long *, size_t, size_t);
+
+/* Return the index of the first word in [pos, end) that is not all ones,
+ * or @end if there is none.
+ */
+static size_t hbitmap_find_not_full_int(const unsigned long *words,
+                                        size_t pos, size_t end)
+{
+    while (pos < end && words[pos] == (unsigned long)-1) {
+        pos++;
+    }
+    return pos;
+}
+
+/* Same, for at least HBITMAP_FIND_ACCEL_MIN words.  */
+static size_t hbitmap_find_not_full_int_ge(const unsigned long *words,
+                                           size_t pos, size_t end)
+{
+    while (end - pos >= 4 &&
+           (words[pos] & words[pos + 1] &
+            words[pos + 2] & words[pos + 3]) == (unsigned long)-1) {
+        pos += 4;
+    }
+    return hbitmap_find_not_full_int(words, pos, end);
+}
+
+#include "host/hbitmap.c.inc"
+
+static hbitmap_find_fn hbitmap_find_not_full_accel;
+static unsigned accel_index;
+
+static size_t hbitmap_find_not_full(const unsigned long *words,
+                                    size_t pos, size_t end)
+{
+    if (end - pos >= HBITMAP_FIND_ACCEL_MIN) {
+        return hbitmap_find_not_full_accel(words, pos, end);
+    }
+    return hbitmap_find_not_full_int(words, pos, end);
+}
+
+bool test_hbitmap_find_next_accel(void)
+{
+    if (accel_index != 0) {
+        hbitmap_find_not_full_accel = accel_table[--accel_index];
+        return true;
+    }
+    return false;
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    accel_index = best_accel();
+    hbitmap_find_not_full_accel = accel_table[accel_index];
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -245,10 +304,8 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        /* Upper levels only track set bits, so this must scan every word.  */
+        pos = hbitmap_find_not_full(last_lev, pos + 1, sz);
         if (pos >= sz) {
             return -1;
         }
@@ -87,6 +87,29 @@ static int64_t throttle_do_compute_wait(double limit, double extra)
     return wait;
 }
 
+/* compute the size of the buckets of a leaky bucket
+ *
+ * @bkt:               the leaky bucket we operate on
+ * @bucket_size:       I/O before throttling to bkt->avg
+ * @burst_bucket_size: I/O before throttling to bkt->max
+ */
+static void throttle_bucket_size(LeakyBucket *bkt, double *bucket_size,
+                                 double *burst_bucket_size)
+{
+    if (!bkt->max) {
+        /* If bkt->max is 0 we still want to allow short bursts of I/O
+         * from the guest, otherwise every other request will be throttled
+         * and performance will suffer considerably. */
+        *bucket_size = (double) bkt->avg / 10;
+        *burst_bucket_size = 0;
+    } else {
+        /* If we have a burst limit then we have to wait until all I/O
+         * at burst rate has finished before throttling to bkt->avg */
+        *bucket_size = bkt->max * bkt->burst_length;
+        *burst_bucket_size = (double) bkt->max / 10;
+    }
+}
+
 /* This function compute the wait time in ns that a leaky bucket should trigger
  *
  * @bkt: the leaky bucket we operate on
@@ -102,18 +125,7 @@ int64_t throttle_compute_wait(LeakyBucket *bkt)
         return 0;
     }
 
-    if (!bkt->max) {
-        /* If bkt->max is 0 we still want to allow short bursts of I/O
-         * from the guest, otherwise every other request will be throttled
-         * and performance will suffer considerably. */
-        bucket_size = (double) bkt->avg / 10;
-        burst_bucket_size = 0;
-    } else {
-        /* If we have a burst limit then we have to wait until all I/O
-         * at burst rate has finished before throttling to bkt->avg */
-        bucket_size = bkt->max * bkt->burst_length;
-        burst_bucket_size = (double) bkt->max / 10;
-    }
+    throttle_bucket_size(bkt, &bucket_size, &burst_bucket_size);
 
     /* If the main bucket is full then we have to wait */
     extra = bkt->level - bucket_size;
@@ -462,6 +474,43 @@ bool throttle_schedule_timer(ThrottleState *ts,
     return true;
 }
 
+static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
+    { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+    { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+};
+static const BucketType bucket_types_units[THROTTLE_MAX][2] = {
+    { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+    { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+};
+
+/* add (or, if negative, remove) I/O to the buckets of a direction
+ *
+ * @direction: throttle direction
+ * @size:      the number of bytes
+ * @units:     the number of operations
+ */
+static void throttle_do_account(ThrottleState *ts, ThrottleDirection direction,
+                                double size, double units)
+{
+    unsigned i;
+
+    for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
+        LeakyBucket *bkt;
+
+        bkt = &ts->cfg.buckets[bucket_types_size[direction][i]];
+        bkt->level = MAX(bkt->level + size, 0);
+        if (bkt->burst_length > 1) {
+            bkt->burst_level = MAX(bkt->burst_level + size, 0);
+        }
+
+        bkt = &ts->cfg.buckets[bucket_types_units[direction][i]];
+        bkt->level = MAX(bkt->level + units, 0);
+        if (bkt->burst_length > 1) {
+            bkt->burst_level = MAX(bkt->burst_level + units, 0);
+        }
+    }
+}
+
 /* do the accounting for this operation
  *
  * @direction: throttle direction
@@ -470,16 +519,7 @@ bool throttle_schedule_timer(ThrottleState *ts,
 void throttle_account(ThrottleState *ts, ThrottleDirection direction,
                       uint64_t size)
 {
-    static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
-        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
-        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
-    };
-    static const BucketType bucket_types_units[THROTTLE_MAX][2] = {
-        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
-        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
-    };
     double units = 1.0;
-    unsigned i;
 
     assert(direction < THROTTLE_MAX);
     /* if cfg.op_size is defined and smaller than size we compute unit count */
@@ -487,21 +527,95 @@ void throttle_account(ThrottleState *ts, ThrottleDirection direction,
         units = (double) size / ts->cfg.op_size;
     }
 
-    for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
-        LeakyBucket *bkt;
+    throttle_do_account(ts, direction, size, units);
+}
 
-        bkt = &ts->cfg.buckets[bucket_types_size[direction][i]];
-        bkt->level += size;
-        if (bkt->burst_length > 1) {
-            bkt->burst_level += size;
-        }
+/* return how much I/O can still be added to a leaky bucket before requests
+ * have to wait, but no more than @room
+ *
+ * @bkt:  the leaky bucket we operate on
+ * @room: the upper limit for the result
+ */
+static double throttle_bucket_room(LeakyBucket *bkt, double room)
+{
+    double bucket_size, burst_bucket_size;
 
-        bkt = &ts->cfg.buckets[bucket_types_units[direction][i]];
-        bkt->level += units;
-        if (bkt->burst_length > 1) {
-            bkt->burst_level += units;
-        }
+    if (!bkt->avg) {
+        return room;
     }
+
+    throttle_bucket_size(bkt, &bucket_size, &burst_bucket_size);
+    room = MIN(room, bucket_size - bkt->level);
+    if (bkt->burst_length > 1) {
+        room = MIN(room, burst_bucket_size - bkt->burst_level);
+    }
+    return MAX(room, 0);
+}
+
+/* account in advance for as much I/O as can be done without waiting
+ *
+ * The caller can then let requests through without calling
+ * throttle_schedule_timer() and throttle_account() while they fit in the
+ * credit.  The buckets keep leaking while the credit is not used, so
+ * credit that is used at once never lets requests pass where they would
+ * have had to wait otherwise, but older credit adds to what the buckets
+ * allow.  Callers must therefore stop using credit after a short time.
+ * Unused credit must be given back with throttle_return_credit() before
+ * the next call to throttle_schedule_timer().  This applies to the other
+ * direction as well if total limits are set, because the credit is then
+ * also accounted in the total buckets.
+ *
+ * No credit is given if cfg.op_size is set, because the number of
+ * operations then depends on the size of the requests.
+ *
+ * @direction: throttle direction
+ * @now:       the current clock timestamp
+ * @bytes:     the maximum number of bytes, set to the bytes granted
+ * @ops:       the maximum number of operations, set to the operations granted
+ */
+void throttle_grant_credit(ThrottleState *ts, ThrottleDirection direction,
+                           int64_t now, uint64_t *bytes, uint64_t *ops)
+{
+    double room_bytes = *bytes;
+    double room_ops = *ops;
+    unsigned i;
+
+    assert(direction < THROTTLE_MAX);
+    *bytes = *ops = 0;
+    if (ts->cfg.op_size) {
+        return;
+    }
+
+    throttle_do_leak(ts, now);
+
+    for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
+        room_bytes = throttle_bucket_room(
+            &ts->cfg.buckets[bucket_types_size[direction][i]], room_bytes);
+        room_ops = throttle_bucket_room(
+            &ts->cfg.buckets[bucket_types_units[direction][i]], room_ops);
+    }
+
+    if (room_bytes < 1 || room_ops < 1) {
+        return;
+    }
+
+    *bytes = room_bytes;
+    *ops = room_ops;
+    throttle_do_account(ts, direction, *bytes, *ops);
+}
+
+/* give back credit that throttle_grant_credit() accounted for but that was
+ * not used
+ *
+ * @direction: throttle direction
+ * @bytes:     the number of unused bytes
+ * @ops:       the number of unused operations
+ */
+void throttle_return_credit(ThrottleState *ts, ThrottleDirection direction,
+                            uint64_t bytes, uint64_t ops)
+{
+    assert(direction < THROTTLE_MAX);
+    throttle_do_account(ts, direction, -(double) bytes, -(double) ops);
 }
 
 /* return a ThrottleConfig based on the options in a ThrottleLimits
@@ -191,16 +191,21 @@ void qemu_vfio_pci_unmap_bar(QEMUVFIOState *s, int index, void *bar,
 }
 
 /**
- * Initialize device IRQ with @irq_type and register an event notifier.
+ * Initialize up to @count device IRQs with @irq_type and register the event
+ * notifiers in the array @e for them.  Return the number of IRQs that were
+ * set up, which is less than @count if the device does not have that many,
+ * or a negative errno on failure.
  */
 int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
-                           int irq_type, Error **errp)
+                           unsigned count, int irq_type, Error **errp)
 {
     int r;
+    unsigned i;
     struct vfio_irq_set *irq_set;
     size_t irq_set_size;
     struct vfio_irq_info irq_info = { .argsz = sizeof(irq_info) };
 
+    assert(count > 0);
     irq_info.index = irq_type;
     if (ioctl(s->device, VFIO_DEVICE_GET_IRQ_INFO, &irq_info)) {
         error_setg_errno(errp, errno, "Failed to get device interrupt info");
@@ -210,8 +215,13 @@ int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
         error_setg(errp, "Device interrupt doesn't support eventfd");
         return -EINVAL;
     }
+    if (!irq_info.count) {
+        error_setg(errp, "Device has no interrupts of this type");
+        return -EINVAL;
+    }
+    count = MIN(count, irq_info.count);
 
-    irq_set_size = sizeof(*irq_set) + sizeof(int);
+    irq_set_size = sizeof(*irq_set) + count * sizeof(int);
     irq_set = g_malloc0(irq_set_size);
 
     /* Get to a known IRQ state */
@@ -220,17 +230,19 @@ int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
         .flags = VFIO_IRQ_SET_DATA_EVENTFD | VFIO_IRQ_SET_ACTION_TRIGGER,
         .index = irq_info.index,
         .start = 0,
-        .count = 1,
+        .count = count,
     };
 
-    *(int *)&irq_set->data = event_notifier_get_fd(e);
+    for (i = 0; i < count; i++) {
+        ((int *)&irq_set->data)[i] = event_notifier_get_fd(&e[i]);
+    }
     r = ioctl(s->device, VFIO_DEVICE_SET_IRQS, irq_set);
     g_free(irq_set);
     if (r) {
         error_setg_errno(errp, errno, "Failed to setup device interrupt");
         return -errno;
     }
-    return 0;
+    return count;
 }
 
 static int qemu_vfio_pci_read_config(QEMUVFIOState *s, void *buf,